@@ -14,7 +14,20 @@ char the_summary[] =
    "Astrology Reporter\n\n"
    "Outputs astrology data about an event. If no event is specified,\n"
    "uses the current time. The event should be specified according to\n"
-   "ISO standard dates. Available house systems are:\n\n"
+   "ISO standard dates. With --stdin or --input, events are read one\n"
+   "per line, as name,date,time,coords, and reported as they come.\n"
+   "With --store, charts are added to a sqlite database instead, and\n"
+   "--from-store reports on the charts of such a database, or, with\n"
+   "--query, on those where every term of a query is true, as in\n"
+   "\"Sun 10-12 Leo, Moon water, Mars angular P\" (see index.c).\n"
+   "With --stats, charts are counted by sign, degree, house and aspect\n"
+   "into a file instead; --test-stats merges such files, as of shards\n"
+   "of a dataset, and does chi-square tests on them. With --controls,\n"
+   "the events are also counted in as many control groups, shuffled\n"
+   "as --control-kind says, and tested against them.\n"
+   "With --script, a function of a Lua script is called on each chart,\n"
+   "and whatever it returns is printed (see script.c).\n"
+   "Available house systems are:\n\n"
    "P Placidus     K Koch           T Topocentric\n"
    "C Campanus     M Morinus        U Krusinski-Pisa-Goelzer\n"
    "O Porphyrius   L Pullen SD      Q Pullen SR\n"
@@ -29,7 +42,22 @@ int pts[64] = { 0,1,2,3,4,5,6,7,8,9,11, SE_END };
 static char* opt_sys = "PTK"; //in order of popularity
 static char* opt_geo = "0,0";
 static char* opt_fmt = NULL;
+static char* opt_input = NULL;
+static int opt_jobs = 1;
+static char* opt_archive = NULL;
+static char* opt_store = NULL;
+static char* opt_from_store = NULL;
+static char* opt_query = NULL;
+static char* opt_stats = NULL;
+static char* opt_test_stats = NULL;
+static char* opt_baseline = NULL;
+static int opt_controls = 0;
+static char* opt_control_kind = "times";
+static int opt_seed = 0;
+static char* opt_script = NULL;
+static char* opt_map = "map";
 static Datum opt_geo_d;
+static PointFormat* point_fmt; // of opt_fmt, compiled once
 static char* geo_rio = "-23,-43"; //UGLY to hardcode this
 
 #define OPTIONS \
@@ -40,11 +68,13 @@ FMT('u', houses,"Show house cusps") \
 FMT('a', asp,   "Show aspect table") \
 FMT('i', lit,   "Output C language literal") \
 FMT('c', csv,   "Output comma sepparated values") \
+FMT( 0 , json,  "Output one line of JSON per event, and nothing else") \
 FMT('C', ceres, "Include dwarf planet Ceres") \
 FMT('E', eris,  "Include dwarf planet Eris") \
 FMT('K', chiron,"Include comet Chiron") \
 FMT('A', asts,  "Include main asteroids") \
 FMT('U', ura,   "Include Uranian fictious planets") \
+FMT( 0 , stdin, "Read events from standard input, one per line") \
 FMT('t', tst,   "temporary - run test()")
 ///@todo include opt for NO Inners
 ///@todo include opt for NO Pluto
@@ -75,6 +105,62 @@ parse_arguments( int* num_of_args, char** args[] )
          "fmt", 'f', 0, G_OPTION_ARG_STRING,  &opt_fmt,
          "Point table format", NULL
          },
+         {
+         "input", 'I', 0, G_OPTION_ARG_FILENAME, &opt_input,
+         "Read events from FILE, one per line", "FILE"
+         },
+         {
+         "archive", 0, 0, G_OPTION_ARG_FILENAME, &opt_archive,
+         "Append charts to archive FILE, instead of reporting", "FILE"
+         },
+         {
+         "store", 0, 0, G_OPTION_ARG_FILENAME, &opt_store,
+         "Add charts to the sqlite store FILE, instead of reporting", "FILE"
+         },
+         {
+         "from-store", 0, 0, G_OPTION_ARG_FILENAME, &opt_from_store,
+         "Report every chart in the sqlite store FILE", "FILE"
+         },
+         {
+         "query", 0, 0, G_OPTION_ARG_STRING, &opt_query,
+         "With --from-store, report only the charts where Q is true", "Q"
+         },
+         {
+         "stats", 0, 0, G_OPTION_ARG_FILENAME, &opt_stats,
+         "Count the charts into stats FILE, instead of reporting", "FILE"
+         },
+         {
+         "test-stats", 0, 0, G_OPTION_ARG_STRING, &opt_test_stats,
+         "Merge the stats FILEs, comma separated, and test them", "FILES"
+         },
+         {
+         "baseline", 0, 0, G_OPTION_ARG_FILENAME, &opt_baseline,
+         "With --test-stats, test against stats FILE, not even counts", "FILE"
+         },
+         {
+         "controls", 0, 0, G_OPTION_ARG_INT, &opt_controls,
+         "With --stats, also count K control groups, into FILE.control", "K"
+         },
+         {
+         "control-kind", 0, 0, G_OPTION_ARG_STRING, &opt_control_kind,
+         "Shuffle the times or places of the controls, or draw their dates", "times|places|dates"
+         },
+         {
+         "seed", 0, 0, G_OPTION_ARG_INT, &opt_seed,
+         "Seed of the random controls, the same seed makes the same controls", "N"
+         },
+         {
+         "script", 0, 0, G_OPTION_ARG_FILENAME, &opt_script,
+         "Print what a function of Lua FILE returns for each chart", "FILE"
+         },
+         {
+         "map", 0, 0, G_OPTION_ARG_STRING, &opt_map,
+         "With --script, the function to call, map by default", "FN"
+         },
+         {
+         "jobs", 'J', 0, G_OPTION_ARG_INT, &opt_jobs,
+         "Make charts on N threads, output stays in order", "N"
+         },
       OPTIONS
          { NULL }
       };
@@ -143,6 +229,7 @@ parse_arguments( int* num_of_args, char** args[] )
       else
          { printf("failed to parse: %s\n", (*args)[i] ); }
       }
+   if ( c == 0 && ( opt_stdin || opt_input || opt_from_store || opt_test_stats ) ) { return; }
    if ( c == 0 ) //???SHOULD THIS BE if num_of_args == 1?????
       {
       events[0] = calloc( 1, sizeof(Event) );
@@ -156,13 +243,13 @@ parse_arguments( int* num_of_args, char** args[] )
 //*//
 intern
 void
-test( Chart* c )
+test( Chart* c, FILE* out )
    {
-   puts( "running test() func" );
-   printf( "aspect count: %i\n", c->asp_count );
+   fputs( "running test() func\n", out );
+   fprintf( out, "aspect count: %i\n", c->asp_count );
    for( int i = 0; i < c->asp_count; i++ )
       {
-      printf( "%s %s %s kind: %i score: %f\n",
+      fprintf( out, "%s %s %s kind: %i score: %f\n",
          c->points[c->aspects[i].point1].symbol,
          c->aspects[i].symbol,
          c->points[c->aspects[i].point2].symbol,
@@ -182,23 +269,31 @@ test( Chart* c )
 
 intern
 void
-spit( char* s )
+spit( char* s, FILE* out )
    {
-   puts( s );
+   fprintf( out, "%s\n", s );
    free( s );
    }
 
-/** process_event( ev ) reports on each of the events provided on the
- * command line according to what was requested.
- * 
- * @param ev An Event* structure.
+/** report_chart( c ) reports on a chart according to what was
+ * requested.
+ *
+ * @param c A Chart* structure.
+ * @param cf The ChartConfig of the chart.
+ * @param out Where the report goes.
  */
 intern
 void
-process_event( Event* ev )
+report_chart( Chart* c, ChartConfig* cf, FILE* out )
    {
    char buff[NAME_SIZE];
-   Chart* c;
+   Event* ev = c->ev;
+   Sink sk = sink_of_file( out );
+   if ( opt_json )
+      {
+      put_json( &sk, c, cf );
+      return;
+      }
    /* -- do stuff according to what the user requests
    if( opt_ )
       {
@@ -206,68 +301,728 @@ process_event( Event* ev )
    */
    if ( !opt_quiet )
       {
-      printf( "\nname:  %s\n", ev->name );
+      fprintf( out, "\nname:  %s\n", ev->name );
       to_datetag( buff, ev->jdn );
-      printf( "time:  %s\n", buff );
+      fprintf( out, "time:  %s\n", buff );
       to_coords(buff,ev);
-      printf( "place: %s\n", buff );
+      fprintf( out, "place: %s\n", buff );
       }
    if( opt_jdn )
       {
-      printf( "day number: %.3f\n", ev->jdn );
+      fprintf( out, "day number: %.3f\n", ev->jdn );
       }
-   ///@maybe avoid calculating chart if no astro data requested
-   c = make_chart_of_event( ev );
    if( !opt_quiet )
       {
-      char* s;
-      if( opt_fmt )
-         { s = make_point_table(c, opt_fmt); }
-      else
-         { s = make_point_table(c, "|$Y| $N | $U |$S |$d |$C|"); }
-      puts(s);
-      free(s);
+      put_point_table_with( &sk, c, point_fmt );
+      sink_put( &sk, "\n", 1 );
       }
    if( opt_houses )
       {
-      spit( make_house_table(c) );
+      put_house_table( &sk, c );
+      sink_put( &sk, "\n", 1 );
       }
    if( opt_asp )
       {
-      spit(  make_aspect_table(c) );
+      spit(  make_aspect_table(c), out );
       }
    if( opt_csv )
       {
-      spit(  make_csv_list(c) );
+      put_csv_list( &sk, c );
+      sink_put( &sk, "\n", 1 );
       }
    if( opt_lit )
       {
-      spit(  make_c_literal(c) );
+      put_c_literal( &sk, c );
+      sink_put( &sk, "\n", 1 );
       }
    if( opt_tst ) /* -- TESTING ---------------------------------------*/
       {
-      test( c );
+      test( c, out );
+      }
+   }
+
+/** process_event( ev ) reports on each of the events provided on the
+ * command line according to what was requested.
+ * 
+ * @param ev An Event* structure.
+ * @param out Where the report goes.
+ */
+intern
+void
+process_event( Event* ev, FILE* out )
+   {
+   ///@maybe avoid calculating chart if no astro data requested
+   Chart* c = make_chart_of_event( ev );
+   report_chart( c, get_chart_config(), out );
+   dump_chart( c );
+   }
+
+//---- WORKER POOL ---------------------------------------------------//
+//-- With --jobs N, events go to N worker threads, each reporting into
+//-- a memory stream. The main thread keeps a ring of the last few
+//-- events, and prints each report once all earlier ones are printed,
+//-- so output keeps the order of input and memory stays bounded no
+//-- matter how many events are streamed.
+#define RING_PER_JOB 4
+
+/** struct Job is one event on its way through the pool */
+typedef struct Job
+   {
+   Event* ev;
+   gboolean owned; // ev is dumped once reported
+   gboolean done;
+   char* text;
+   size_t len;
+   }
+Job;
+
+static struct
+   {
+   GThread** workers;
+   int count;
+   GAsyncQueue* todo;
+   GMutex lock;
+   GCond done;
+   Job* ring;
+   int size;
+   long next_in; // sequence of the next event submitted
+   long next_out; // sequence of the next report printed
+   }
+pool;
+static Job stop_job; // tells a worker to quit
+
+intern
+gpointer
+pool_worker( gpointer unused )
+   {
+   init_ephemeris_thread();
+   for ( ;; )
+      {
+      Job* j = g_async_queue_pop( pool.todo );
+      if ( j == &stop_job ) { break; }
+      char* text;
+      size_t len;
+      FILE* out = open_memstream( &text, &len );
+      enforce( "open report stream", out );
+      process_event( j->ev, out );
+      fclose( out );
+      g_mutex_lock( &pool.lock );
+      j->text = text;
+      j->len = len;
+      j->done = TRUE;
+      g_cond_broadcast( &pool.done );
+      g_mutex_unlock( &pool.lock );
+      }
+   end_ephemeris_thread();
+   return NULL;
+   }
+
+/** print_job() prints the oldest report, waiting for it if @p wait.
+ * @return FALSE if it was not ready.
+ */
+intern
+gboolean
+print_job( gboolean wait )
+   {
+   Job* j = pool.ring + pool.next_out % pool.size;
+   g_mutex_lock( &pool.lock );
+   while ( wait && !j->done ) { g_cond_wait( &pool.done, &pool.lock ); }
+   gboolean ready = j->done;
+   g_mutex_unlock( &pool.lock );
+   if ( !ready ) { return FALSE; }
+   fwrite( j->text, 1, j->len, stdout );
+   free( j->text );
+   if ( j->owned ) { dump_event( j->ev ); }
+   j->done = FALSE;
+   pool.next_out++;
+   return TRUE;
+   }
+
+intern
+void
+start_pool( int count )
+   {
+   pool.count = count;
+   pool.size = RING_PER_JOB * count;
+   pool.ring = calloc( pool.size, sizeof( Job ) );
+   pool.todo = g_async_queue_new();
+   pool.workers = malloc( sizeof( GThread* ) * count );
+   g_mutex_init( &pool.lock );
+   g_cond_init( &pool.done );
+   for ( int i = 0; i < count; i++ )
+      {
+      pool.workers[i] = g_thread_new( "ar_worker", pool_worker, NULL );
+      }
+   }
+
+intern
+void
+end_pool()
+   {
+   while ( pool.next_out < pool.next_in ) { print_job( TRUE ); }
+   for ( int i = 0; i < pool.count; i++ ) { g_async_queue_push( pool.todo, &stop_job ); }
+   for ( int i = 0; i < pool.count; i++ ) { g_thread_join( pool.workers[i] ); }
+   g_async_queue_unref( pool.todo );
+   g_mutex_clear( &pool.lock );
+   g_cond_clear( &pool.done );
+   free( pool.workers );
+   free( pool.ring );
+   pool.count = 0;
+   }
+
+//---- ARCHIVING -----------------------------------------------------//
+//-- With --archive, events are only kept until there are enough of
+//-- them to fill a ChartBatch, which is then appended to the archive.
+#define ARCHIVE_BATCH 4096
+
+static struct
+   {
+   ChartBatch* b;
+   Event evs[ARCHIVE_BATCH];
+   int count;
+   long written;
+   }
+to_archive;
+
+intern
+void
+flush_archive()
+   {
+   if ( to_archive.count == 0 ) { return; }
+   if ( !to_archive.b ) { to_archive.b = make_chart_batch( get_chart_config(), ARCHIVE_BATCH ); }
+   fill_chart_batch( to_archive.b, to_archive.evs, to_archive.count );
+   if ( append_to_archive( opt_archive, to_archive.b ) < 0 ) { exit( 1 ); }
+   to_archive.written += to_archive.count;
+   to_archive.count = 0;
+   }
+
+intern
+void
+archive_event( Event* ev )
+   {
+   to_archive.evs[to_archive.count] = *ev;
+   to_archive.evs[to_archive.count++].name = NULL; // batches have no names
+   if ( to_archive.count == ARCHIVE_BATCH ) { flush_archive(); }
+   }
+
+//---- COUNTING ------------------------------------------------------//
+//-- With --stats, events are kept until there are enough of them to
+//-- share among --jobs threads, which count them with fill_chart_stats().
+//-- With --controls, every event is also kept, to make the controls of.
+#define STATS_EVENTS 16384
+
+static ChartStats* stats;
+static struct
+   {
+   Event evs[STATS_EVENTS];
+   int count;
+   }
+to_count;
+static struct
+   {
+   Event* evs;
+   int count;
+   int size;
+   }
+kept;
+
+intern
+void
+flush_stats()
+   {
+   fill_chart_stats( stats, to_count.evs, to_count.count, opt_jobs );
+   to_count.count = 0;
+   }
+
+intern
+void
+keep_event( Event* ev )
+   {
+   if ( kept.count == kept.size )
+      {
+      kept.size = kept.size ? 2 * kept.size : STATS_EVENTS;
+      kept.evs = realloc( kept.evs, sizeof( Event ) * kept.size );
+      enforce( "keep events for controls", kept.evs );
+      }
+   kept.evs[kept.count] = *ev;
+   kept.evs[kept.count++].name = NULL;
+   }
+
+intern
+void
+count_event( Event* ev )
+   {
+   if ( opt_controls > 0 ) { keep_event( ev ); }
+   to_count.evs[to_count.count] = *ev;
+   to_count.evs[to_count.count++].name = NULL; // not needed to count
+   if ( to_count.count == STATS_EVENTS ) { flush_stats(); }
+   }
+
+/** control_kind() is the CONTROL_ kind named by --control-kind, or -1. */
+intern
+int
+control_kind()
+   {
+   char* kinds[] = { "times", "places", "dates" };
+   for ( int k = 0; k < G_N_ELEMENTS( kinds ); k++ )
+      {
+      if ( strcmp( opt_control_kind, kinds[k] ) == 0 ) { return k; }
+      }
+   return -1;
+   }
+
+/** print_p() prints a line of the report of test_controls(). */
+intern
+void
+print_p( char* what, double p )
+   {
+   if ( p < 0.0 ) { return; }
+   printf( "   %-24s p %.4g\n", what, p );
+   }
+
+/** test_controls() counts --controls controls of the kept events, saves
+ * them merged into the --stats file with .control added, which is a
+ * baseline for --test-stats, and prints how often a control deviates
+ * from the others as much as the counted stats do.
+ */
+intern
+void
+test_controls()
+   {
+   ChartConfig* cf = stats->cf;
+   ChartStats** controls = make_control_stats( cf, kept.evs, kept.count, control_kind(),
+                                               opt_controls, opt_seed, opt_jobs );
+   ChartStats* all = merge_control_stats( controls, opt_controls );
+   char* path = g_strconcat( opt_stats, ".control", NULL );
+   if ( save_chart_stats( all, path ) < 0 ) { exit( 1 ); }
+   printf( "%d controls by %s counted in %s\n", opt_controls, opt_control_kind, path );
+   char name[50]; /* SWEPH address for planet name, at least 20 char */
+   char other[50];
+   char what[NAME_SIZE];
+   for ( int i = 0; i < cf->pt_count; i++ )
+      {
+      swe_get_planet_name( cf->pts[i], name );
+      printf( "%s\n", name );
+      print_p( "signs", control_p_value( stats, controls, opt_controls, all, STATS_SIGNS, i, 0 ) );
+      for ( int s = 0; s < cf->sys_count; s++ )
+         {
+         snprintf( what, NAME_SIZE, "houses %c", cf->systems[s] );
+         print_p( what, control_p_value( stats, controls, opt_controls, all, STATS_HOUSES, i, s ) );
+         }
+      for ( int j = i+1; j < cf->pt_count; j++ )
+         {
+         swe_get_planet_name( cf->pts[j], other );
+         snprintf( what, NAME_SIZE, "aspects to %s", other );
+         print_p( what, control_p_value( stats, controls, opt_controls, all, STATS_ASPECTS, i, j ) );
+         }
       }
+   g_free( path );
+   dump_chart_stats( all );
+   dump_control_stats( controls, opt_controls );
+   }
+
+/** end_stats() saves the stats to the --stats file, and tests them
+ * against their controls, with --controls.
+ */
+intern
+void
+end_stats()
+   {
+   flush_stats();
+   if ( save_chart_stats( stats, opt_stats ) < 0 ) { exit( 1 ); }
+   if ( !opt_quiet ) { printf( "%ld charts counted in %s\n", stats->count, opt_stats ); }
+   if ( opt_controls > 0 ) { test_controls(); }
+   dump_chart_stats( stats );
+   stats = NULL;
+   free( kept.evs );
+   kept.evs = NULL;
+   kept.count = kept.size = 0;
+   }
+
+/** print_test() prints a line of the report of test_stats(). */
+intern
+void
+print_test( char* what, ChiSquare x )
+   {
+   if ( x.dof == 0 ) { return; }
+   printf( "   %-24s chi2 %10.2f  dof %3d  p %.4g\n", what, x.chi2, x.dof, x.p );
+   }
+
+/** test_stats() merges the stats files of --test-stats and does the
+ * chi-square tests of their counts of signs and houses of each point,
+ * and, against a --baseline, of aspects between each pair.
+ */
+intern
+void
+test_stats()
+   {
+   ChartConfig* cf = get_chart_config();
+   ChartStats* all = make_chart_stats( cf );
+   ChartStats* base = NULL;
+   char** paths = g_strsplit( opt_test_stats, ",", -1 );
+   for ( int i = 0; paths[i]; i++ )
+      {
+      ChartStats* shard = load_chart_stats( paths[i], cf );
+      if ( !shard || merge_chart_stats( all, shard ) < 0 ) { exit( 1 ); }
+      dump_chart_stats( shard );
+      }
+   g_strfreev( paths );
+   if ( opt_baseline && !( base = load_chart_stats( opt_baseline, cf ) ) ) { exit( 1 ); }
+   printf( "%ld charts, against %s\n", all->count, base ? opt_baseline : "even counts" );
+   char name[50]; /* SWEPH address for planet name, at least 20 char */
+   char other[50];
+   char what[NAME_SIZE];
+   for ( int i = 0; i < cf->pt_count; i++ )
+      {
+      swe_get_planet_name( cf->pts[i], name );
+      printf( "%s\n", name );
+      print_test( "signs", test_chart_stats( all, base, STATS_SIGNS, i, 0 ) );
+      for ( int s = 0; s < cf->sys_count; s++ )
+         {
+         snprintf( what, NAME_SIZE, "houses %c", cf->systems[s] );
+         print_test( what, test_chart_stats( all, base, STATS_HOUSES, i, s ) );
+         }
+      for ( int j = i+1; base && j < cf->pt_count; j++ )
+         {
+         swe_get_planet_name( cf->pts[j], other );
+         snprintf( what, NAME_SIZE, "aspects to %s", other );
+         print_test( what, test_chart_stats( all, base, STATS_ASPECTS, i, j ) );
+         }
+      }
+   if ( base ) { dump_chart_stats( base ); }
+   dump_chart_stats( all );
+   }
+
+//---- STORING -------------------------------------------------------//
+//-- With --store, each chart is added to a sqlite store, which commits
+//-- them in big transactions; --from-store reports on the charts of a
+//-- store, as they were made, without the ephemeris.
+static ChartStore* store;
+static long stored;
+
+intern
+void
+store_event( Event* ev )
+   {
+   Chart* c = make_chart_of_event( ev );
+   if ( store_chart( store, c ) > 0 ) { stored++; }
    dump_chart( c );
    }
 
+//---- SCRIPTING -----------------------------------------------------//
+//-- With --script, events are kept, with their names, until there are
+//-- enough of them to share among the --jobs states of the script, and
+//-- what it returns for each is printed in the order of the events.
+#define SCRIPT_EVENTS 4096
+
+static Script* script;
+static struct
+   {
+   Event evs[SCRIPT_EVENTS];
+   int count;
+   long found; // charts the script returned something for
+   }
+to_script;
+
+intern
+void
+print_result( Event* ev, const char* text, void* data )
+   {
+   fprintf( data, "%s\n", text );
+   }
+
+intern
+void
+flush_script()
+   {
+   to_script.found += map_script( script, to_script.evs, to_script.count, print_result, stdout );
+   for ( int k = 0; k < to_script.count; k++ ) { g_free( to_script.evs[k].name ); }
+   to_script.count = 0;
+   }
+
+intern
+void
+script_event( Event* ev )
+   {
+   to_script.evs[to_script.count] = *ev;
+   to_script.evs[to_script.count++].name = g_strdup( ev->name );
+   if ( to_script.count == SCRIPT_EVENTS ) { flush_script(); }
+   }
+
+/** use_chart() counts a chart of a store with --stats, runs the script
+ * on it with --script, or reports on it.
+ * @param c A Chart* structure.
+ * @param cf The ChartConfig of the store.
+ */
+intern
+void
+use_chart( Chart* c, ChartConfig* cf )
+   {
+   if ( stats )
+      {
+      add_chart_to_stats( stats, c );
+      if ( opt_controls > 0 ) { keep_event( c->ev ); }
+      }
+   else if ( script )
+      {
+      char* text = run_script( script, c );
+      if ( !text ) { return; }
+      print_result( c->ev, text, stdout );
+      to_script.found++;
+      free( text );
+      }
+   else { report_chart( c, cf, stdout ); }
+   }
+
+/** report_query() reports on the charts of a store where a query is
+ * true, found with a ChartIndex of the store.
+ * @return number of charts reported.
+ */
+intern
+long
+report_query( ChartStore* from, char* query )
+   {
+   ChartIndex* ix = index_chart_store( from );
+   if ( !ix ) { exit( 1 ); }
+   long* ids = malloc( sizeof( long ) * MAX( ix->count, 1 ) );
+   long count = query_chart_index( ix, query, ids, ix->count );
+   if ( count < 0 ) { exit( 1 ); }
+   for ( long i = 0; i < count; i++ )
+      {
+      Chart* c = load_chart( from, ids[i] );
+      use_chart( c, from->cf );
+      dump_chart( c );
+      }
+   if ( !opt_quiet ) { printf( "%ld of %ld charts found\n", count, ix->count ); }
+   free( ids );
+   dump_chart_index( ix );
+   return count;
+   }
+
+/** report_store() reports on every chart in a store, or on those where
+ * @p query is true, if not NULL.
+ * @return number of charts reported.
+ */
+intern
+long
+report_store( char* path, char* query )
+   {
+   ChartStore* from = open_chart_store( path, NULL );
+   if ( !from ) { exit( 1 ); }
+   if ( opt_stats ) { stats = make_chart_stats( from->cf ); }
+   long count = 0;
+   if ( query ) { count = report_query( from, query ); }
+   else
+      {
+      for ( long id = next_stored_chart( from, 0 ); id; id = next_stored_chart( from, id ) )
+         {
+         Chart* c = load_chart( from, id );
+         use_chart( c, from->cf );
+         dump_chart( c );
+         count++;
+         }
+      }
+   if ( stats ) { end_stats(); }
+   dump_chart_store( from );
+   return count;
+   }
+
+/** submit_event() reports on an event, right away or through the pool.
+ * @param ev An Event* structure.
+ * @param owned If TRUE, the event is dumped after it is reported.
+ */
+intern
+void
+submit_event( Event* ev, gboolean owned )
+   {
+   if ( opt_archive )
+      {
+      archive_event( ev );
+      if ( owned ) { dump_event( ev ); }
+      return;
+      }
+   if ( stats )
+      {
+      count_event( ev );
+      if ( owned ) { dump_event( ev ); }
+      return;
+      }
+   if ( script )
+      {
+      script_event( ev );
+      if ( owned ) { dump_event( ev ); }
+      return;
+      }
+   if ( opt_store )
+      {
+      store_event( ev );
+      if ( owned ) { dump_event( ev ); }
+      return;
+      }
+   if ( pool.count == 0 )
+      {
+      process_event( ev, stdout );
+      if ( owned ) { dump_event( ev ); }
+      return;
+      }
+   // the ring is full: wait for the oldest report
+   if ( pool.next_in - pool.next_out == pool.size ) { print_job( TRUE ); }
+   Job* j = pool.ring + pool.next_in++ % pool.size;
+   j->ev = ev;
+   j->owned = owned;
+   g_async_queue_push( pool.todo, j );
+   while ( pool.next_out < pool.next_in && print_job( FALSE ) ) { }
+   }
+
+/** stream_events() reads events one per line, as on the command line,
+ * and processes each before reading the next, so memory stays the same
+ * for any number of lines. Lines are parsed in place by parse_event(),
+ * and only the lines whose date it cannot read at all, such as month
+ * names of the locale, by make_event_of_string(); a date, time or place
+ * out of range is a failure. Empty lines and lines starting with # are
+ * skipped.
+ * @param in An open FILE*.
+ *
+ * @return number of lines that failed to parse.
+ */
+intern
+long
+stream_events( FILE* in )
+   {
+   char* line = NULL;
+   size_t size = 0;
+   ssize_t len;
+   long num = 0;
+   long failed = 0;
+   while ( ( len = getline( &line, &size, in ) ) != -1 )
+      {
+      num++;
+      while ( len > 0 && ( line[len-1] == '\n' || line[len-1] == '\r' ) )
+         {
+         line[--len] = '\0';
+         }
+      if ( len == 0 || line[0] == '#' ) { continue; }
+      EventSlice es;
+      if ( parse_event( line, len, &es ) == 0 )
+         {
+         // the name ends at its comma, which the parse is done with
+         char* name = line + ( es.name - line );
+         name[es.name_len] = '\0';
+         es.ev.name = name;
+         if ( pool.count == 0 ) { submit_event( &es.ev, FALSE ); }
+         else
+            {
+            // the pool reports later, so it needs an event of its own
+            Event* ev = malloc( sizeof( Event ) );
+            *ev = es.ev;
+            ev->name = strdup( es.ev.name );
+            submit_event( ev, TRUE );
+            }
+         continue;
+         }
+      // formats only the locale knows, such as month names in it
+      int other_format = !strcmp( es.why, "expected a date" ) || !strcmp( es.why, "expected a month" );
+      Event* ev = other_format ? make_event_of_string( line ) : NULL;
+      if ( !ev )
+         {
+         fprintf( stderr, "failed to parse line %ld at column %d, %s: %s\n",
+                  num, es.at + 1, es.why, line );
+         failed++;
+         continue;
+         }
+      submit_event( ev, TRUE );
+      }
+   free( line );
+   return failed;
+   }
+
 int
 main( int num_of_args, char* args[] )
    {
    // initialization
    parse_arguments( &num_of_args, &args );
+   if ( opt_query && !opt_from_store )
+      {
+      fprintf( stderr, "--query needs --from-store\n" );
+      exit( 1 );
+      }
+   if ( opt_controls > 0 && ( !opt_stats || control_kind() < 0 ) )
+      {
+      fprintf( stderr, "--controls needs --stats, and --control-kind times, places or dates\n" );
+      exit( 1 );
+      }
    init_swiss_ephemeris( opt_sys, pts );
    // banner
+   if ( opt_json ) { opt_quiet = TRUE; }
    if ( !opt_quiet )
       {
       printf( "Astrology Research Framework v0.0:%d\n", BUILD_NUMBER );
       }
+   point_fmt = make_point_format( opt_fmt ? opt_fmt : "|$Y| $N | $U |$S |$d |$C|", FALSE );
+   if ( opt_test_stats )
+      {
+      test_stats();
+      dump_point_format( point_fmt );
+      end_swiss_ephemeris();
+      return 0;
+      }
    // process events
-   if( events[0] == NULL) { puts("no events"); }
+   if ( opt_stats && !opt_from_store ) { stats = make_chart_stats( get_chart_config() ); }
+   if ( opt_store )
+      {
+      store = open_chart_store( opt_store, get_chart_config() );
+      if ( !store ) { exit( 1 ); }
+      }
+   else if ( opt_script )
+      {
+      script = load_script( opt_script, opt_map, opt_jobs );
+      if ( !script ) { exit( 1 ); }
+      }
+   else if ( opt_jobs > 1 && !stats ) { start_pool( opt_jobs ); }
    for( int i = 0; events[i]; i++ )
       {
-      process_event( events[i] );
+      submit_event( events[i], FALSE );
+      }
+   if ( opt_input )
+      {
+      FILE* in = fopen( opt_input, "r" );
+      if ( !in )
+         {
+         fprintf( stderr, "cannot open %s\n", opt_input );
+         exit( 1 );
+         }
+      stream_events( in );
+      fclose( in );
+      }
+   else if ( opt_stdin )
+      {
+      stream_events( stdin );
+      }
+   else if ( opt_from_store )
+      {
+      report_store( opt_from_store, opt_query );
+      }
+   else if( events[0] == NULL) { puts("no events"); }
+   if ( pool.count ) { end_pool(); }
+   if ( stats ) { end_stats(); }
+   if ( script )
+      {
+      flush_script();
+      if ( !opt_quiet ) { printf( "%ld charts mapped by %s\n", to_script.found, opt_script ); }
+      dump_script( script );
+      }
+   if ( opt_archive )
+      {
+      flush_archive();
+      if ( !opt_quiet ) { printf( "%ld charts added to %s\n", to_archive.written, opt_archive ); }
+      if ( to_archive.b ) { dump_chart_batch( to_archive.b ); }
+      }
+   if ( store )
+      {
+      dump_chart_store( store );
+      if ( !opt_quiet ) { printf( "%ld charts added to %s\n", stored, opt_store ); }
       }
    // termination
+   dump_point_format( point_fmt );
    end_swiss_ephemeris();
    }
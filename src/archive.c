@@ -0,0 +1,502 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file archive.c
+ *    keeps charts in a binary file of columns, to be read many times.
+ *
+ * Research goes over the same dataset again and again. Instead of
+ * making every chart anew on each run, an archive keeps the numbers of
+ * a ChartBatch in a file: one column per point field and per house
+ * cusp, just as in memory. When opened, the file is mapped into memory,
+ * and each segment can be used as a ChartBatch without any copy, so an
+ * analysis never calls the Swiss Ephemeris at all.
+ *
+ * Files are in the byte order of the machine that made them, and only
+ * ever grow: each append_to_archive() adds one segment at the end. The
+ * layout is:
+ *   - an ArchiveHead, with the points and house systems of all charts;
+ *   - any number of segments, each with:
+ *     - an ArchiveSegHead;
+ *     - a sparse index: the jdn of every ARCHIVE_STEP-th chart;
+ *     - the columns, as in a ChartBatch of the same size as the count.
+ *
+ * Charts in a segment are in order of jdn, so the sparse index and a
+ * short binary search find any span of time (see archive_span()). A
+ * segment cut short, by a writer that did not finish, is left out, and
+ * cut off by the next append_to_archive().
+ **/
+
+#include "arfc.h"
+#include <unistd.h> // ftruncate()
+
+#define ARCHIVE_MAGIC "ARFARC1"
+#define SEGMENT_MAGIC "ARFSEG1"
+#define ARCHIVE_STEP 64
+#define ARCHIVE_MAX_POINTS 64
+#define ARCHIVE_MAX_SYSTEMS 32
+
+/** struct ArchiveHead starts an archive file */
+struct ArchiveHead
+   {
+   char magic[8];
+   double probe; // 1.0, to catch files of another byte order
+   gint32 pt_count;
+   gint32 sys_count;
+   gint32 codes[ARCHIVE_MAX_POINTS];
+   char systems[ARCHIVE_MAX_SYSTEMS]; // terminated by '\0'
+   };
+
+/** struct ArchiveSegHead starts each segment of an archive */
+struct ArchiveSegHead
+   {
+   char magic[8];
+   gint32 count; // charts in the segment
+   gint32 step; // charts between marks of the sparse index
+   gint64 length; // bytes in the segment, this head included
+   double first; // jdn of the earliest chart
+   double last; // jdn of the latest chart
+   };
+
+/** struct ArchiveMarks is the sparse index of one segment */
+struct ArchiveMarks
+   {
+   const double* jdn;
+   int step;
+   int count;
+   };
+
+intern
+size_t
+columns_of( const struct ArchiveHead* h )
+   {
+   return 3 + 4 * h->pt_count + 12 * h->sys_count;
+   }
+
+intern
+size_t
+segment_length( const struct ArchiveHead* h, int count, int step )
+   {
+   size_t marks = ( (size_t) count + step - 1 ) / step;
+   return sizeof( struct ArchiveSegHead )
+          + sizeof( double ) * ( marks + columns_of( h ) * count );
+   }
+
+intern
+void
+head_of_config( struct ArchiveHead* h, ChartConfig* cf )
+   {
+   memset( h, 0, sizeof( *h ) );
+   memcpy( h->magic, ARCHIVE_MAGIC, 8 );
+   h->probe = 1.0;
+   h->pt_count = cf->pt_count;
+   h->sys_count = cf->sys_count;
+   for ( int i = 0; i < cf->pt_count; i++ ) { h->codes[i] = cf->pts[i]; }
+   g_strlcpy( h->systems, cf->systems, ARCHIVE_MAX_SYSTEMS );
+   }
+
+/** whole_segment() tells if the segment whose head is at @p at is all
+ * in a file of @p len bytes. */
+intern
+int
+whole_segment( const struct ArchiveHead* h, const struct ArchiveSegHead* s,
+               size_t at, size_t len )
+   {
+   return 0 == memcmp( s->magic, SEGMENT_MAGIC, 8 ) && s->count > 0 && s->step > 0
+          && (size_t) s->length == segment_length( h, s->count, s->step )
+          && at + s->length <= len;
+   }
+
+/** struct Row pairs the jdn of a chart with its place in a batch */
+typedef struct Row
+   {
+   double jdn;
+   int k;
+   }
+Row;
+
+intern
+int
+cmp_rows( const void* a, const void* b )
+   {
+   const Row* x = a;
+   const Row* y = b;
+   return ( x->jdn > y->jdn ) - ( x->jdn < y->jdn );
+   }
+
+//---- WRITING -------------------------------------------------------//
+/** end_of_segments() is where the whole segments of an archive end.
+ * @param in Archive file, open for reading.
+ * @param h Its head.
+ * @param len Its length, in bytes.
+ */
+intern
+size_t
+end_of_segments( FILE* in, const struct ArchiveHead* h, size_t len )
+   {
+   struct ArchiveSegHead s;
+   size_t at = sizeof( *h );
+   while ( at + sizeof( s ) <= len
+           && 0 == fseek( in, at, SEEK_SET ) && 1 == fread( &s, sizeof( s ), 1, in )
+           && whole_segment( h, &s, at, len ) )
+      {
+      at += s.length;
+      }
+   return at;
+   }
+
+/** append_to_archive() adds the charts of a batch to the end of an
+ * archive file, as a new segment. The file is made if it does not
+ * exist; nothing already in it is rewritten, but a broken segment at
+ * the end is cut off first, or no segment after it could be read.
+ * @param path Name of the archive file.
+ * @param b Pointer to a ChartBatch, with the same points and house
+ *        systems as the charts already in the archive.
+ *
+ * @return number of charts added, or -1 on error.
+ */
+extern
+int
+append_to_archive( char* path, ChartBatch* b )
+   {
+   ChartConfig* cf = b->cf;
+   if ( cf->pt_count > ARCHIVE_MAX_POINTS || cf->sys_count >= ARCHIVE_MAX_SYSTEMS )
+      {
+      complain( "too many points or house systems for an archive\n" );
+      return -1;
+      }
+   struct ArchiveHead want, have;
+   head_of_config( &want, cf );
+   FILE* out = fopen( path, "ab" );
+   if ( !out )
+      {
+      complain( "cannot write archive to %s\n", path );
+      return -1;
+      }
+   int ok = 1;
+   fseek( out, 0, SEEK_END );
+   size_t len = ftell( out );
+   if ( len == 0 )
+      {
+      ok = 1 == fwrite( &want, sizeof( want ), 1, out );
+      }
+   else
+      {
+      FILE* in = fopen( path, "rb" );
+      ok = in && 1 == fread( &have, sizeof( have ), 1, in )
+           && 0 == memcmp( &have, &want, sizeof( want ) );
+      if ( !ok ) { complain( "%s is not an archive of these charts\n", path ); }
+      size_t end = ok ? end_of_segments( in, &have, len ) : len;
+      if ( in ) { fclose( in ); }
+      // the file is opened to append, so writing goes on from the cut
+      if ( end != len )
+         {
+         complain( "%s ends in a broken segment, cut off\n", path );
+         ok = 0 == ftruncate( fileno( out ), end );
+         if ( !ok ) { complain( "cannot cut %s\n", path ); }
+         }
+      }
+   if ( !ok || b->count == 0 )
+      {
+      fclose( out );
+      return ok ? 0 : -1;
+      }
+   // charts go in order of time
+   int n = b->count;
+   Row* rows = malloc( sizeof( Row ) * n );
+   for ( int k = 0; k < n; k++ ) { rows[k] = ( Row ) { b->jdn[k], k }; }
+   qsort( rows, n, sizeof( Row ), cmp_rows );
+   struct ArchiveSegHead seg;
+   memset( &seg, 0, sizeof( seg ) );
+   memcpy( seg.magic, SEGMENT_MAGIC, 8 );
+   seg.count = n;
+   seg.step = ARCHIVE_STEP;
+   seg.length = segment_length( &want, n, ARCHIVE_STEP );
+   seg.first = rows[0].jdn;
+   seg.last = rows[n-1].jdn;
+   ok = 1 == fwrite( &seg, sizeof( seg ), 1, out );
+   double* col = malloc( sizeof( double ) * n );
+   int marks = 0;
+   for ( int k = 0; k < n; k += ARCHIVE_STEP ) { col[marks++] = rows[k].jdn; }
+   ok = ok && (size_t) marks == fwrite( col, sizeof( double ), marks, out );
+   // the columns of a batch are contiguous from b->jdn on
+   for ( size_t c = 0; ok && c < columns_of( &want ); c++ )
+      {
+      const double* from = b->jdn + c * b->size;
+      for ( int k = 0; k < n; k++ ) { col[k] = from[rows[k].k]; }
+      ok = (size_t) n == fwrite( col, sizeof( double ), n, out );
+      }
+   free( col );
+   free( rows );
+   ok = ( 0 == fclose( out ) ) && ok;
+   if ( !ok ) { complain( "cannot write archive to %s\n", path ); }
+   return ok ? n : -1;
+   }
+
+//---- READING -------------------------------------------------------//
+/** open_archive() maps an archive file into memory. Each segment
+ * becomes a ChartBatch in @a segs, whose columns point into the file,
+ * and so must not be written to.
+ * @param path Name of a file from append_to_archive().
+ *
+ * @return pointer to an Archive, that must be dumped, or NULL if the
+ *         file cannot be read or is not an archive, or its house
+ *         systems are not all known to make_chart_config().
+ */
+extern
+Archive*
+open_archive( char* path )
+   {
+   GError* gerr = NULL;
+   GMappedFile* map = g_mapped_file_new( path, FALSE, &gerr );
+   if ( !map )
+      {
+      complain( "cannot map %s: %s\n", path, gerr->message );
+      g_error_free( gerr );
+      return NULL;
+      }
+   const char* data = g_mapped_file_get_contents( map );
+   size_t len = g_mapped_file_get_length( map );
+   const struct ArchiveHead* h = (const struct ArchiveHead*) data;
+   if ( len < sizeof( *h ) || 0 != memcmp( h->magic, ARCHIVE_MAGIC, 8 )
+        || h->probe != 1.0 || h->pt_count < 0 || h->pt_count > ARCHIVE_MAX_POINTS
+        || h->sys_count < 0 || h->sys_count >= ARCHIVE_MAX_SYSTEMS
+        || h->systems[h->sys_count] != '\0' || !house_systems_known( h->systems ) )
+      {
+      complain( "%s is not an archive\n", path );
+      g_mapped_file_unref( map );
+      return NULL;
+      }
+   // count the whole segments first
+   int seg_count = 0;
+   size_t at = sizeof( *h );
+   while ( at + sizeof( struct ArchiveSegHead ) <= len )
+      {
+      const struct ArchiveSegHead* s = (const struct ArchiveSegHead*) ( data + at );
+      if ( !whole_segment( h, s, at, len ) ) { break; }
+      at += s->length;
+      seg_count++;
+      }
+   if ( at != len ) { complain( "%s ends in a broken segment, left out\n", path ); }
+   int codes[ARCHIVE_MAX_POINTS + 1];
+   for ( int i = 0; i < h->pt_count; i++ ) { codes[i] = h->codes[i]; }
+   codes[h->pt_count] = SE_END;
+   Archive* a;
+   a = malloc( sizeof( Archive ) );
+   a->map = map;
+   a->cf = make_chart_config( (char*) h->systems, codes );
+   a->seg_count = seg_count;
+   a->chart_count = 0;
+   a->segs = malloc( sizeof( ChartBatch ) * MAX( 1, seg_count ) );
+   a->marks = malloc( sizeof( struct ArchiveMarks ) * MAX( 1, seg_count ) );
+   at = sizeof( *h );
+   for ( int g = 0; g < seg_count; g++ )
+      {
+      const struct ArchiveSegHead* s = (const struct ArchiveSegHead*) ( data + at );
+      const double* marks = (const double*) ( s + 1 );
+      int n = s->count;
+      ChartBatch* b = a->segs + g;
+      b->cf = a->cf;
+      b->count = b->size = n;
+      b->jdn = (double*) marks + ( n + s->step - 1 ) / s->step;
+      b->lat = b->jdn + n;
+      b->lon = b->lat + n;
+      b->pts = b->lon + n;
+      b->cusps = b->pts + 4 * h->pt_count * n;
+      a->marks[g] = ( struct ArchiveMarks ) { marks, s->step, n };
+      a->chart_count += n;
+      at += s->length;
+      }
+   return a;
+   }
+
+/** dump_archive() unmaps an Archive, and all its segments.
+ * @param a Pointer to an Archive.
+ */
+extern
+void
+dump_archive( Archive* a )
+   {
+   g_mapped_file_unref( a->map );
+   dump_chart_config( a->cf );
+   free( a->segs );
+   free( a->marks );
+   free( a );
+   }
+
+/** archive_span() finds the charts of a segment within a span of time.
+ * @param a Pointer to an Archive.
+ * @param g Index of the segment.
+ * @param from, to Span of time, in JDN format, from included.
+ * @param first Gets the index of the first chart in the span.
+ *
+ * @return number of charts in the span, from @p first on.
+ */
+extern
+int
+archive_span( Archive* a, int g, double from, double to, int* first )
+   {
+   const double* jdn = a->segs[g].jdn;
+   struct ArchiveMarks* m = a->marks + g;
+   int ends[2];
+   double at[2] = { from, to };
+   for ( int e = 0; e < 2; e++ )
+      {
+      // the sparse index gives a stretch of at most step charts...
+      int lo = 0, hi = ( m->count + m->step - 1 ) / m->step;
+      while ( lo < hi )
+         {
+         int mid = ( lo + hi ) / 2;
+         if ( m->jdn[mid] < at[e] ) { lo = mid + 1; } else { hi = mid; }
+         }
+      // ...then search the columns only there
+      int a0 = MAX( 0, ( lo - 1 ) * m->step );
+      int b0 = MIN( m->count, lo * m->step );
+      while ( a0 < b0 )
+         {
+         int mid = ( a0 + b0 ) / 2;
+         if ( jdn[mid] < at[e] ) { a0 = mid + 1; } else { b0 = mid; }
+         }
+      ends[e] = a0;
+      }
+   *first = ends[0];
+   return MAX( 0, ends[1] - ends[0] );
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+#define EVCOUNT 300
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( "PKR", NULL );
+   ChartConfig* cf = get_chart_config();
+   char* path = NULL;
+   int fd = g_file_open_tmp( "arf-test-XXXXXX.archive", &path, NULL );
+   if ( fd < 0 ) { puts( "no temporary file for the tests" ); exit( 1 ); }
+   close( fd );
+   Event evs[EVCOUNT];
+   for ( int i = 0; i < EVCOUNT; i++ )
+      {
+      evs[i].jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      evs[i].lat = g_test_rand_double_range( -60.0, 60.0 );
+      evs[i].lon = g_test_rand_double_range( -180.0, 180.0 );
+      evs[i].name = "archive";
+      }
+   ChartBatch* b = make_chart_batch( cf, EVCOUNT );
+   fill_chart_batch( b, evs, EVCOUNT );
+   ChartBatch* half = make_chart_batch( cf, EVCOUNT );
+   fill_chart_batch( half, evs, EVCOUNT / 2 );
+   //
+   TRIAL( "no leaks on open_archive()",
+      ENSURE( EVCOUNT == append_to_archive( path, b ) );
+      BOUND(
+         Archive* a = open_archive( path );
+         PROBE( a );
+         dump_archive( a );
+         );
+      );
+   TRIAL( "appending adds a segment, and keeps what was there",
+      ENSURE( EVCOUNT / 2 == append_to_archive( path, half ) );
+      Archive* a = open_archive( path );
+      ENSURE( a->seg_count == 2 );
+      ENSURE( a->chart_count == EVCOUNT + EVCOUNT / 2 );
+      ENSURE( a->cf->pt_count == cf->pt_count );
+      ENSURE( 0 == strcmp( a->cf->systems, cf->systems ) );
+      dump_archive( a );
+      );
+   TRIAL( "columns of an archive equal those of the batch",
+      Archive* a = open_archive( path );
+      ChartBatch* s = a->segs;
+      for ( int k = 0; k < s->count; k++ )
+         {
+         AVOID( k && s->jdn[k] < s->jdn[k-1] );
+         int j = 0;
+         while ( j < EVCOUNT && b->jdn[j] != s->jdn[k] ) { j++; }
+         ENSURE( j < EVCOUNT );
+         if ( j == EVCOUNT ) { break; }
+         AVOID( s->lat[k] != b->lat[j] );
+         for ( int i = 0; i < cf->pt_count; i++ )
+            {
+            AVOID( batch_col( s, i, 0 )[k] != batch_col( b, i, 0 )[j] );
+            AVOID( batch_col( s, i, 3 )[k] != batch_col( b, i, 3 )[j] );
+            }
+         for ( int h = 1; h <= 12; h++ )
+            {
+            AVOID( batch_house( s, 2, h )[k] != batch_house( b, 2, h )[j] );
+            }
+         }
+      dump_archive( a );
+      );
+   TRIAL( "archive_span() finds the same charts as a scan",
+      Archive* a = open_archive( path );
+      for ( int t = 0; t < 100; t++ )
+         {
+         double from = g_test_rand_double_range( 2434000.0, 2461000.0 );
+         double to = from + g_test_rand_double_range( 0.0, 5000.0 );
+         for ( int g = 0; g < a->seg_count; g++ )
+            {
+            int first;
+            int n = archive_span( a, g, from, to, &first );
+            int want = 0;
+            int want_first = -1;
+            for ( int k = 0; k < a->segs[g].count; k++ )
+               {
+               if ( a->segs[g].jdn[k] >= from && a->segs[g].jdn[k] < to )
+                  {
+                  if ( want_first < 0 ) { want_first = k; }
+                  want++;
+                  }
+               }
+            AVOID( n != want );
+            AVOID( want && first != want_first );
+            }
+         }
+      dump_archive( a );
+      );
+   TRIAL( "a segment cut short is left out",
+      FILE* f = fopen( path, "rb" );
+      fseek( f, 0, SEEK_END );
+      long whole = ftell( f );
+      fclose( f );
+      ENSURE( EVCOUNT / 2 == append_to_archive( path, half ) );
+      ENSURE( 0 == truncate( path, whole + 1000 ) );
+      Archive* a = open_archive( path );
+      PROBE( a );
+      ENSURE( a->seg_count == 2 );
+      dump_archive( a );
+      );
+   TRIAL( "appending after a segment cut short cuts it off",
+      ENSURE( EVCOUNT / 2 == append_to_archive( path, half ) );
+      Archive* a = open_archive( path );
+      ENSURE( a->seg_count == 3 );
+      ENSURE( a->chart_count == 2 * EVCOUNT );
+      dump_archive( a );
+      );
+   TRIAL( "charts of another config are not appended",
+      ChartConfig* other = make_chart_config( "E", NULL );
+      ChartBatch* ob = make_chart_batch( other, 1 );
+      fill_chart_batch( ob, evs, 1 );
+      ENSURE( -1 == append_to_archive( path, ob ) );
+      dump_chart_batch( ob );
+      dump_chart_config( other );
+      );
+   TRIAL( "an archive of unknown house systems is refused",
+      FILE* f = fopen( path, "r+b" );
+      ENSURE( f != NULL );
+      struct ArchiveHead h;
+      ENSURE( 1 == fread( &h, sizeof( h ), 1, f ) );
+      h.systems[1] = 'G';
+      rewind( f );
+      ENSURE( 1 == fwrite( &h, sizeof( h ), 1, f ) );
+      fclose( f );
+      ENSURE( NULL == open_archive( path ) );
+      );
+   remove( path );
+   g_free( path );
+   dump_chart_batch( half );
+   dump_chart_batch( b );
+   end_swiss_ephemeris();
+END_TESTS
+#endif //TEST
@@ -57,6 +57,18 @@ typedef struct Event
    }
 Event;
 
+/** struct EventSlice is an event parsed by parse_event(), whose name is
+ * left in the parsed string, or where and why the parse failed. */
+typedef struct EventSlice
+   {
+   Event ev; // ev.name is NULL
+   const char* name; // not ended by '\0'
+   int name_len;
+   int at; // offset of the failure in the string, or -1
+   const char* why;
+   }
+EventSlice;
+
 /** struct Point is everything that can show up in a chart, planets,
  * asteroids, fictional planets, etc.
  *
@@ -107,6 +119,65 @@ typedef struct Aspect
    }
 Aspect;
 
+/** struct Series is a file of Chebyshev polynomials for the positions
+ * of some points over a range of dates, made by make_series_file() and
+ * mapped into memory (and shared by every process) by load_series().
+ **/
+typedef struct Series
+   {
+   void* map; // the GMappedFile
+   const struct SeriesHead* head;
+   const struct SeriesEntry* entries; // one per point
+   const double* coefs;
+   }
+Series;
+
+/** struct Transit is a moving point in exact aspect to a natal one */
+typedef struct Transit
+   {
+   double jdn;
+   int point; // code of the moving point
+   int target; // index of the natal point, or -n for the cusp of house n
+   int kind; // as in Aspect
+   double angle;
+   char symbol[SYMB_SIZE];
+   }
+Transit;
+
+/** struct TransitTimeline has the transits over each of many charts */
+typedef struct TransitTimeline
+   {
+   int chart_count;
+   Transit** charts; // per chart, in order of time, ended by .kind==0
+   int* counts; // per chart
+   }
+TransitTimeline;
+
+/** struct ChartConfig has all that is needed to make a kind of Chart:
+ * which points and which house systems, together with the counts and
+ * sizes derived from them. It is read-only once made, so many charts
+ * (and many threads) can share one.
+ **/
+typedef struct ChartConfig
+   {
+   int* pts; // point codes, terminated by SE_END
+   char* systems; // one letter per house system
+   int pt_count;
+   int sys_count;
+   int cp_count;
+   Series* series; // if not NULL, used for points it has...
+   double accuracy; // ...when its error is under this many degrees
+   }
+ChartConfig;
+
+/** struct PointCacheStats counts how the point cache of a thread did */
+typedef struct PointCacheStats
+   {
+   long hits;
+   long misses;
+   }
+PointCacheStats;
+
 /** struct Chart has an event and an array of cusps and points */
 typedef struct Chart
    {
@@ -118,9 +189,162 @@ typedef struct Chart
    int cp_count;
    int sys_count;
    int asp_count;
+   double* sys_cusps; // 12 cusps per house system, see housealt(), NAN if it failed
+   char* sys_codes; // letter of each house system, '?' if it failed
    }
 Chart;
 
+/** struct ChartArena gives out the memory for many charts from a few
+ * big blocks, so that a whole batch is freed with a single call.
+ **/
+typedef struct ChartArena
+   {
+   struct ArenaBlock* block; // newest block, linked to the older ones
+   size_t block_size;
+   size_t used; // bytes used in the newest block
+   int chart_count;
+   }
+ChartArena;
+
+/** struct ChartBatch holds many charts as columns of doubles, one
+ * column for each number: event jdn, lat and lon, then lon, lat, dist
+ * and speed of every point, then every cusp of every house system.
+ * Use batch_col() and batch_house() to get to a column.
+ **/
+typedef struct ChartBatch
+   {
+   ChartConfig* cf;
+   int count; // charts in the batch
+   int size;  // charts there is room for
+   double* jdn;
+   double* lat;
+   double* lon;
+   double* pts;   // [pt_count][4][size]
+   double* cusps; // [sys_count][12][size]
+   }
+ChartBatch;
+
+
+/** struct Archive is a file of charts in columns, mapped into memory by
+ * open_archive(). Each segment of the file is a ChartBatch whose
+ * columns point into the file, charts in order of jdn.
+ **/
+typedef struct Archive
+   {
+   void* map; // the GMappedFile
+   ChartConfig* cf; // points and house systems of every chart
+   int seg_count;
+   ChartBatch* segs; // one per segment, read-only
+   struct ArchiveMarks* marks; // sparse index of each segment
+   long chart_count;
+   }
+Archive;
+
+/** struct ChartStore is a sqlite database of charts, opened by
+ * open_chart_store(). See store.c for its tables.
+ **/
+typedef struct ChartStore
+   {
+   void* db; // the sqlite3 connection
+   ChartConfig* cf; // points and house systems of every chart
+   void* stmts[9]; // prepared statements
+   int pending; // charts stored since the last commit
+   gboolean open; // a transaction is open, even with none pending
+   }
+ChartStore;
+
+/** struct ChartIndex has bitmaps of the charts with each point in each
+ * sign, degree and house, made by index_chart() and read by
+ * query_chart_index().
+ **/
+typedef struct ChartIndex
+   {
+   ChartConfig* cf; // points and house systems of every chart
+   long count; // charts indexed
+   long size; // room in ids
+   long* ids; // of each chart, by row
+   struct Bitmap* maps; // per point, by sign, degree and house
+   }
+ChartIndex;
+
+/** struct ChartStats counts, over many charts, the charts with each
+ * point in each degree, sign and house, and with each aspect kind
+ * between each pair of points. See stats_bins().
+ **/
+typedef struct ChartStats
+   {
+   ChartConfig* cf; // points and house systems of every chart
+   long count; // charts counted
+   long* lon; // [pt_count][360]
+   long* signs; // [pt_count][12]
+   long* houses; // [pt_count][sys_count][12]
+   long* aspects; // [pair][ASPECT_KINDS], kind 0 is no aspect
+   size_t size; // counts in all, from lon on
+   }
+ChartStats;
+#define STATS_LON 0
+#define STATS_SIGNS 1
+#define STATS_HOUSES 2
+#define STATS_ASPECTS 3
+
+/** kinds of control of make_control_events() */
+#define CONTROL_TIMES 0 // times of day shuffled among the events
+#define CONTROL_PLACES 1 // places shuffled among the events
+#define CONTROL_DATES 2 // times drawn evenly over the range of the events
+
+/** struct ChiSquare is the result of a chi-square test */
+typedef struct ChiSquare
+   {
+   double chi2;
+   int dof; // degrees of freedom
+   double p;
+   }
+ChiSquare;
+
+/** struct Script is a Lua script loaded into a lua_State per thread,
+ * with the global function to call on each chart. See script.c.
+ **/
+typedef struct Script
+   {
+   struct lua_State** states;
+   int count; // of states, and of threads map_script() runs on
+   char* fn;
+   }
+Script;
+
+/** ScriptResult is called by map_script() with what a script returned */
+typedef void ScriptResult( Event* ev, const char* text, void* data );
+
+/** SinkWriter is called by a Sink made by sink_of_callback() */
+typedef void SinkWriter( const char* str, size_t len, void* data );
+
+/** struct Sink is where the serializers write text to: a FILE, a buffer
+ * that grows as needed, or a callback. Make one with sink_of_file(),
+ * sink_of_buffer() or sink_of_callback().
+ **/
+typedef struct Sink
+   {
+   FILE* file; // if not NULL, written to
+   SinkWriter* write; // else if not NULL, called
+   void* data; // for write
+   char* buf; // else, grown and written to, always a string
+   size_t len;
+   size_t size;
+   }
+Sink;
+
+/** struct PointFormat is a format of point tables, compiled once by
+ * make_point_format() to write the tables of many charts.
+ **/
+typedef struct PointFormat
+   {
+   int count; // columns, text or $ fields
+   struct PointColumn* cols;
+   gboolean fixed; // same widths for every chart
+   int uses; // bit mask of the measures widths depend on
+   int widths[7]; // per measure, the least width
+   }
+PointFormat;
 
 //---- ITERATORS and ACCESSORS ---------------------------------------//
 #define for_each_point(c) \
@@ -130,10 +354,14 @@ Chart;
 #define for_each_house(c) \
         for(Point * each = (c->points-1); each>(c->points-13); each--)
 #define house(x) points[ -(x) ]
-#define housealt(n,sys) points[(-12*((sys+1)/4))-(n)].data[sys<3?sys:(sys+1)%4]
+#define housealt(n,sys) sys_cusps[12*(sys)+(n)-1]
 #define ascendant points[-1].def
 #define midheaven points[-10].def
-#define syscode(sys) points[(-12*((sys+1)/4))-1].symbol[sys<3?sys:(sys+1)%4]
+#define syscode(sys) sys_codes[sys]
+// i is the point index in the config, f the index as in Point.data[]
+#define batch_col(b,i,f) ( (b)->pts + ((i)*4+(f))*(b)->size )
+// s is the house system index, n the house number from 1 to 12
+#define batch_house(b,s,n) ( (b)->cusps + ((s)*12+(n)-1)*(b)->size )
 
 //---- DATE & UNIT CONVERSIONS (in convert.c) ------------------------//
 extern double jdn_of_gregorian( int y, int m, int d, int h, int min );
@@ -146,6 +374,10 @@ extern double jdn_of_isotag ( char* );
 extern double jdn_of_now ();
 extern Datum coords_of_string( char* );
 extern Event* make_event_of_string( char* );
+extern double jdn_of_date_slice( const char*, int len, int* at );
+extern double jdn_of_time_slice( const char*, int len, int* at );
+extern double jdn_of_iso_slice( const char*, int len, int* at );
+extern int parse_event( const char*, int len, EventSlice* );
 #define dump_event( e ) free(e->name); free( e );
 // to interop with Glib
 extern GDateTime* make_gdatetime_of_jdn( double );
@@ -163,16 +395,133 @@ extern size_t to_coords( char*, Event* );
 extern void init_swiss_ephemeris(char* systems, int* points);
 extern void set_housesystem( int );
 extern void end_swiss_ephemeris();
+extern void init_ephemeris_thread();
+extern void end_ephemeris_thread();
+extern PointCacheStats get_point_cache_stats();
+extern void clear_point_cache();
+extern ChartConfig* make_chart_config( char* systems, int* points );
+extern void dump_chart_config( ChartConfig* );
+extern gboolean house_systems_known( const char* systems );
+extern ChartConfig* get_chart_config();
+extern void set_chart_series( ChartConfig*, Series*, double accuracy );
 extern Chart* make_chart( char* name, double jdn, double lat, double lon );
+extern Chart* make_chart_with( ChartConfig*, char* name, double jdn,
+                               double lat, double lon );
 extern Chart* make_chart_of_event( Event* ev );
+extern Chart* make_chart_of_numbers( ChartConfig*, Event* ev, double* pts,
+                                     double* cusps, char* codes, double* defs );
+extern ChartArena* make_chart_arena( size_t block_size );
+extern Chart* make_chart_in( ChartArena*, ChartConfig*, char* name,
+                             double jdn, double lat, double lon );
+extern void clear_chart_arena( ChartArena* );
+extern void dump_chart_arena( ChartArena* );
 extern void dump_chart( Chart* );
+extern int house_of( double* cusps, double lon );
 extern Aspect to_aspect( double, double );
+#define ASPECT_TOLERANCE 1e-5
+#define ASPECT_KINDS 13 // 0 for none, then harmonics up to 12
+extern void to_aspects( double*, double*, int n, int* kinds, float* scores );
 extern Aspect* make_aspects( Chart* );
+extern Aspect* make_aspects_by_sweep( Chart* );
+extern Aspect* make_cross_aspects( Chart* inner, Chart* outer );
 extern void dump_aspects( Aspect* );
 extern double nearest_return( Chart* c, int code, double ref_time );
 extern double nearest_ingress( int code, double zlon, double ref_time );
+extern double nearest_station( int code, double ref_time );
+
+//---- TRANSITS (in transit.c) --------------------------------------//
+extern Transit* find_transits( Chart* natal, double from, double to,
+                               int* ptlist, int* count );
+extern TransitTimeline* make_transit_timeline( ChartBatch*, double from,
+                                              double to, int* ptlist );
+extern void dump_transit_timeline( TransitTimeline* );
+
+//---- CHEBYSHEV SERIES (in series.c) -------------------------------//
+extern int make_series_file( char* path, int* ptlist, double from, double to,
+                             int degree, double tolerance );
+extern Series* load_series( char* path );
+extern void dump_series( Series* );
+extern int eval_series( Series*, int code, double jdn, double accuracy,
+                        double* ret );
+
+//---- COLUMNS OF CHARTS (in batch.c) --------------------------------//
+extern ChartBatch* make_chart_batch( ChartConfig*, int size );
+extern void dump_chart_batch( ChartBatch* );
+extern int fill_chart_batch( ChartBatch*, Event* evs, int n );
+extern int add_chart_to_batch( ChartBatch*, Chart* );
+extern double* batch_column( ChartBatch*, int code, int field );
+
+//---- ARCHIVES OF CHARTS (in archive.c) ----------------------------//
+extern int append_to_archive( char* path, ChartBatch* );
+extern Archive* open_archive( char* path );
+extern void dump_archive( Archive* );
+extern int archive_span( Archive*, int seg, double from, double to, int* first );
+
+//---- STORES OF CHARTS (in store.c) --------------------------------//
+extern ChartStore* open_chart_store( char* path, ChartConfig* );
+extern void flush_chart_store( ChartStore* );
+extern void dump_chart_store( ChartStore* );
+extern long store_chart( ChartStore*, Chart* );
+extern Chart* load_chart( ChartStore*, long id );
+extern long next_stored_chart( ChartStore*, long id );
+extern long find_chart_named( ChartStore*, char* name );
+extern int find_stored_charts( ChartStore*, int code, double from, double to,
+                               long* ids, int max );
+extern ChartIndex* index_chart_store( ChartStore* );
+
+//---- INDEXES OF CHARTS (in index.c) -------------------------------//
+extern ChartIndex* make_chart_index( ChartConfig* );
+extern void dump_chart_index( ChartIndex* );
+extern long index_chart( ChartIndex*, Chart*, long id );
+extern long index_numbers( ChartIndex*, long id, double* lons, double* cusps, char* codes );
+extern long query_chart_index( ChartIndex*, char* query, long* ids, long max );
+
+//---- STATISTICS OF CHARTS (in stats.c) ----------------------------//
+extern ChartStats* make_chart_stats( ChartConfig* );
+extern void dump_chart_stats( ChartStats* );
+extern void add_chart_to_stats( ChartStats*, Chart* );
+extern void add_batch_to_stats( ChartStats*, ChartBatch* );
+extern void fill_chart_stats( ChartStats*, Event* evs, int n, int threads );
+extern int merge_chart_stats( ChartStats* into, ChartStats* from );
+extern int save_chart_stats( ChartStats*, char* path );
+extern ChartStats* load_chart_stats( char* path, ChartConfig* );
+extern ChiSquare chi_square( long* observed, double* expected, int bins );
+extern long* stats_bins( ChartStats*, int what, int i, int j, int* bins );
+extern ChiSquare test_chart_stats( ChartStats*, ChartStats* base, int what,
+                                   int i, int j );
+
+//---- CONTROL GROUPS (in control.c) ---------------------------------//
+extern void make_control_events( Event* evs, int n, int kind, GRand*,
+                                 Event* out );
+extern ChartStats** make_control_stats( ChartConfig*, Event* evs, int n,
+                                        int kind, int count, guint32 seed,
+                                        int threads );
+extern void dump_control_stats( ChartStats**, int count );
+extern ChartStats* merge_control_stats( ChartStats**, int count );
+extern double control_p_value( ChartStats*, ChartStats** controls, int count,
+                               ChartStats* all, int what, int i, int j );
+
+//---- LUA SCRIPTS (in script.c) ------------------------------------//
+extern Script* load_script( char* path, char* fn, int threads );
+extern void dump_script( Script* );
+extern char* run_script( Script*, Chart* );
+extern long map_script( Script*, Event* evs, int n, ScriptResult* found,
+                        void* data );
 
 //---- SERIALIZATION (in serialize.c) --------------------------------//
+extern Sink sink_of_file( FILE* );
+extern Sink sink_of_buffer();
+extern Sink sink_of_callback( SinkWriter*, void* data );
+extern void sink_put( Sink*, const char*, size_t len );
+extern void sink_printf( Sink*, const char* fmt, ... );
+extern void put_csv_list( Sink*, Chart* );
+extern void put_c_literal( Sink*, Chart* );
+extern void put_point_table( Sink*, Chart*, char* );
+extern PointFormat* make_point_format( char* fmt, gboolean fixed );
+extern void put_point_table_with( Sink*, Chart*, PointFormat* );
+extern void dump_point_format( PointFormat* );
+extern void put_house_table( Sink*, Chart* );
+extern void put_json( Sink*, Chart*, ChartConfig* );
 extern char* make_csv_list( Chart* );
 extern char* make_c_literal( Chart* );
 extern char* make_point_table( Chart*, char* );
@@ -194,6 +543,7 @@ typedef struct Figure
    double y; // of center point
    double sz; // font size
    int l; //line type
+   Chart* c2; // outer chart of a bi-wheel, or NULL
    }
 Figure;
 
@@ -259,6 +609,8 @@ extern Painter extra_house_sys;
 extern Painter basic_aspects;
 extern Painter fancy_aspects;
 extern Painter zodiac_open;
+extern Painter outer_points;
+extern Painter cross_aspects;
 //main stripe painter
 extern void paint_stripes( Figure*, Stripe* bs );
 
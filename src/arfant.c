@@ -25,6 +25,9 @@ GtkWidget* ui_display;
 cairo_surface_t* imgbuf = NULL;
 Figure arf_context = { };
 Figure* F = &arf_context;
+// the charts db, opened on first use
+#define DB_FILE "arfant.db"
+ChartStore* db = NULL;
 
 //---- HELPER FUNCTIONS ----------------------------------------------//
 intern
@@ -42,6 +45,14 @@ spit( char* s )
    free( s );
    }
 
+intern
+ChartStore*
+get_db()
+   {
+   if( !db ) { db = open_chart_store( DB_FILE, get_chart_config() ); }
+   return db;
+   }
+
 intern
 void
 paint_chart( Figure* ff )
@@ -76,7 +87,21 @@ paint_chart( Figure* ff )
             { point_image, .begin=1.0, .end=0.84 },
             {}
          };
-      paint_stripes( ff, mys );
+      // same rings, with the outer chart between zodiac and houses
+      Stripe bi[] =
+         {
+            { axis_decor,  .width=0.1 },
+            { axis,  .over=1 },
+            { zodiac_open, .begin=0.96, .end=0.88 },
+            { extra_house_sys, .width=0.05 },
+            { outer_points, .width=0.15 },
+            { house_slabs, .width=0.22 },
+            { cross_aspects, .width=0.3 },
+            { dot_dot_points, .over=-2 },
+            { point_image, .begin=1.0, .end=0.84 },
+            {}
+         };
+      paint_stripes( ff, ff->c2 ? bi : mys );
       }
    }
 
@@ -90,6 +115,7 @@ callback( GtkWidget* w, gpointer data )
       ifcommand( "Now" )
          {
          if( F->c ) { dump_chart( F->c ); }
+         if( F->c2 ) { dump_chart( F->c2 ); F->c2 = NULL; }
          double jdnnow = jdn_of_now();
          F->c = make_chart( "Now", jdnnow, -23.0, -43.0 );
          F->asc = F->c->ascendant;
@@ -109,6 +135,7 @@ callback( GtkWidget* w, gpointer data )
          if( ! isnan(jdn) )
             {
             if( F->c ) { dump_chart( F->c ); }
+            if( F->c2 ) { dump_chart( F->c2 ); F->c2 = NULL; }
             F->c = make_chart( nam, jdn+tmd, geo.lat, geo.lon );
             F->asc = F->c->ascendant;
             paint_chart( F );
@@ -120,6 +147,29 @@ callback( GtkWidget* w, gpointer data )
          free(plc);
          }
       else
+      ifcommand( "Compare" )
+         {
+         // the entries become the outer chart, around the current one
+         char* nam = strdup( gtk_entry_get_text( GTK_ENTRY(ui_Name) ));
+         char* dat = strdup( gtk_entry_get_text( GTK_ENTRY(ui_Date) ));
+         char* tim = strdup( gtk_entry_get_text( GTK_ENTRY(ui_Time) ));
+         char* plc = strdup( gtk_entry_get_text( GTK_ENTRY(ui_Location) ));
+         double jdn = jdn_of_datestring( dat );
+         double tmd = jdn_of_timestring( tim );
+         Datum geo = coords_of_string( plc );
+         if( F->c && ! isnan(jdn) )
+            {
+            if( F->c2 ) { dump_chart( F->c2 ); }
+            F->c2 = make_chart( nam, jdn+tmd, geo.lat, geo.lon );
+            paint_chart( F );
+            refresh();
+            }
+         free(nam);
+         free(dat);
+         free(tim);
+         free(plc);
+         }
+      else
       ifcommand( "Export PNG" )
          {
          cairo_status_t ret;
@@ -146,6 +196,36 @@ callback( GtkWidget* w, gpointer data )
             }
          }
       else
+      ifcommand( "Save" )
+         {
+         if( F->c && get_db() )
+            {
+            long id = store_chart( db, F->c );
+            flush_chart_store( db );
+            if( id < 0 ) { printf( "could not save %s in %s\n", F->c->ev->name, DB_FILE ); }
+            else { printf( "saved %s as chart %ld of %s\n", F->c->ev->name, id, DB_FILE ); }
+            }
+         }
+      else
+      ifcommand( "Load" )
+         {
+         // the last chart saved with the name in the Name entry
+         const char* nam = gtk_entry_get_text( GTK_ENTRY(ui_Name) );
+         long id = get_db() ? find_chart_named( db, (char*) nam ) : 0;
+         Chart* c = id ? load_chart( db, id ) : NULL;
+         if( c )
+            {
+            if( F->c ) { dump_chart( F->c ); }
+            if( F->c2 ) { dump_chart( F->c2 ); F->c2 = NULL; }
+            F->c = c;
+            F->asc = F->c->ascendant;
+            paint_chart( F );
+            refresh();
+            }
+         else
+            { printf( "no chart named %s in %s\n", nam, DB_FILE ); }
+         }
+      else
       ifcommand( "Quit" )
          { g_application_quit( G_APPLICATION(app) ); }
       else
@@ -236,6 +316,9 @@ build_gui( GtkApplication* app, gpointer d)
    ENTRY( Time );
    ENTRY( Location );
    BUTTON( "Calculate" );
+   BUTTON( "Compare" );
+   BUTTON( "Save" );
+   BUTTON( "Load" );
    BUTTON( "Export PNG" );
    BUTTON( "Export PDF" );
    BUTTON( "Report" );
@@ -270,6 +353,7 @@ main( int count, char* args[] )
    g_signal_connect (app, "activate", G_CALLBACK (build_gui), NULL);
    status = g_application_run (G_APPLICATION (app), count, args);
    g_object_unref (app);
+   if( db ) { dump_chart_store( db ); }
    //
    end_swiss_ephemeris();
    return status;
@@ -35,9 +35,50 @@ if(!( exp )) { fputs("failed to " action_description, stderr); }
 //--> for debuging (I KNOW IT IS UGLY)
 #define SHOUT() printf("at line %d\n", __LINE__)
 
+//---- INTERNAL API (shared by ARF files, in astro.c) ----------------//
+/** struct AspectDef is one of the aspects charts look for */
+typedef struct AspectDef
+   {
+   int kind;
+   double angle;
+   double orb;
+   char symbol[SYMB_SIZE];
+   }
+AspectDef;
+extern const AspectDef aspect_defs[]; // terminated by .kind==0
+/** struct Motion is where a point is, and how fast, at a moment */
+typedef struct Motion
+   {
+   double t;
+   double lon;
+   double speed;
+   }
+Motion;
+typedef void PieceFound( Motion a, Motion b, void* data );
+extern int scan_motion( int code, double from, double to, double max_step,
+                        PieceFound* found, void* data );
+typedef void CrossingFound( double jdn, int target, void* data );
+extern int find_crossings( int code, double from, double to,
+                           double* targets, int n,
+                           CrossingFound* found, void* data );
+extern int calc_point( ChartConfig* cf, double jdn, int code, double* ret );
+extern void calc_houses( ChartConfig* cf, double jdn, double lat, double lon,
+                         double* cusps, char* tags, double* ascmc );
+
 //---- C testing -----------------------------------------------------//
 #ifdef TEST
+#ifndef TEST_THREADS
 #include <mcheck.h>
+#define START_MCHECK() if( 0!=mcheck( NULL ) ) exit(171);
+#define PROBE( ptr ) if( MCHECK_OK != mprobe( ptr ) ) \
+   { errors++; complain( "mprobe error for" #ptr ); }
+#else
+// mcheck is not thread-safe, so tests that start threads go without it,
+// and PROBE() can only check there is a pointer
+#define START_MCHECK()
+#define PROBE( ptr ) if( !(ptr) ) \
+   { errors++; complain( "no pointer for" #ptr ); }
+#endif
 
 int unfreed_mallocs = 0;
 #define malloc( x ) malloc( x ); unfreed_mallocs++;
@@ -47,7 +88,7 @@ int unfreed_mallocs = 0;
 
 #define BEGIN_TESTS int main( int arg_count, char* args[] ) \
    { \
-   if( 0!=mcheck( NULL ) ) exit(171); \
+   START_MCHECK() \
    puts( "Running tests for " __FILE__ ); \
    int num_failures = 0;
 #define END_TESTS return num_failures; }
@@ -72,8 +113,6 @@ int unfreed_mallocs = 0;
    do { op } while (0); \
    if(0 != unfreed_mallocs) \
       { errors++;printf("(%d unfreed)",unfreed_mallocs); };
-#define PROBE( ptr ) if( MCHECK_OK != mprobe( ptr ) ) \
-   { errors++; complain( "mprobe error for" #ptr ); }
 #define CLOBBER(S) do { char* ptr = S; \
    while ( *ptr != '\0' ) { *ptr='X'; ptr++; } \
    } while (0);
@@ -5,31 +5,46 @@
 /** @file astro.c
  *    contains astrology related functions.
  *    Much of this is handling the Swiss Ephemeris, and data types.
+ *
+ * @par Threads
+ * Chart calculation is reentrant, provided the Swiss Ephemeris was
+ * built with thread local storage (the default for 2.x, unless it was
+ * compiled with -DTLSOFF). The rules are:
+ *   - call init_swiss_ephemeris() once, before any thread is started,
+ *     and end_swiss_ephemeris() after all of them are joined;
+ *   - every worker calls init_ephemeris_thread() before its first chart
+ *     and end_ephemeris_thread() before it exits, because the ephemeris
+ *     path and file handles live in per-thread storage;
+ *   - after that make_chart() and friends only read the configuration,
+ *     so any number of threads can call them at the same time.
  **/
 
 #include "arfc.h"
-intern void fill_points( Chart* ); //--> used to be extern in arf.h
-intern void fill_cusps( Chart* ); //--> used to be extern in arf.h
+intern void fill_points( Chart*, ChartConfig* ); //--> used to be extern in arf.h
+intern void fill_cusps( Chart*, ChartConfig* ); //--> used to be extern in arf.h
 intern void fill_aspects( Chart* );
+intern void name_point( Point*, int code );
+intern void name_houses( Chart*, ChartConfig* );
+#define MAX_ASPECTS(n) ( (n) > 1 ? (n)*((n)-1)/2 : 1 )
 
 //---- CONFIGURATION DATA --------------------------------------------//
 static int def_pts[] = { 0,1,2,3,4,5,6,7,8, SE_END };
-static int * dyn_pts = NULL;
-static int * the_pts = def_pts;
 static char def_systems[] = "PTK";
-static char * the_systems = def_systems;
-static char * dyn_systems = NULL;
+static ChartConfig def_config =
+   {
+   .pts = def_pts, .systems = def_systems,
+   .pt_count = 9, .sys_count = 3, .cp_count = 12
+   };
+static ChartConfig * dyn_config = NULL;
+static ChartConfig * the_config = &def_config;
+static char * the_ephe_path = NULL;
 // systems_by_popularity[] = "PTKEUORWCB";
 // all_swiss_eph_systems[] = "BYXHCFEDNIiKUMPTOLQRSVW";
+// all that make_chart_config() takes, which is all but Gauquelin
+static const char known_systems[] = "ABCDEFHIiKLMNOPQRSTUVWXY";
 
-//FIX_ME should this be in arf.h??????????
-static struct
-   {
-   int kind;
-   double angle;
-   double orb;
-   char symbol[4];
-   } aspect_defs[] =
+// AspectDef is in arfc.h, so other ARF files can use the same aspects
+const AspectDef aspect_defs[] =
    {
       {   1,   0.0, 10.0, "\u260C" }, //conjunction
       {   2, 180.0,  8.0, "\u260D" }, //opposition
@@ -46,10 +61,12 @@ static struct
 /** Makes the ephemeris ready to use
  * @param systems is a string, where each letter is a house-system
  * @param ptlist is an array of point codes, terminated by SE_END
+ *
+ * The lists become the ChartConfig used by make_chart(), other configs
+ * can be made with make_chart_config() and used with make_chart_with().
  */
 extern
 void
-//FIXME the configs should be passed as a CONF_STRUCT...
 init_swiss_ephemeris( char* systems, int* ptlist )
    {
    char* d = NULL;
@@ -59,50 +76,137 @@ init_swiss_ephemeris( char* systems, int* ptlist )
       {
       if ( g_file_test( paths[f], G_FILE_TEST_EXISTS ) ) { d = paths[f]; }
       }
-   swe_set_ephe_path( d );
-   if ( ptlist!=NULL )
-      {
-      int len = 0;
-      while( SE_END != ptlist[len] ) { len++; }
-      dyn_pts = malloc( sizeof(int) * (len + 1) );
-      int i = 0;
-      while( SE_END != ptlist[i] )
-         {
-         dyn_pts[i] = ptlist[i];
-         i++;
-         }
-      dyn_pts[i] = SE_END;
-      the_pts = dyn_pts;
-      }
-   if ( systems!=NULL )
+   the_ephe_path = d;
+   init_ephemeris_thread();
+   if ( ptlist!=NULL || systems!=NULL )
       {
-      dyn_systems = strdup( systems );
-      the_systems = dyn_systems;
+      dyn_config = make_chart_config( systems, ptlist );
+      the_config = dyn_config;
       }
    }
 
+/** make_chart_config() allocates the configuration for a kind of chart.
+ * Counts and sizes are worked out here, once, so that making charts
+ * with it has no setup cost. Many configurations can be used at once.
+ * @param systems is a string, where each letter is a house-system,
+ *        or NULL for the default systems.
+ * @param ptlist is an array of point codes, terminated by SE_END, or
+ *        NULL for the default points.
+ *
+ * @return pointer to a ChartConfig, that must be dumped.
+ */
+extern
+ChartConfig*
+make_chart_config( char* systems, int* ptlist )
+   {
+   if ( ptlist==NULL ) { ptlist = def_pts; }
+   if ( systems==NULL ) { systems = def_systems; }
+   if ( 'G' == systems[0] ) { puts( "Gauquelin not implemented" ); exit( 'g' ); }
+   int len = 0;
+   while( SE_END != ptlist[len] ) { len++; }
+   int syslen = strlen( systems );
+   // one block: the struct, then the point list, then the systems
+   ChartConfig* cf;
+   cf = malloc( sizeof(ChartConfig) + sizeof(int)*(len+1) + syslen+1 );
+   cf->pts = (int*) (cf + 1);
+   cf->systems = (char*) (cf->pts + len + 1);
+   memcpy( cf->pts, ptlist, sizeof(int) * (len+1) );
+   memcpy( cf->systems, systems, syslen+1 );
+   cf->pt_count = len;
+   cf->sys_count = syslen;
+   cf->cp_count = 12; // other systems go to Chart.sys_cusps
+   cf->series = NULL;
+   cf->accuracy = 0.0;
+   return cf;
+   }
+
+/** dump_chart_config() deallocates a ChartConfig.
+ * @param cf Pointer to a ChartConfig, from make_chart_config().
+ */
+extern
+void
+dump_chart_config( ChartConfig* cf )
+   {
+   free( cf );
+   }
+
+/** house_systems_known() is TRUE if make_chart_config() takes each
+ * letter of @p systems as a house system, for systems read from files.
+ */
+extern
+gboolean
+house_systems_known( const char* systems )
+   {
+   return '\0' == systems[strspn( systems, known_systems )];
+   }
+
+/** set_chart_series() lets a ChartConfig take points from a Series,
+ * instead of from the ephemeris, wherever the series is accurate enough.
+ * Must be called before any chart is made with the config.
+ * @param cf Pointer to a ChartConfig.
+ * @param s Pointer to a Series, that must outlive the config, or NULL.
+ * @param accuracy Largest error accepted in lon and lat, in degrees.
+ */
+extern
+void
+set_chart_series( ChartConfig* cf, Series* s, double accuracy )
+   {
+   cf->series = s;
+   cf->accuracy = accuracy;
+   }
+
+/** get_chart_config() is the configuration used by make_chart().
+ *
+ * @return pointer to the ChartConfig set by init_swiss_ephemeris(), or
+ *         to the defaults. Must not be dumped.
+ */
+extern
+ChartConfig*
+get_chart_config()
+   {
+   return the_config;
+   }
+
+/** init_ephemeris_thread() prepares the calling thread to make charts.
+ * The Swiss Ephemeris keeps its state per thread, so each worker must
+ * set the ephemeris path found by init_swiss_ephemeris() on its own.
+ * The main thread does not need this, init_swiss_ephemeris() does it.
+ */
+extern
+void
+init_ephemeris_thread()
+   {
+   swe_set_ephe_path( the_ephe_path );
+   clear_point_cache();
+   }
+
+/** end_ephemeris_thread() closes the ephemeris files of this thread.
+ */
+extern
+void
+end_ephemeris_thread()
+   {
+   swe_close();
+   }
+
 /** end_swiss_ephemeris() Does any cleanup needed after using ephemeris.
  */
 extern
 void
 end_swiss_ephemeris()
    {
-   if(dyn_pts)
+   if(dyn_config)
       {
-      free(dyn_pts);
-      dyn_pts = NULL;
-      the_pts = def_pts;
+      dump_chart_config(dyn_config);
+      dyn_config = NULL;
+      the_config = &def_config;
       }
-   if(dyn_systems)
-      {
-      free(dyn_systems);
-      dyn_systems = NULL;
-      the_systems = def_systems;
-      }
-   swe_close();
+   the_ephe_path = NULL;
+   end_ephemeris_thread();
    }
 
-/** make_chart() allocates and fills a Chart from some event data.
+/** make_chart() allocates and fills a Chart from some event data,
+ * using the configuration given to init_swiss_ephemeris().
  * @param name String describing the event, usually a name.
  * @param jdn A precise moment in time, in the Julian Day Number format.
  * @param lat,lon Latitude and Longitude.
@@ -112,6 +216,46 @@ end_swiss_ephemeris()
 extern
 Chart*
 make_chart( char* name, double jdn, double lat, double lon )
+   {
+   return make_chart_with( the_config, name, jdn, lat, lon );
+   }
+
+/** chart_block_size() is the size of the block that holds the Points
+ * of a chart (cusps first), then the cusps of every house system, then
+ * their letters.
+ */
+intern
+size_t
+chart_block_size( ChartConfig* cf )
+   {
+   return sizeof( Point ) * ( cf->pt_count + cf->cp_count )
+        + sizeof( double ) * 12 * cf->sys_count
+        + cf->sys_count + 1;
+   }
+
+/** place_chart_block() points the arrays of a Chart into its block,
+ * the counts must be set already. */
+intern
+void
+place_chart_block( Chart* c, void* block )
+   {
+   c->cusps = block;
+   c->points = c->cusps + c->cp_count;
+   c->sys_cusps = (double*) ( c->points + c->pt_count );
+   c->sys_codes = (char*) ( c->sys_cusps + 12 * c->sys_count );
+   }
+
+/** make_chart_with() allocates and fills a Chart from some event data.
+ * @param cf Pointer to a ChartConfig, with points and house systems.
+ * @param name String describing the event, usually a name.
+ * @param jdn A precise moment in time, in the Julian Day Number format.
+ * @param lat,lon Latitude and Longitude.
+ *
+ * @return a pointer to a Chart structure.
+ */
+extern
+Chart*
+make_chart_with( ChartConfig* cf, char* name, double jdn, double lat, double lon )
    {
    Chart* c;
    c = malloc( sizeof( Chart ) );
@@ -121,23 +265,209 @@ make_chart( char* name, double jdn, double lat, double lon )
    c->ev->jdn = jdn;
    c->ev->lat = lat;
    c->ev->lon = lon;
-   // count point length
-   int len=0;
-   while( the_pts[len]!=SE_END ) { len++; }
-   c->pt_count = len;
-   c->sys_count = strlen(the_systems);
-   //at least 12 houses, but more if many alt housesystems requested
-   c->cp_count = 12 + 12 * (c->sys_count/4);
-   // alloc big array which is both Cusps and Points
-   c->cusps = calloc( sizeof( Point ), (c->pt_count + c->cp_count) );
-   c->points = c->cusps + c->cp_count;
+   // sizes come precomputed from the config
+   c->pt_count = cf->pt_count;
+   c->sys_count = cf->sys_count;
+   c->cp_count = cf->cp_count;
+   // alloc big block which is Cusps, Points and cusps of all systems
+   void* block;
+   block = calloc( 1, chart_block_size( cf ) );
+   place_chart_block( c, block );
    // populate arrays
-   fill_points( c );
-   fill_cusps( c );
+   fill_points( c, cf );
+   fill_cusps( c, cf );
+   c->aspects = malloc( sizeof(Aspect) * MAX_ASPECTS( c->pt_count ) );
+   fill_aspects( c );
+   // give back what was not used by aspects
+   Aspect* tmp = realloc( c->aspects, sizeof(Aspect) * MAX( c->asp_count, 1 ) );
+   if( tmp ) { c->aspects = tmp; }
+   return c;
+   }
+
+/** make_chart_of_numbers() rebuilds a Chart from numbers kept from
+ * another one, such as by store_chart(), without any calculation by
+ * the ephemeris. Aspects are found anew.
+ * @param cf Pointer to the ChartConfig the numbers were made with.
+ * @param ev Pointer to an Event, which is copied.
+ * @param pts For each point, lon, lat, dist and speed (4 * pt_count).
+ * @param cusps For each house system, the 12 cusps (12 * sys_count).
+ * @param codes Letter of each house system, '?' if it failed.
+ * @param defs The .def of each house Point, from house 1 to 12.
+ *
+ * @return a pointer to a Chart structure.
+ */
+extern
+Chart*
+make_chart_of_numbers( ChartConfig* cf, Event* ev, double* pts,
+                       double* cusps, char* codes, double* defs )
+   {
+   Chart* c;
+   c = malloc( sizeof( Chart ) );
+   c->ev = malloc( sizeof( Event ) );
+   c->ev->name = strdup( ev->name );
+   c->ev->jdn = ev->jdn;
+   c->ev->lat = ev->lat;
+   c->ev->lon = ev->lon;
+   c->pt_count = cf->pt_count;
+   c->sys_count = cf->sys_count;
+   c->cp_count = cf->cp_count;
+   void* block;
+   block = calloc( 1, chart_block_size( cf ) );
+   place_chart_block( c, block );
+   for ( int i = 0; i < c->pt_count; i++ )
+      {
+      // a point the ephemeris failed on is NAN, and left as fill_points() does
+      if ( isnan( pts[4*i] ) )
+         {
+         (*c).points[i].code = cf->pts[i];
+         g_strlcpy( (*c).points[i].name, "Swiss Ephemeris error", NAME_SIZE );
+         g_strlcpy( (*c).points[i].symbol, "?", SYMB_SIZE );
+         continue;
+         }
+      memcpy( c->points[i].data, pts + 4*i, sizeof( double ) * 4 );
+      name_point( c->points + i, cf->pts[i] );
+      }
+   memcpy( c->sys_cusps, cusps, sizeof( double ) * 12 * c->sys_count );
+   memcpy( c->sys_codes, codes, c->sys_count );
+   name_houses( c, cf );
+   for ( int i = 1; i <= 12; i++ ) { c->house( i ).def = defs[i-1]; }
+   c->aspects = malloc( sizeof(Aspect) * MAX_ASPECTS( c->pt_count ) );
+   fill_aspects( c );
+   Aspect* tmp = realloc( c->aspects, sizeof(Aspect) * MAX( c->asp_count, 1 ) );
+   if( tmp ) { c->aspects = tmp; }
+   return c;
+   }
+
+//---- ARENAS --------------------------------------------------------//
+/** struct ArenaBlock is one big chunk of memory of a ChartArena. */
+struct ArenaBlock
+   {
+   struct ArenaBlock* prev;
+   size_t size;
+   char data[];
+   };
+
+#define ARENA_ALIGN 16
+#define ARENA_DEFAULT_BLOCK ( 1024 * 1024 )
+
+/** make_chart_arena() allocates an arena to make many charts from.
+ * @param block_size Bytes per block, or 0 for a sensible default.
+ *
+ * @return pointer to a ChartArena, that must be dumped.
+ */
+extern
+ChartArena*
+make_chart_arena( size_t block_size )
+   {
+   ChartArena* a;
+   a = malloc( sizeof( ChartArena ) );
+   a->block = NULL;
+   a->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK;
+   a->used = 0;
+   a->chart_count = 0;
+   return a;
+   }
+
+/** arena_alloc() carves @p sz bytes out of the current block of an
+ * arena, starting a new block when it does not fit.
+ * @param a Pointer to a ChartArena.
+ * @param sz Size in bytes.
+ *
+ * @return pointer to uninitialized memory, valid until the arena is
+ *         cleared or dumped.
+ */
+intern
+void*
+arena_alloc( ChartArena* a, size_t sz )
+   {
+   sz = ( sz + ARENA_ALIGN - 1 ) & ~(size_t)( ARENA_ALIGN - 1 );
+   if ( a->block == NULL || a->used + sz > a->block->size )
+      {
+      size_t bsz = MAX( sz, a->block_size );
+      struct ArenaBlock* b;
+      b = malloc( sizeof( struct ArenaBlock ) + bsz );
+      enforce( "allocate arena block", b );
+      b->size = bsz;
+      b->prev = a->block;
+      a->block = b;
+      a->used = 0;
+      }
+   void* ptr = a->block->data + a->used;
+   a->used += sz;
+   return ptr;
+   }
+
+/** make_chart_in() is make_chart_with(), but all memory of the Chart
+ * comes from an arena. Such charts must NOT be passed to dump_chart(),
+ * they are freed together by clear_chart_arena() or dump_chart_arena().
+ * @param a Pointer to a ChartArena.
+ * @param cf Pointer to a ChartConfig, with points and house systems.
+ * @param name String describing the event, usually a name.
+ * @param jdn A precise moment in time, in the Julian Day Number format.
+ * @param lat,lon Latitude and Longitude.
+ *
+ * @return a pointer to a Chart structure.
+ */
+extern
+Chart*
+make_chart_in( ChartArena* a, ChartConfig* cf, char* name,
+               double jdn, double lat, double lon )
+   {
+   size_t namelen = strlen( name ) + 1;
+   Chart* c = arena_alloc( a, sizeof( Chart ) );
+   c->ev = arena_alloc( a, sizeof( Event ) );
+   c->ev->name = memcpy( arena_alloc( a, namelen ), name, namelen );
+   c->ev->jdn = jdn;
+   c->ev->lat = lat;
+   c->ev->lon = lon;
+   c->pt_count = cf->pt_count;
+   c->sys_count = cf->sys_count;
+   c->cp_count = cf->cp_count;
+   size_t blocksz = chart_block_size( cf );
+   place_chart_block( c, memset( arena_alloc( a, blocksz ), 0, blocksz ) );
+   fill_points( c, cf );
+   fill_cusps( c, cf );
+   // aspects go last, so the unused tail can be given back at once
+   size_t aspsz = sizeof( Aspect ) * MAX_ASPECTS( c->pt_count );
+   c->aspects = arena_alloc( a, aspsz );
    fill_aspects( c );
+   size_t unused = aspsz - sizeof( Aspect ) * c->asp_count;
+   a->used -= unused & ~(size_t)( ARENA_ALIGN - 1 );
+   a->chart_count++;
    return c;
    }
 
+/** clear_chart_arena() frees all charts made in an arena at once.
+ * The first block is kept, so the arena can be reused for the next
+ * batch without going back to malloc.
+ * @param a Pointer to a ChartArena.
+ */
+extern
+void
+clear_chart_arena( ChartArena* a )
+   {
+   while ( a->block && a->block->prev )
+      {
+      struct ArenaBlock* prev = a->block->prev;
+      free( a->block );
+      a->block = prev;
+      }
+   a->used = 0;
+   a->chart_count = 0;
+   }
+
+/** dump_chart_arena() frees an arena and every chart made in it.
+ * @param a Pointer to a ChartArena.
+ */
+extern
+void
+dump_chart_arena( ChartArena* a )
+   {
+   clear_chart_arena( a );
+   if ( a->block ) { free( a->block ); }
+   free( a );
+   }
+
 /** make_chart_of_event() calls make_chart() with data from an event.
  * @param ev An Event* structure.
  *
@@ -164,241 +494,1198 @@ dump_chart( Chart* c )
    free( c );
    }
 
-/** fill_points() calculates the points in a Chart.
- * @param c Pointer to a Chart structure.
- */
+//---- POINT CACHE ---------------------------------------------------//
+//-- Charts of one moment at many places have the same points, so the
+//-- ephemeris results are kept in a small direct-mapped cache, keyed by
+//-- (jdn, code, flags). It is per thread, like the ephemeris itself, so
+//-- it needs no locks; a new entry simply replaces the one in its slot.
+#define POINT_CACHE_SIZE 1024 // a power of 2, at least 64
+
+typedef struct CachedPoint
+   {
+   double jdn;
+   int code;
+   int flags; // 0 for an empty slot
+   double ret[6];
+   }
+CachedPoint;
+
+static __thread CachedPoint point_cache[POINT_CACHE_SIZE];
+static __thread PointCacheStats point_cache_stats;
+
+/** point_cache_slot() is where a point would be in the cache. Each
+ * moment maps to a row of 64 slots, one per point code (modulo 64),
+ * so the planets and nodes of one chart do not push each other out;
+ * asteroids whose codes are equal modulo 64 do, and are then simply
+ * calculated again. */
+intern
+CachedPoint*
+point_cache_slot( double jdn, int code, int flags )
+   {
+   guint64 bits;
+   memcpy( &bits, &jdn, sizeof bits );
+   bits = ( bits ^ ( bits >> 29 ) ^ flags ) * 0xBF58476D1CE4E5B9ull;
+   int row = ( bits >> 40 ) & ( POINT_CACHE_SIZE/64 - 1 );
+   return point_cache + row * 64 + ( code & 63 );
+   }
+
+/** get_point_cache_stats() tells how the point cache of the calling
+ * thread has done since it was last cleared.
+ *
+ * @return hits and misses of the cache.
+ */
+extern
+PointCacheStats
+get_point_cache_stats()
+   {
+   return point_cache_stats;
+   }
+
+/** clear_point_cache() empties the point cache of the calling thread,
+ * and zeroes its stats.
+ */
+extern
+void
+clear_point_cache()
+   {
+   memset( point_cache, 0, sizeof point_cache );
+   point_cache_stats = ( PointCacheStats ) {};
+   }
+
+/** calc_point() calculates one point at one moment, it is the single
+ * place where point positions come from: the Series of the config if
+ * it has the point accurately enough, or else the ephemeris (through
+ * the point cache).
+ * @param cf Pointer to the ChartConfig in use, or NULL for the ephemeris.
+ * @param jdn Moment in time, in JDN format.
+ * @param code Swiss Ephemeris point code.
+ * @param ret Array of at least 6 doubles: lon, lat, dist, and speeds.
+ *
+ * @return negative on error, as swe_calc_ut().
+ */
+extern
+int
+calc_point( ChartConfig* cf, double jdn, int code, double* ret )
+   {
+   char err[AS_MAXCH];
+   int flags = SEFLG_SPEED;
+   if ( cf && cf->series && 0 == eval_series( cf->series, code, jdn, cf->accuracy, ret ) )
+      { return flags; }
+   CachedPoint* slot = point_cache_slot( jdn, code, flags );
+   if ( slot->flags == flags && slot->code == code && slot->jdn == jdn )
+      {
+      point_cache_stats.hits++;
+      memcpy( ret, slot->ret, sizeof slot->ret );
+      return flags;
+      }
+   point_cache_stats.misses++;
+   int stat = swe_calc_ut( jdn, code, flags, ret, err );
+   // errors are not kept, the next call may have the ephemeris file
+   if ( stat >= 0 )
+      {
+      *slot = ( CachedPoint ) { jdn, code, flags };
+      memcpy( slot->ret, ret, sizeof slot->ret );
+      }
+   return stat;
+   }
+
+/** calc_houses() calculates the cusps of all house systems of a config.
+ * Sidereal time, obliquity and nutation are worked out once, and every
+ * system is derived from the same ARMC, which is what swe_houses()
+ * would do for each of them.
+ * @param cf Pointer to the ChartConfig, with the house systems.
+ * @param jdn,lat,lon Moment and place.
+ * @param cusps Array of 12 doubles per system, filled system by system,
+ *        NAN for the systems that could not be calculated.
+ * @param tags Array of one char per system, the system letter or '?'
+ *        if it could not be calculated.
+ * @param ascmc Array of 10 doubles for Ascendant, MC, ARMC and so on.
+ */
+extern
+void
+calc_houses( ChartConfig* cf, double jdn, double lat, double lon,
+             double* cusps, char* tags, double* ascmc )
+   {
+   double ret[13] = {};
+   double nut[6];
+   double sun[6];
+   char err[AS_MAXCH];
+   // true obliquity, ..., nutation, without which no system can be had
+   if ( calc_point( cf, jdn, SE_ECL_NUT, nut ) < 0 )
+      {
+      for( int s=0; s<cf->sys_count; s++ ) { tags[s] = '?'; }
+      for( int k=0; k<12*cf->sys_count; k++ ) { cusps[k] = NAN; }
+      return;
+      }
+   double armc = swe_degnorm( swe_sidtime0( jdn, nut[0], nut[2] ) * 15.0 + lon );
+   int sunshine = 0; // 1 once the Sun is had, -1 if it failed
+   for( int s=0; s<cf->sys_count; s++ )
+      {
+      tags[s] = cf->systems[s];
+      // Sunshine houses also need the declination of the Sun
+      if( 'I' == tags[s] || 'i' == tags[s] )
+         {
+         if( !sunshine )
+            {
+            sunshine = swe_calc_ut( jdn, SE_SUN, SEFLG_EQUATORIAL, sun, err ) < 0 ? -1 : 1;
+            }
+         if( sunshine < 0 )
+            {
+            tags[s] = '?';
+            for( int k=0; k<12; k++ ) { cusps[12*s + k] = NAN; }
+            continue;
+            }
+         ascmc[9] = sun[1];
+         }
+      if( -1 == swe_houses_armc( armc, lat, nut[0], tags[s], ret, ascmc ) )
+         {
+         // failed systems are NAN, in charts as in batches
+         tags[s] = '?';
+         for( int k=0; k<12; k++ ) { cusps[12*s + k] = NAN; }
+         continue;
+         }
+      memcpy( cusps + 12*s, ret + 1, 12 * sizeof( double ) );
+      }
+   }
+
+/** fill_points() calculates the points in a Chart.
+ * @param c Pointer to a Chart structure.
+ * @param cf Pointer to the ChartConfig it was made with.
+ */
+intern
+void
+fill_points( Chart* c, ChartConfig* cf )
+   {
+   long stat;
+   double ret[6];
+   //---
+   for ( int i=0; i < c->pt_count; i++ )
+      {
+      stat = calc_point( cf, c->ev->jdn, cf->pts[i], ret );
+      if ( stat<0 )
+         {
+         (*c).points[i].code  =cf->pts[i];
+         g_strlcpy( (*c).points[i].name, "Swiss Ephemeris error", NAME_SIZE );
+         g_strlcpy( (*c).points[i].symbol, "?", SYMB_SIZE );
+         }
+      else
+         {
+         (*c).points[i].lon   =ret[0];
+         (*c).points[i].lat   =ret[1];
+         (*c).points[i].dist  =ret[2];
+         (*c).points[i].speed =ret[3];
+         name_point( (*c).points + i, cf->pts[i] );
+         }
+      }
+   stat = calc_point( cf, c->ev->jdn, SE_TRUE_NODE, ret );
+   (*c).points[-12].def = ret[0];
+   }
+
+/** name_point() sets the code, name and symbol of a Point. */
+intern
+void
+name_point( Point* p, int code )
+   {
+   char buff[50]; /* SWEPH address for planet name, at least 20 char */
+   p->code = code;
+   swe_get_planet_name( code, buff );
+   g_strlcpy( p->name, buff, NAME_SIZE );
+   to_symbol_utf( p->symbol, code );
+   }
+
+/** fill_cusps() calculates house cusps in a Chart.
+ * The 12 house Points have the first system as .cusp, and the second
+ * and third (if any) as .alt1 and .alt2; all systems are also in
+ * Chart.sys_cusps, see housealt().
+ * @param c A pointer to a Chart structure.
+ * @param cf Pointer to the ChartConfig it was made with.
+ */
+intern
+void
+fill_cusps( Chart* c, ChartConfig* cf )
+   {
+   double extra[10] = {};
+   calc_houses( cf, c->ev->jdn, c->ev->lat, c->ev->lon, c->sys_cusps, c->sys_codes, extra );
+   name_houses( c, cf );
+   (*c).points[-1].def = extra[0]; // Ascendant
+   (*c).points[-2].def = extra[5]; // "co-ascendant Kock"
+   (*c).points[-3].def = extra[6]; // "co-ascendant Munkasey"
+   (*c).points[-4].def = extra[2]; // Right ascension ARMC
+   (*c).points[-5].def = extra[4]; // "equatorial ascendant"
+   (*c).points[-6].def = extra[7]; // "polar ascendant"
+   (*c).points[-7].def = extra[3]; // West Point (Vertex)
+   //(*c).points[-8].def = extra[?];
+   //(*c).points[-9].def = extra[?];
+   (*c).points[-10].def = extra[1];// Midheaven MC
+   //(*c).points[-11].def = extra[?];
+   /// @todo add missing (*c).points[-8,-9,-11,-12].def
+   //(*c).points[-12].def = ret[0];
+   }
+
+/** name_houses() fills the 12 house Points from Chart.sys_cusps. */
+intern
+void
+name_houses( Chart* c, ChartConfig* cf )
+   {
+   c->sys_codes[c->sys_count] = '\0';
+   for( int i=1; i<=12; i++ ) //ATTENTION! counting from 1!
+      {
+      (*c).points[-i].code = -i;
+      to_roman( (*c).points[-i].name, i);
+      for( int s=0; s<3 && s<cf->sys_count; s++ )
+         {
+         (*c).points[-i].data[s] = c->housealt( i, s );
+         (*c).points[-i].symbol[s] = c->syscode( s );
+         }
+      }
+   }
+
+/** house_of() finds the house a longitude is in.
+ * @param cusps The 12 cusps of a house system, as &c->housealt( 1, s ).
+ * @param lon A sky position, in degrees.
+ *
+ * @return the house, from 1 to 12, or 0 if the cusps are NAN.
+ */
+extern
+int
+house_of( double* cusps, double lon )
+   {
+   for ( int h = 1; h <= 12; h++ )
+      {
+      double from = cusps[h-1];
+      double to = cusps[h % 12];
+      if ( fmod( lon - from + 720.0, 360.0 ) < fmod( to - from + 720.0, 360.0 ) ) { return h; }
+      }
+   return 0;
+   }
+
+/** symbols for the harmonic aspect kinds of to_aspect(), by kind */
+static const char* const harmonic_symbs[] =
+   {
+   " ","\u260C","\u260D","\u25B3","\u25A1","\u2155","\u26B9","\u2150",
+   " "," "," "," ","\u26BA" // Quincunx \u26BB is not a harmonic
+   };
+
+/** to_aspect() determines whether there is an aspect between to angles.
+ * @param ang1, ang2 Two sky positions, in degrees.
+ *
+ * @return An Aspect structure, that can be .kind=0 for no aspect.
+ */
+Aspect
+to_aspect( double ang1, double ang2 )
+   {
+   Aspect a = {.kind=0,.diff=0.0,.score=0.0,.symbol={'.','\0','\0','\0'} };
+   double m, s;
+   a.diff = fabs( ang1 - ang2 );
+   if ( a.diff > 180.0 ) { a.diff = ( a.diff - 360.0 ) * -1.0; }
+   #define RANK(n) m = fabs( fmod( a.diff, 360.0/n ) - (180/n) ) / (180.0/n); \
+      s = pow( m, 18 ) * 110.0 - 10.0;
+   for ( int i = 1; i<8; i++ )
+      {
+      RANK( (double)i );
+      if ( s>a.score ) { a.score = s; a.kind = i; }
+      }
+   RANK( 12.0 );
+   if ( s>a.score ) { a.score = s; a.kind = 12; }
+   g_strlcpy( a.symbol, harmonic_symbs[a.kind], SYMB_SIZE );
+   return a;
+#undef RANK
+   }
+
+//---- VECTOR KERNELS for to_aspect() --------------------------------//
+//-- They do the same math as to_aspect() on many pairs at once, but
+//-- without fmod() and pow(). Kinds are always the same as to_aspect():
+//-- when two harmonics score closer than ASPECT_AMBIGUOUS, which is far
+//-- more than the rounding differences, that pair is redone by
+//-- to_aspect() itself. Scores are the same within ASPECT_TOLERANCE.
+static const double harmonics[8] = { 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 12.0 };
+#define ASPECT_AMBIGUOUS 1e-4
+
+intern
+void
+to_aspects_scalar( double* ang1, double* ang2, int n, int* kinds, float* scores )
+   {
+   for ( int i = 0; i < n; i++ )
+      {
+      Aspect a = to_aspect( ang1[i], ang2[i] );
+      kinds[i] = a.kind;
+      scores[i] = a.score;
+      }
+   }
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_ASPECT_KERNELS
+
+__attribute__(( target( "sse2" ) ))
+intern
+void
+to_aspects_sse2( double* ang1, double* ang2, int n, int* kinds, float* scores )
+   {
+   const __m128d sign = _mm_set1_pd( -0.0 );
+   const __m128d ambig = _mm_set1_pd( ASPECT_AMBIGUOUS );
+   int i = 0;
+   for ( ; i + 2 <= n; i += 2 )
+      {
+      __m128d d, far, best, kind, amb;
+      d = _mm_sub_pd( _mm_loadu_pd( ang1+i ), _mm_loadu_pd( ang2+i ) );
+      d = _mm_andnot_pd( sign, d );
+      far = _mm_cmpgt_pd( d, _mm_set1_pd( 180.0 ) );
+      d = _mm_or_pd( _mm_and_pd( far, _mm_sub_pd( _mm_set1_pd( 360.0 ), d ) ),
+                     _mm_andnot_pd( far, d ) );
+      best = kind = amb = _mm_setzero_pd();
+      for ( int h = 0; h < 8; h++ )
+         {
+         __m128d per = _mm_set1_pd( 360.0 / harmonics[h] );
+         __m128d half = _mm_set1_pd( 180.0 / harmonics[h] );
+         // d is never negative, so truncation is floor
+         __m128d q = _mm_cvtepi32_pd( _mm_cvttpd_epi32( _mm_div_pd( d, per ) ) );
+         __m128d m = _mm_sub_pd( _mm_sub_pd( d, _mm_mul_pd( q, per ) ), half );
+         m = _mm_div_pd( _mm_andnot_pd( sign, m ), half );
+         __m128d m2 = _mm_mul_pd( m, m );
+         __m128d m16 = _mm_mul_pd( m2, m2 );
+         m16 = _mm_mul_pd( m16, m16 );
+         m16 = _mm_mul_pd( m16, m16 );
+         __m128d s = _mm_mul_pd( _mm_mul_pd( m16, m2 ), _mm_set1_pd( 110.0 ) );
+         s = _mm_sub_pd( s, _mm_set1_pd( 10.0 ) );
+         // same test as to_aspect(), against the score rounded to float
+         __m128d gt = _mm_cmpgt_pd( s, best );
+         amb = _mm_or_pd( amb,
+               _mm_cmplt_pd( _mm_andnot_pd( sign, _mm_sub_pd( s, best ) ), ambig ) );
+         s = _mm_cvtps_pd( _mm_cvtpd_ps( s ) );
+         best = _mm_or_pd( _mm_and_pd( gt, s ), _mm_andnot_pd( gt, best ) );
+         kind = _mm_or_pd( _mm_and_pd( gt, _mm_set1_pd( harmonics[h] ) ),
+                           _mm_andnot_pd( gt, kind ) );
+         }
+      double k[2], b[2];
+      _mm_storeu_pd( k, kind );
+      _mm_storeu_pd( b, best );
+      int redo = _mm_movemask_pd( amb );
+      for ( int j = 0; j < 2; j++ )
+         {
+         if ( redo & (1<<j) )
+            { to_aspects_scalar( ang1+i+j, ang2+i+j, 1, kinds+i+j, scores+i+j ); }
+         else
+            { kinds[i+j] = (int) k[j]; scores[i+j] = (float) b[j]; }
+         }
+      }
+   to_aspects_scalar( ang1+i, ang2+i, n-i, kinds+i, scores+i );
+   }
+
+__attribute__(( target( "avx2" ) ))
+intern
+void
+to_aspects_avx2( double* ang1, double* ang2, int n, int* kinds, float* scores )
+   {
+   const __m256d sign = _mm256_set1_pd( -0.0 );
+   const __m256d ambig = _mm256_set1_pd( ASPECT_AMBIGUOUS );
+   int i = 0;
+   for ( ; i + 4 <= n; i += 4 )
+      {
+      __m256d d, far, best, kind, amb;
+      d = _mm256_sub_pd( _mm256_loadu_pd( ang1+i ), _mm256_loadu_pd( ang2+i ) );
+      d = _mm256_andnot_pd( sign, d );
+      far = _mm256_cmp_pd( d, _mm256_set1_pd( 180.0 ), _CMP_GT_OQ );
+      d = _mm256_blendv_pd( d, _mm256_sub_pd( _mm256_set1_pd( 360.0 ), d ), far );
+      best = kind = amb = _mm256_setzero_pd();
+      for ( int h = 0; h < 8; h++ )
+         {
+         __m256d per = _mm256_set1_pd( 360.0 / harmonics[h] );
+         __m256d half = _mm256_set1_pd( 180.0 / harmonics[h] );
+         __m256d q = _mm256_floor_pd( _mm256_div_pd( d, per ) );
+         __m256d m = _mm256_sub_pd( _mm256_sub_pd( d, _mm256_mul_pd( q, per ) ), half );
+         m = _mm256_div_pd( _mm256_andnot_pd( sign, m ), half );
+         __m256d m2 = _mm256_mul_pd( m, m );
+         __m256d m16 = _mm256_mul_pd( m2, m2 );
+         m16 = _mm256_mul_pd( m16, m16 );
+         m16 = _mm256_mul_pd( m16, m16 );
+         __m256d s = _mm256_mul_pd( _mm256_mul_pd( m16, m2 ), _mm256_set1_pd( 110.0 ) );
+         s = _mm256_sub_pd( s, _mm256_set1_pd( 10.0 ) );
+         // same test as to_aspect(), against the score rounded to float
+         __m256d gt = _mm256_cmp_pd( s, best, _CMP_GT_OQ );
+         amb = _mm256_or_pd( amb, _mm256_cmp_pd(
+               _mm256_andnot_pd( sign, _mm256_sub_pd( s, best ) ), ambig, _CMP_LT_OQ ) );
+         s = _mm256_cvtps_pd( _mm256_cvtpd_ps( s ) );
+         best = _mm256_blendv_pd( best, s, gt );
+         kind = _mm256_blendv_pd( kind, _mm256_set1_pd( harmonics[h] ), gt );
+         }
+      double k[4], b[4];
+      _mm256_storeu_pd( k, kind );
+      _mm256_storeu_pd( b, best );
+      int redo = _mm256_movemask_pd( amb );
+      for ( int j = 0; j < 4; j++ )
+         {
+         if ( redo & (1<<j) )
+            { to_aspects_scalar( ang1+i+j, ang2+i+j, 1, kinds+i+j, scores+i+j ); }
+         else
+            { kinds[i+j] = (int) k[j]; scores[i+j] = (float) b[j]; }
+         }
+      }
+   to_aspects_scalar( ang1+i, ang2+i, n-i, kinds+i, scores+i );
+   }
+#endif
+
+/** to_aspects() is to_aspect() for many pairs of angles at once.
+ * It uses SSE2 or AVX2 when the processor has them. Kinds are always
+ * the same as to_aspect() would give, scores differ by no more than
+ * ASPECT_TOLERANCE (that is, one float rounding of a score).
+ * @param ang1, ang2 Arrays of sky positions, in degrees.
+ * @param n Number of pairs.
+ * @param kinds Array of n ints, for the aspect kinds (0 for none).
+ * @param scores Array of n floats, for the aspect scores.
+ */
+void
+to_aspects( double* ang1, double* ang2, int n, int* kinds, float* scores )
+   {
+#ifdef HAVE_ASPECT_KERNELS
+   if ( __builtin_cpu_supports( "avx2" ) )
+      { to_aspects_avx2( ang1, ang2, n, kinds, scores ); }
+   else if ( __builtin_cpu_supports( "sse2" ) )
+      { to_aspects_sse2( ang1, ang2, n, kinds, scores ); }
+   else
+#endif
+      { to_aspects_scalar( ang1, ang2, n, kinds, scores ); }
+   }
+
+#define ASPECT_CHUNK 256
+intern
+void
+fill_aspects( Chart* c )
+   {
+   // c->aspects must have room for MAX_ASPECTS( c->pt_count )
+   double ang1[ASPECT_CHUNK], ang2[ASPECT_CHUNK];
+   int i1[ASPECT_CHUNK], i2[ASPECT_CHUNK], kinds[ASPECT_CHUNK];
+   float scores[ASPECT_CHUNK];
+   int count = 0;
+   int n = 0;
+   for ( int i = 0; i < c->pt_count; i++)
+      {
+      for ( int k = i+1; k < c->pt_count; k++ )
+         {
+         i1[n] = i;
+         i2[n] = k;
+         ang1[n] = c->points[i].lon;
+         ang2[n] = c->points[k].lon;
+         n++;
+         // score a full chunk, or what is left after the last pair
+         if ( n < ASPECT_CHUNK && !( i == c->pt_count-2 ) ) { continue; }
+         to_aspects( ang1, ang2, n, kinds, scores );
+         for ( int j = 0; j < n; j++ )
+            {
+            if( kinds[j] == 0 ) { continue; }
+            Aspect* a = c->aspects + count++;
+            a->kind = kinds[j];
+            a->score = scores[j];
+            a->point1 = i1[j];
+            a->point2 = i2[j];
+            a->diff = fabs( ang1[j] - ang2[j] );
+            if ( a->diff > 180.0 ) { a->diff = ( a->diff - 360.0 ) * -1.0; }
+            g_strlcpy( a->symbol, harmonic_symbs[a->kind], SYMB_SIZE );
+            }
+         n = 0;
+         }
+      }
+   c->asp_count = count;
+   }
+
+/** aspect_of_pair() tests two longitudes against one of aspect_defs[].
+ * All aspect finders decide through here, so they agree to the bit.
+ * @param lon1, lon2 Longitudes of the two points.
+ * @param m Index in aspect_defs[].
+ * @param a Pointer to an Aspect, filled (but for the points) if found.
+ *
+ * @return 1 if the points are in that aspect, 0 if not.
+ */
+intern
+int
+aspect_of_pair( double lon1, double lon2, int m, Aspect* a )
+   {
+   double d = lon1 - lon2;
+   d = d < 180.0 ? d : d - 360.0;
+   d = d >-180.0 ? d : d + 360.0;
+   double da = fabs( d );
+   if ( !( fabs( da-aspect_defs[m].angle )<aspect_defs[m].orb ) ) { return 0; }
+   a->kind = aspect_defs[m].kind;
+   a->score = aspect_defs[m].orb-fabs( da-aspect_defs[m].angle );
+   a->diff = d;
+   g_strlcpy( a->symbol, aspect_defs[m].symbol, SYMB_SIZE );
+   return 1;
+   }
+
+/** brute_aspects() tests every pair of points against every aspect. */
+intern
+Aspect*
+brute_aspects( Chart* c )
+   {
+   Aspect* list = malloc( sizeof(Aspect) * ( MAX_ASPECTS( c->pt_count ) + 1 ) );
+   int ac = 0;
+   for ( int i = 0; c->pt_count > i; i++ )
+      {
+      for ( int k=i+1; c->pt_count > k; k++ )
+         {
+         for ( int m=0; aspect_defs[m].kind!=0; m++ )
+            {
+            if ( aspect_of_pair( c->points[i].lon, c->points[k].lon, m, list+ac ) )
+               {
+               list[ac].point1 = i;
+               list[ac].point2 = k;
+               ac++;
+               }
+            }
+         }
+      }
+   list[ac++] = ( Aspect ) { 0, NAN, 0, 0, {}, NAN };
+   list = realloc( list, sizeof( Aspect ) * ac );
+   return list;
+   }
+
+//---- SORT AND SWEEP ------------------------------------------------//
+//-- With hundreds of points, testing all pairs is too slow. Instead
+//-- one side is sorted by longitude, and for each point and aspect only
+//-- the window lon+angle-orb .. lon+angle+orb is looked at. Windows
+//-- are a bit wider than the orbs, and every candidate is decided by
+//-- aspect_of_pair(), so the result is exactly that of testing all.
+#define SWEEP_SLACK 1e-6
+#define SWEEP_MIN_POINTS 24
+
+/** struct Candidate is a pair of points that may be in aspect m */
+typedef struct Candidate
+   {
+   int p1, p2, m;
+   }
+Candidate;
+
+intern
+int
+cmp_candidates( const void* a, const void* b )
+   {
+   const Candidate* x = a;
+   const Candidate* y = b;
+   if ( x->p1 != y->p1 ) { return x->p1 - y->p1; }
+   if ( x->p2 != y->p2 ) { return x->p2 - y->p2; }
+   return x->m - y->m;
+   }
+
+/** struct Sorted is one side of a sweep, indexes sorted by longitude
+ * and the longitudes repeated over three turns, from -360 to 720. */
+typedef struct Sorted
+   {
+   int n;
+   int* order;
+   double* ext;
+   }
+Sorted;
+
+/** struct Keyed is a longitude with the index it came from, sorted
+ * together so that qsort() needs no state besides the array. */
+typedef struct Keyed
+   {
+   double key;
+   int i;
+   }
+Keyed;
+
+intern
+int
+cmp_by_key( const void* a, const void* b )
+   {
+   double x = ( (const Keyed*) a )->key;
+   double y = ( (const Keyed*) b )->key;
+   return ( x > y ) - ( x < y );
+   }
+
+intern
+double
+norm_lon( double lon )
+   {
+   lon = fmod( lon, 360.0 );
+   return lon < 0.0 ? lon + 360.0 : lon;
+   }
+
+intern
+Sorted
+make_sorted( double* lons, int n )
+   {
+   Sorted s = { .n = n };
+   Keyed* keys = malloc( sizeof(Keyed) * MAX( n, 1 ) );
+   s.order = malloc( sizeof(int) * MAX( n, 1 ) );
+   s.ext = malloc( sizeof(double) * MAX( 3*n, 1 ) );
+   for ( int i = 0; i < n; i++ ) { keys[i] = ( Keyed ) { norm_lon( lons[i] ), i }; }
+   qsort( keys, n, sizeof(Keyed), cmp_by_key );
+   for ( int i = 0; i < n; i++ ) { s.order[i] = keys[i].i; }
+   for ( int t = 0; t < 3*n; t++ )
+      {
+      s.ext[t] = keys[t%n].key + 360.0 * ( t/n - 1 );
+      }
+   free( keys );
+   return s;
+   }
+
+intern
+void
+dump_sorted( Sorted s )
+   {
+   free( s.order );
+   free( s.ext );
+   }
+
+/** sweep_window() adds to @p cs every point of @p s whose longitude is
+ * within @p lo .. @p hi (with lo from -360 to 720).
+ *
+ * @return new count of candidates.
+ */
+intern
+int
+sweep_window( Sorted s, double lo, double hi, int i, int same, int m,
+              Candidate** cs, int* count, int* room )
+   {
+   // first place with ext >= lo
+   int a = 0, b = 3*s.n;
+   while ( a < b )
+      {
+      int mid = (a+b)/2;
+      if ( s.ext[mid] < lo ) { a = mid+1; } else { b = mid; }
+      }
+   for ( int t = a; t < 3*s.n && s.ext[t] <= hi; t++ )
+      {
+      int j = s.order[t % s.n];
+      if ( same && j == i ) { continue; }
+      if ( *count == *room )
+         {
+         *room *= 2;
+         *cs = realloc( *cs, sizeof(Candidate) * (*room) );
+         enforce( "grow aspect candidates", *cs );
+         }
+      // within one chart a pair is always (lower index, higher index)
+      if ( same && j < i ) { (*cs)[*count] = ( Candidate ) { j, i, m }; }
+      else { (*cs)[*count] = ( Candidate ) { i, j, m }; }
+      (*count)++;
+      }
+   return *count;
+   }
+
+/** sweep_aspects() finds all aspects between two lists of longitudes.
+ * @param lon1, n1 First list of longitudes.
+ * @param lon2, n2 Second list, sorted and swept.
+ * @param same If lon1 and lon2 are the same list, pairs are then only
+ *        looked at once, as (lower index, higher index).
+ *
+ * @return array of Aspects, ordered by point1, point2 and aspect_defs[],
+ *         terminated by one of .kind==0.
+ */
+intern
+Aspect*
+sweep_aspects( double* lon1, int n1, double* lon2, int n2, int same )
+   {
+   Sorted s = make_sorted( lon2, n2 );
+   int count = 0, room = 64;
+   Candidate* cs = malloc( sizeof(Candidate) * room );
+   for ( int m = 0; aspect_defs[m].kind != 0; m++ )
+      {
+      double ang = aspect_defs[m].angle;
+      double orb = aspect_defs[m].orb + SWEEP_SLACK;
+      for ( int i = 0; i < n1; i++ )
+         {
+         double l = norm_lon( lon1[i] );
+         sweep_window( s, l+ang-orb, l+ang+orb, i, same, m, &cs, &count, &room );
+         // within one chart the pair is seen from the other point
+         if ( same ) { continue; }
+         sweep_window( s, l-ang-orb, l-ang+orb, i, same, m, &cs, &count, &room );
+         }
+      }
+   dump_sorted( s );
+   qsort( cs, count, sizeof(Candidate), cmp_candidates );
+   Aspect* list = malloc( sizeof(Aspect) * ( count + 1 ) );
+   int ac = 0;
+   for ( int k = 0; k < count; k++ )
+      {
+      if ( k && 0 == cmp_candidates( cs+k, cs+k-1 ) ) { continue; }
+      if ( aspect_of_pair( lon1[cs[k].p1], lon2[cs[k].p2], cs[k].m, list+ac ) )
+         {
+         list[ac].point1 = cs[k].p1;
+         list[ac].point2 = cs[k].p2;
+         ac++;
+         }
+      }
+   free( cs );
+   list[ac++] = ( Aspect ) { 0, NAN, 0, 0, {}, NAN };
+   list = realloc( list, sizeof( Aspect ) * ac );
+   return list;
+   }
+
+/** make_aspects_by_sweep() is make_aspects() by sorting and sweeping,
+ * in O(n log n + k) for n points and k aspects found.
+ * @param Pointer to a Chart structure.
+ *
+ * @return Pointer to an array of Aspects, the same as make_aspects().
+ */
+Aspect*
+make_aspects_by_sweep( Chart* c )
+   {
+   double* lons = malloc( sizeof(double) * MAX( c->pt_count, 1 ) );
+   for_point_i( c ) { lons[i] = c->points[i].lon; }
+   Aspect* list = sweep_aspects( lons, c->pt_count, lons, c->pt_count, 1 );
+   free( lons );
+   return list;
+   }
+
+/** make_cross_aspects() finds aspects between the points of two charts,
+ * as for synastry or transits over a natal chart.
+ * @param a Pointer to the inner Chart, indexed by Aspect.point1.
+ * @param b Pointer to the outer Chart, indexed by Aspect.point2.
+ *
+ * @return Pointer to an array of Aspects, terminated by .kind==0, with
+ *         .diff as the longitude in @p a minus the one in @p b.
+ */
+Aspect*
+make_cross_aspects( Chart* a, Chart* b )
+   {
+   double* lons = malloc( sizeof(double) * MAX( a->pt_count + b->pt_count, 1 ) );
+   for_point_i( a ) { lons[i] = a->points[i].lon; }
+   for_point_i( b ) { lons[a->pt_count + i] = b->points[i].lon; }
+   Aspect* list = sweep_aspects( lons, a->pt_count, lons + a->pt_count, b->pt_count, 0 );
+   free( lons );
+   return list;
+   }
+
+/** make_aspects() allocates and calculates aspects (using aspect_defs[])
+ * Charts with many points are done by make_aspects_by_sweep().
+ * @param Pointer to a Chart structure.
+ *
+ * @return Pointer to an array of Aspects, terminated by .kind==0.
+ */
+Aspect*
+make_aspects( Chart* c )
+   {
+   if ( c->pt_count >= SWEEP_MIN_POINTS ) { return make_aspects_by_sweep( c ); }
+   return brute_aspects( c );
+   }
+
+/** dump_aspect() deallocates a naked array of aspects.
+ * @param Pointer to an array of Aspects.
+ */
+void
+dump_aspects( Aspect* ptr )
+   {
+   free( ptr );
+   }
+
+//---- EVENT FINDING -------------------------------------------------//
+//-- Returns, ingresses and stations are all roots of a function of
+//-- time: how far a point is from a longitude, or its speed. They are
+//-- found by scanning out from a date in steps shorter than the time
+//-- between two stations of the point, so a root shows as a change of
+//-- sign (taking care of the wrap at 0 Aries), and a station within a
+//-- step splits it in two pieces where the point moves one way only.
+//-- Each bracket is then refined by Newton steps kept inside it, or by
+//-- Brent's method for stations, since the change of speed is not at
+//-- hand. No search takes more than EVENT_MAX_CALLS ephemeris calls.
+#define EVENT_MAX_STEPS 4096 // per direction
+#define EVENT_MAX_ITER 64 // per refinement
+#define EVENT_MAX_CALLS ( 2 * EVENT_MAX_STEPS + 8 * EVENT_MAX_ITER )
+#define EVENT_TOLERANCE 1e-9 // in days, less than a millisecond
+#define CROSSING_MAX_MOVE 10.0 // degrees per step of find_crossings()
+
+/** struct Finder is the state of one search */
+typedef struct Finder
+   {
+   int code;
+   double target; // a longitude, or NAN when looking for stations
+   int calls;
+   }
+Finder;
+
+/** struct Sample is the function searched at a moment */
+typedef struct Sample
+   {
+   double t;
+   double val; // distance to the target, or speed for stations
+   double speed;
+   double lon;
+   }
+Sample;
+
+/** event_step() is a step, in days, that is safe to scan a point with.
+ * Points that never turn only need to move less than 90 degrees. */
+intern
+double
+event_step( int code )
+   {
+   switch ( code )
+      {
+      case SE_MOON: return 1.0;
+      case SE_SUN: return 20.0;
+      case SE_MERCURY: return 4.0;
+      case SE_VENUS: case SE_MARS: return 8.0;
+      case SE_JUPITER: case SE_SATURN: case SE_CHIRON: return 16.0;
+      case SE_URANUS: case SE_NEPTUNE: case SE_PLUTO: return 30.0;
+      case SE_MEAN_NODE: case SE_MEAN_APOG: return 60.0;
+      default: return 1.0; // true node, asteroids, ... better be safe
+      }
+   }
+
+/** never_turns() is true for points that have no stations */
 intern
-void
-fill_points( Chart* c )
+int
+never_turns( int code )
+   {
+   return code == SE_SUN || code == SE_MOON || code == SE_MEAN_NODE || code == SE_MEAN_APOG;
+   }
+
+intern
+int
+probe( Finder* f, double t, Sample* s )
    {
-   //--- swiss ephemeris vars
-   long stat;
-   long opts= SEFLG_SPEED;
    double ret[6];
-   char buff[50]; /* SWEPH address for planet name, at least 20 char */
-   char err[AS_MAXCH];
-   //---
-   for ( int i=0; i < c->pt_count; i++ )
+   if ( f->calls >= EVENT_MAX_CALLS ) { return -1; }
+   f->calls++;
+   if ( calc_point( the_config, t, f->code, ret ) < 0 ) { return -1; }
+   s->t = t;
+   s->lon = ret[0];
+   s->speed = ret[3];
+   s->val = isnan( f->target ) ? ret[3] : swe_difdeg2n( ret[0], f->target );
+   return 0;
+   }
+
+/** refine_crossing() finds where val is 0 between two samples of
+ * opposite sign, by Newton steps that fall back to bisection when they
+ * would leave the bracket. */
+intern
+double
+refine_crossing( Finder* f, Sample lo, Sample hi )
+   {
+   if ( lo.val == 0.0 ) { return lo.t; }
+   if ( hi.val == 0.0 ) { return hi.t; }
+   if ( lo.val > 0.0 ) { Sample x = lo; lo = hi; hi = x; } // lo.val < 0
+   Sample s;
+   double t = lo.t - lo.val * ( hi.t - lo.t ) / ( hi.val - lo.val );
+   for ( int i = 0; i < EVENT_MAX_ITER; i++ )
       {
-      stat = swe_calc_ut( c->ev->jdn,the_pts[i],opts,ret,err );
-      if ( stat<0 )
+      if ( probe( f, t, &s ) < 0 ) { return NAN; }
+      if ( s.val == 0.0 ) { return t; }
+      if ( s.val < 0.0 ) { lo = s; } else { hi = s; }
+      double next = t - s.val / s.speed;
+      if ( !( next > MIN( lo.t, hi.t ) && next < MAX( lo.t, hi.t ) ) )
          {
-         (*c).points[i].code  =the_pts[i];
-         g_strlcpy( (*c).points[i].name, "Swiss Ephemeris error", NAME_SIZE );
-         g_strlcpy( (*c).points[i].symbol, "?", SYMB_SIZE );
+         next = ( lo.t + hi.t ) / 2.0;
          }
-      else
+      if ( fabs( next - t ) < EVENT_TOLERANCE || fabs( hi.t - lo.t ) < EVENT_TOLERANCE )
          {
-         (*c).points[i].code  =the_pts[i];
-         (*c).points[i].lon   =ret[0];
-         (*c).points[i].lat   =ret[1];
-         (*c).points[i].dist  =ret[2];
-         (*c).points[i].speed =ret[3];
-         swe_get_planet_name( the_pts[i], buff );
-         g_strlcpy( (*c).points[i].name, buff, NAME_SIZE );
-         to_symbol_utf( (*c).points[i].symbol,the_pts[i] );
+         return next;
          }
+      t = next;
       }
-   stat = swe_calc_ut( c->ev->jdn,SE_TRUE_NODE,opts,ret,err );
-   (*c).points[-12].def = ret[0];
+   return t;
    }
 
-/** fill_cusps() calculates house cusps in a Chart.
- * @param c A pointer to a Chart structure.
- */
+/** refine_station() finds where the speed is 0 between two samples of
+ * opposite speed, by Brent's method. */
 intern
-void
-fill_cusps( Chart* c )
+double
+refine_station( Finder* f, Sample a, Sample b )
    {
-   // swiss ephemeris stuff
-   double ret[13] = {};
-   double extra[10] = {};
-   long stat;
-   //char err[AS_MAXCH];
-   //long opts= SEFLG_SPEED;
-   //
-   if ( 'G' == the_systems[0] ) { puts( "Gauquelin not implemented" ); exit( 'g' ); }
-   int len = strlen( the_systems );
-   //
-   for( int s=0; s<len; s++ ) // s indexing the _S_ystems
-      {
-      int base = -12 * ((s+1)/4); // for .points[base-x]
-      char tag = the_systems[s];
-      stat = swe_houses(c->ev->jdn,c->ev->lat,c->ev->lon,tag,ret,extra );
-      if( stat==-1 ) { tag = '?'; }
-      for( int i=1; i<=12; i++ ) //ATTENTION! counting from 1!
-         {
-         int place = s<3 ? s : (s+1)%4;
-         (*c).points[base-i].data[place] = ret[i];
-         (*c).points[base-i].symbol[place] = tag;
-         if( !(s&&((s+1)%4)) ) //this is true everytime we are in a new 12-cluster
+   if ( a.speed == 0.0 ) { return a.t; }
+   if ( b.speed == 0.0 ) { return b.t; }
+   Sample c = b;
+   Sample s;
+   double d = 0.0, e = 0.0;
+   for ( int i = 0; i < EVENT_MAX_ITER; i++ )
+      {
+      if ( ( b.speed > 0.0 ) == ( c.speed > 0.0 ) )
+         {
+         c = a;
+         d = e = b.t - a.t;
+         }
+      if ( fabs( c.speed ) < fabs( b.speed ) )
+         {
+         a = b;
+         b = c;
+         c = a;
+         }
+      double tol = EVENT_TOLERANCE / 2.0;
+      double m = ( c.t - b.t ) / 2.0;
+      if ( fabs( m ) <= tol || b.speed == 0.0 ) { return b.t; }
+      if ( fabs( e ) >= tol && fabs( a.speed ) > fabs( b.speed ) )
+         {
+         // inverse quadratic interpolation, or secant
+         double p, q, r;
+         double sa = b.speed / a.speed;
+         if ( a.t == c.t )
+            {
+            p = 2.0 * m * sa;
+            q = 1.0 - sa;
+            }
+         else
+            {
+            q = a.speed / c.speed;
+            r = b.speed / c.speed;
+            p = sa * ( 2.0 * m * q * ( q - r ) - ( b.t - a.t ) * ( r - 1.0 ) );
+            q = ( q - 1.0 ) * ( r - 1.0 ) * ( sa - 1.0 );
+            }
+         if ( p > 0.0 ) { q = -q; } else { p = -p; }
+         if ( 2.0 * p < MIN( 3.0 * m * q - fabs( tol * q ), fabs( e * q ) ) )
+            {
+            e = d;
+            d = p / q;
+            }
+         else
             {
-            (*c).points[base-i].code = -i;
-            to_roman( (*c).points[base-i].name, i);
+            d = m;
+            e = m;
             }
          }
+      else
+         {
+         d = m;
+         e = m;
+         }
+      a = b;
+      double t = b.t + ( fabs( d ) > tol ? d : ( m > 0.0 ? tol : -tol ) );
+      if ( probe( f, t, &s ) < 0 ) { return NAN; }
+      b = s;
       }
-   (*c).points[-1].def = extra[0]; // Ascendant
-   (*c).points[-2].def = extra[5]; // "co-ascendant Kock"
-   (*c).points[-3].def = extra[6]; // "co-ascendant Munkasey"
-   (*c).points[-4].def = extra[2]; // Right ascension ARMC
-   (*c).points[-5].def = extra[4]; // "equatorial ascendant"
-   (*c).points[-6].def = extra[7]; // "polar ascendant"
-   (*c).points[-7].def = extra[3]; // West Point (Vertex)
-   //(*c).points[-8].def = extra[?];
-   //(*c).points[-9].def = extra[?];
-   (*c).points[-10].def = extra[1];// Midheaven MC
-   //(*c).points[-11].def = extra[?];
-   /// @todo add missing (*c).points[-8,-9,-11,-12].def
-   //(*c).points[-12].def = ret[0];
+   return b.t;
    }
 
-/** to_aspect() determines whether there is an aspect between to angles.
- * @param ang1, ang2 Two sky positions, in degrees.
- *
- * @return An Aspect structure, that can be .kind=0 for no aspect.
- */
-Aspect
-to_aspect( double ang1, double ang2 )
+/** crossing_in() is the root between two samples where the point moves
+ * one way only, or NAN if there is none. */
+intern
+double
+crossing_in( Finder* f, Sample a, Sample b )
    {
-   const char* symbs[] =
-      {" ","\u260C","\u260D","\u25B3","\u25A1","\u2155","\u26B9","\u2150"};
-      // Semisextile  \u26BA
-      // Quincunx     \u26BB
-   Aspect a = {.kind=0,.diff=0.0,.score=0.0,.symbol={'.','\0','\0','\0'} };
-   double m, s;
-   a.diff = fabs( ang1 - ang2 );
-   if ( a.diff > 180.0 ) { a.diff = ( a.diff - 360.0 ) * -1.0; }
-   #define RANK(n) m = fabs( fmod( a.diff, 360.0/n ) - (180/n) ) / (180.0/n); \
-      s = pow( m, 18 ) * 110.0 - 10.0;
-   for ( int i = 1; i<8; i++ )
+   if ( a.val == 0.0 ) { return a.t; }
+   // a change of sign, but not the jump from +180 to -180
+   if ( ( a.val < 0.0 ) != ( b.val < 0.0 ) && fabs( a.val ) + fabs( b.val ) < 180.0 )
       {
-      RANK( (double)i );
-      if ( s>a.score ) { a.score = s; a.kind = i; }
+      return refine_crossing( f, a, b );
       }
-   RANK( 12.0 );
-   if ( s>a.score ) { a.score = s; a.kind = 12; }
-   g_strlcpy( a.symbol, symbs[a.kind], SYMB_SIZE );
-   return a;
-#undef RANK
+   return NAN;
    }
 
+/** event_in_step() is the root between two samples that is closest to
+ * the first one, or NAN. */
 intern
-void
-fill_aspects( Chart* c )
+double
+event_in_step( Finder* f, Sample a, Sample b )
    {
-   int count = 0;
-   #define pts c->points
-   c->aspects = malloc( sizeof(Aspect) * c->pt_count*(c->pt_count-1) );
-   for ( int i = 0; i < c->pt_count; i++)
+   if ( isnan( f->target ) )
       {
-      for ( int k = i+1; k < c->pt_count; k++ )
+      if ( a.val == 0.0 ) { return a.t; }
+      if ( ( a.val < 0.0 ) != ( b.val < 0.0 ) ) { return refine_station( f, a, b ); }
+      return NAN;
+      }
+   double h = fabs( b.t - a.t );
+   // the point turns within the step, and could come back to the target
+   if ( ( a.speed < 0.0 ) != ( b.speed < 0.0 )
+        && MIN( fabs( a.val ), fabs( b.val ) ) < ( fabs( a.speed ) + fabs( b.speed ) ) * h )
+      {
+      Sample st;
+      double ts = refine_station( f, a, b );
+      if ( isnan( ts ) || probe( f, ts, &st ) < 0 ) { return NAN; }
+      double r = crossing_in( f, a, st );
+      return isnan( r ) ? crossing_in( f, st, b ) : r;
+      }
+   return crossing_in( f, a, b );
+   }
+
+/** nearest_event() scans both ways from @p ref for the closest root.
+ * @return A moment in JDN format, or NAN if none was found.
+ */
+intern
+double
+nearest_event( Finder* f, double ref )
+   {
+   double h = event_step( f->code );
+   double found[2] = { NAN, NAN };
+   Sample cur[2];
+   int live[2] = { 1, 1 };
+   if ( probe( f, ref, cur ) < 0 ) { return NAN; }
+   cur[1] = cur[0];
+   for ( int k = 0; k < EVENT_MAX_STEPS && ( live[0] || live[1] ); k++ )
+      {
+      for ( int d = 0; d < 2; d++ )
          {
-         c->aspects[count] = to_aspect( pts[i].lon, pts[k].lon );
-         if( c->aspects[count].kind != 0 )
+         Sample next;
+         if ( !live[d] ) { continue; }
+         if ( probe( f, cur[d].t + ( d ? -h : h ), &next ) < 0 ) { live[d] = 0; continue; }
+         found[d] = event_in_step( f, cur[d], next );
+         if ( !isnan( found[d] ) ) { live[d] = 0; }
+         cur[d] = next;
+         }
+      // no need to look farther than a root already found
+      for ( int d = 0; d < 2; d++ )
+         {
+         if ( live[d] && !isnan( found[!d] )
+              && fabs( cur[d].t - ref ) >= fabs( found[!d] - ref ) )
             {
-            c->aspects[count].point1 = i;
-            c->aspects[count].point2 = k;
-            count++;
+            live[d] = 0;
             }
          }
       }
-   c->asp_count = count;
-   #undef pts
+   if ( isnan( found[0] ) ) { return found[1]; }
+   if ( isnan( found[1] ) ) { return found[0]; }
+   return fabs( found[0] - ref ) <= fabs( found[1] - ref ) ? found[0] : found[1];
    }
 
-/** make_aspects() allocates and calculates aspects (using aspect_defs[])
- * @param Pointer to a Chart structure.
+/** crossings_in() reports every target crossed between two samples of
+ * a point moving one way only. A target right at @p q is left for the
+ * next piece, so it is not reported twice. */
+intern
+int
+crossings_in( int code, Sample p, Sample q, double* targets, int n,
+              CrossingFound* found, void* data )
+   {
+   int count = 0;
+   for ( int k = 0; k < n; k++ )
+      {
+      Finder f = { code, targets[k], 0 };
+      p.val = swe_difdeg2n( p.lon, targets[k] );
+      q.val = swe_difdeg2n( q.lon, targets[k] );
+      if ( q.val == 0.0 ) { continue; }
+      double t = crossing_in( &f, p, q );
+      if ( isnan( t ) ) { continue; }
+      found( t, k, data );
+      count++;
+      }
+   return count;
+   }
+
+/** scan_motion() steps a point through a span of time, cutting it in
+ * pieces where the point moves one way only: steps end where it turns.
+ * @param code Code of a point (sweph format).
+ * @param from, to Span of time, in JDN format.
+ * @param max_step Longest step, in days; steps are also kept shorter
+ *        than the time between stations, and shorter as it goes faster.
+ * @param found Called for each piece, in order of time.
+ * @param data Passed on to @p found.
  *
- * @return Pointer to an array of Aspects.
+ * @return 0, or -1 on an ephemeris error.
  */
-Aspect*
-make_aspects( Chart* c )
+extern
+int
+scan_motion( int code, double from, double to, double max_step,
+             PieceFound* found, void* data )
    {
-   Aspect* list = malloc( sizeof(Aspect) * c->pt_count*(c->pt_count-1) );
-   int ac = 0;
-   double da, d;
-   for ( int i = 0; c->pt_count > i; i++ )
+   Finder f = { code, NAN, 0 };
+   Sample a, b, st;
+   if ( probe( &f, from, &a ) < 0 ) { return -1; }
+   while ( a.t < to )
       {
-      for ( int k=i+1; c->pt_count > k; k++ )
+      double h = MIN( max_step, event_step( code ) );
+      h = MIN( h, CROSSING_MAX_MOVE / MAX( fabs( a.speed ), 1e-9 ) );
+      f.calls = 0;
+      if ( probe( &f, MIN( a.t + h, to ), &b ) < 0 ) { return -1; }
+      if ( ( a.speed < 0.0 ) != ( b.speed < 0.0 ) )
          {
-         d = c->points[i].lon - c->points[k].lon;
-         d = d < 180.0 ? d : d - 360.0;
-         d = d >-180.0 ? d : d + 360.0;
-         da = fabs( d );
-         for ( int m=0; aspect_defs[m].kind!=0; m++ )
-            {
-            if ( fabs( da-aspect_defs[m].angle )<aspect_defs[m].orb )
-               {
-               list[ac].kind = aspect_defs[m].kind;
-               list[ac].score = aspect_defs[m].orb-fabs( da-aspect_defs[m].angle );
-               list[ac].point1 = i;
-               list[ac].point2 = k;
-               list[ac].diff = d;
-               g_strlcpy( list[ac].symbol, aspect_defs[m].symbol, SYMB_SIZE );
-               ac++;
-               }
-            }
+         // split the step where the point turns
+         double ts = refine_station( &f, a, b );
+         if ( isnan( ts ) || probe( &f, ts, &st ) < 0 ) { return -1; }
+         found( ( Motion ) { a.t, a.lon, a.speed }, ( Motion ) { st.t, st.lon, st.speed }, data );
+         found( ( Motion ) { st.t, st.lon, st.speed }, ( Motion ) { b.t, b.lon, b.speed }, data );
+         }
+      else
+         {
+         found( ( Motion ) { a.t, a.lon, a.speed }, ( Motion ) { b.t, b.lon, b.speed }, data );
          }
+      a = b;
       }
-   list[ac++] = ( Aspect ) { 0, NAN, 0, 0, {}, NAN };
-   list = realloc( list, sizeof( Aspect ) * ac );
-   return list;
+   return 0;
    }
 
-/** dump_aspect() deallocates a naked array of aspects.
- * @param Pointer to an array of Aspects.
- */
+/** struct Crossings is the state of find_crossings() */
+typedef struct Crossings
+   {
+   int code;
+   double* targets;
+   int n;
+   CrossingFound* found;
+   void* data;
+   int count;
+   }
+Crossings;
+
+intern
 void
-dump_aspects( Aspect* ptr )
+crossings_of_piece( Motion a, Motion b, void* data )
    {
-   free( ptr );
+   Crossings* x = data;
+   Sample p = { a.t, NAN, a.speed, a.lon };
+   Sample q = { b.t, NAN, b.speed, b.lon };
+   x->count += crossings_in( x->code, p, q, x->targets, x->n, x->found, x->data );
+   }
+
+/** find_crossings() finds every time a point is exactly at any of many
+ * longitudes within a span of time. The point is scanned once for all
+ * of them, and each crossing is refined on the ephemeris.
+ * @param code Code of a point (sweph format).
+ * @param from, to Span of time, in JDN format.
+ * @param targets Array of @p n longitudes.
+ * @param found Called for each crossing, with its moment and the index
+ *        of the target, in no particular order.
+ * @param data Passed on to @p found.
+ *
+ * @return how many crossings were found, or -1 on an ephemeris error.
+ */
+extern
+int
+find_crossings( int code, double from, double to, double* targets, int n,
+                CrossingFound* found, void* data )
+   {
+   Crossings x = { code, targets, n, found, data, 0 };
+   if ( scan_motion( code, from, to, INFINITY, crossings_of_piece, &x ) < 0 ) { return -1; }
+   return x.count;
    }
 
-/** nearest_return() 
+/** nearest_return() finds when a point of a chart is back where it was.
  * @param c Pointer to a Chart.
- * @param i Index of the point we want (in Chart.points[i] ).
- * @param date A reference date to search. If NAN use now().
+ * @param code Code of the point (sweph format), that must be in the chart.
+ * @param ref_time A reference date to search from. If NAN use now().
  *
- * @return A moment in JDN format.
+ * @return The closest moment in JDN format, or NAN if not found.
  */
 double
 nearest_return( Chart* c, int code, double ref_time )
    {
-   // swiss ephemeris stuff
-   long stat, opts= SEFLG_SPEED;
-   double ret[6] = {};
-   char err[AS_MAXCH];
-   // precision limit of thousandth of arcsecond
-   const double epsilon = 1.0 / 3600000.0;
-   // calculating zlon of sun now
-   double orig_zlon = c->points[code].lon;
-   double next_zlon = 10000.0;
-   double next = ref_time;
-   if (isnan(ref_time)) { next = jdn_of_now(); }
-   while ( fabs( orig_zlon - next_zlon ) > epsilon )
-      {
-      stat = swe_calc_ut( next, code, opts, ret, err );
-      if (stat<0) {puts("swiss ephemeris error"); return NAN; }
-      next_zlon = ret[0];
-      next = ( orig_zlon - next_zlon ) / ret[3] + next;
-      printf("target: %f calc: %f\n", orig_zlon, next_zlon );
-      }
-   return next;
-   }
-
-/** nearest_ingress() 
- * @param int code Code of a point (sweph format).
- * @param double zlon Where exactly is it ingressing into.
- * @param date A reference date to search. If 0 uses now().
+   for_point_i( c )
+      {
+      if ( c->points[i].code == code )
+         {
+         return nearest_ingress( code, c->points[i].lon, ref_time );
+         }
+      }
+   return NAN;
+   }
+
+/** nearest_ingress() finds when a point is at a given longitude.
+ * @param code Code of a point (sweph format).
+ * @param zlon Where exactly is it ingressing into.
+ * @param ref_time A reference date to search from. If NAN use now().
  *
- * @return A moment in JDN format.
+ * @return The closest moment in JDN format, or NAN if not found.
  */
 double
 nearest_ingress( int code, double zlon, double ref_time )
    {
-   // this should FAIL...
-   return NAN;
+   Finder f = { code, swe_degnorm( zlon ), 0 };
+   if ( isnan( ref_time ) ) { ref_time = jdn_of_now(); }
+   return nearest_event( &f, ref_time );
+   }
+
+/** nearest_station() finds when a point stops, to turn retrograde or
+ * direct, which can be told by the sign of its speed right after.
+ * @param code Code of a point (sweph format).
+ * @param ref_time A reference date to search from. If NAN use now().
+ *
+ * @return The closest moment in JDN format, or NAN if not found (the
+ *         Sun, Moon and mean node and apogee never turn).
+ */
+double
+nearest_station( int code, double ref_time )
+   {
+   Finder f = { code, NAN, 0 };
+   if ( never_turns( code ) ) { return NAN; }
+   if ( isnan( ref_time ) ) { ref_time = jdn_of_now(); }
+   return nearest_event( &f, ref_time );
    }
 
 
@@ -429,6 +1716,28 @@ nearest_ingress( int code, double zlon, double ref_time )
       AVOID( mbtowc(NULL,each->symbol,10) < 1 ); \
       }
 
+#define THREAD_COUNT 4
+#define THREAD_CHARTS 25
+static double thread_jdns[THREAD_CHARTS];
+static double thread_lons[THREAD_CHARTS];
+
+/* each worker recalculates all reference charts and counts mismatches */
+intern
+gpointer
+chart_worker( gpointer data )
+   {
+   long mismatches = 0;
+   init_ephemeris_thread();
+   for( int i = 0; i < THREAD_CHARTS; i++ )
+      {
+      Chart* c = make_chart( "thread", thread_jdns[i], -23.0, -43.0 );
+      if( c->points[1].lon != thread_lons[i] ) { mismatches++; }
+      dump_chart( c );
+      }
+   end_ephemeris_thread();
+   return (gpointer) mismatches;
+   }
+
 //---> TODO: Verify with some known data
 //---> TODO: give weird list of points and check pt_count
 //---> TODO: give weird list of house systems and check cp_count
@@ -470,8 +1779,7 @@ BEGIN_TESTS
          tc = make_chart( "test_alloc", 2457555.0, 120.0, 20.0 );
          SANITY_TEST_CHART( tc );
          PROBE( tc );
-         ENSURE( NULL == dyn_pts );
-         ENSURE( NULL == dyn_systems );
+         ENSURE( NULL == dyn_config );
          dump_chart( tc );
          end_swiss_ephemeris();
          //
@@ -479,8 +1787,9 @@ BEGIN_TESTS
          tc = make_chart( "test_alloc", 2457555.0, 60.0, 70.0 );
          SANITY_TEST_CHART( tc );
          PROBE( tc );
-         PROBE( the_pts );
-         ENSURE( NULL == dyn_systems );
+         PROBE( the_config );
+         ENSURE( 4 == the_config->pt_count );
+         ENSURE( 0 == strcmp( def_systems, the_config->systems ) );
          dump_chart( tc );
          end_swiss_ephemeris();
          //
@@ -488,12 +1797,38 @@ BEGIN_TESTS
          tc = make_chart( "test_alloc", 2457555.0, 60.0, 70.0 );
          SANITY_TEST_CHART( tc );
          PROBE( tc );
-         ENSURE( NULL == dyn_pts );
-         PROBE( the_systems );
+         PROBE( the_config );
+         ENSURE( 9 == the_config->pt_count );
+         ENSURE( 2 == the_config->sys_count );
          dump_chart( tc );
          end_swiss_ephemeris();
          );
       );
+   TRIAL("many ChartConfigs side by side",
+      BOUND(
+         ChartConfig* gui = make_chart_config( "UPROC", NULL );
+         ChartConfig* big = make_chart_config( "P", (int[]) {0,1,2,17,18,19,20,SE_END} );
+         PROBE( gui );
+         PROBE( big );
+         ENSURE( 5 == gui->sys_count );
+         ENSURE( 12 == gui->cp_count );
+         ENSURE( 9 == gui->pt_count );
+         ENSURE( 7 == big->pt_count );
+         ENSURE( SE_END == big->pts[big->pt_count] );
+         Chart* c1 = make_chart_with( gui, "gui", 2457555.0, 60.0, 70.0 );
+         Chart* c2 = make_chart_with( big, "big", 2457555.0, 60.0, 70.0 );
+         SANITY_TEST_CHART( c1 );
+         SANITY_TEST_CHART( c2 );
+         ENSURE( c1->pt_count == 9 && c1->sys_count == 5 );
+         ENSURE( c2->pt_count == 7 && c2->sys_count == 1 );
+         ENSURE( c1->points[0].lon == c2->points[0].lon );
+         ENSURE( c2->points[3].code == 17 );
+         dump_chart( c1 );
+         dump_chart( c2 );
+         dump_chart_config( gui );
+         dump_chart_config( big );
+         );
+      );
    TRIAL("Koch and Placidus at weid coords",
       init_swiss_ephemeris( "TPK", NULL );
       tc = make_chart( "test_alloc", 2457555.0, 120.0, 20.0 );
@@ -555,23 +1890,60 @@ BEGIN_TESTS
          {
          AVOID( each->lon < 0.0 || each->lon > 360.0 );
          }
-      for(int n=1; n<12; n++)
+      for(int n=1; n<=12; n++)
          {
          AVOID(tc->housealt(n,0) != tc->house(n).cusp);
          AVOID(tc->housealt(n,0) != tc->points[-n].data[0]);
          AVOID(tc->housealt(n,1) != tc->points[-n].data[1]);
          AVOID(tc->housealt(n,2) != tc->points[-n].data[2]);
-         AVOID(tc->housealt(n,3) != tc->points[-12-n].data[0]);
-         AVOID(tc->housealt(n,4) != tc->points[-12-n].data[1]);
-         AVOID(tc->housealt(n,5) != tc->points[-12-n].data[2]);
-         AVOID(tc->housealt(n,6) != tc->points[-12-n].data[3]);
+         AVOID(tc->housealt(n,3) != tc->sys_cusps[12*3+n-1]);
          }
+      AVOID( strcmp( tc->sys_codes, "TURC" ) );
+      AVOID( tc->syscode(0) != tc->house(1).symbol[0] );
       //for(int i = 0; i<6; i++)
          //{
          //printf("\n%f\t%f\t%f", tc->housealt(2,i), tc->housealt(3,i), tc->housealt(4,i));
          //}
       dump_chart( tc );
       );
+   TRIAL("every house system from one ARMC equals swe_houses()",
+      char* all = "ABCDEFHIiKLMNOPQRSTUVWXY";
+      ChartConfig* cf = make_chart_config( all, NULL );
+      int n = strlen( all );
+      double cusps[12 * n];
+      char tags[n];
+      double ascmc[10];
+      double ret[13];
+      double ref[10];
+      for( int k = 0; k < 20; k++ )
+         {
+         jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+         lat = g_test_rand_double_range( -60.0, 60.0 );
+         lon = g_test_rand_double_range( -180.0, 180.0 );
+         calc_houses( cf, jdn, lat, lon, cusps, tags, ascmc );
+         for( int s = 0; s < n; s++ )
+            {
+            int stat = swe_houses( jdn, lat, lon, all[s], ret, ref );
+            AVOID( ( stat < 0 ) != ( tags[s] == '?' ) );
+            if( tags[s] == '?' )
+               {
+               for( int h = 1; h <= 12; h++ ) { AVOID( !isnan( cusps[12*s + h-1] ) ); }
+               continue;
+               }
+            for( int h = 1; h <= 12; h++ )
+               {
+               AVOID( fabs( swe_difdeg2n( cusps[12*s + h-1], ret[h] ) ) > 1e-9 );
+               }
+            }
+         AVOID( fabs( swe_difdeg2n( ascmc[0], ref[0] ) ) > 1e-9 );
+         }
+      Chart* c1 = make_chart_with( cf, "all systems", jdn, lat, lon );
+      ENSURE( c1->sys_count == n );
+      ENSURE( c1->cp_count == 12 );
+      ENSURE( c1->housealt( 12, n-1 ) == cusps[12*(n-1) + 11] );
+      dump_chart( c1 );
+      dump_chart_config( cf );
+      );
    TRIAL("make many charts at the same time",
       BOUND(
          Chart* ca[10];
@@ -586,6 +1958,24 @@ BEGIN_TESTS
          for (int i=0;i<10;i++) { dump_chart( ca[i] ); }
          );
       );
+   TRIAL("make charts from many threads at once",
+      for( int i = 0; i < THREAD_CHARTS; i++ )
+         {
+         thread_jdns[i] = g_test_rand_double_range( 2435000.0, 2460000.0 );
+         tc = make_chart( "reference", thread_jdns[i], -23.0, -43.0 );
+         thread_lons[i] = tc->points[1].lon;
+         dump_chart( tc );
+         }
+      GThread* th[THREAD_COUNT];
+      for( int t = 0; t < THREAD_COUNT; t++ )
+         {
+         th[t] = g_thread_new( "chart_worker", chart_worker, NULL );
+         }
+      for( int t = 0; t < THREAD_COUNT; t++ )
+         {
+         AVOID( 0 != (long) g_thread_join( th[t] ) );
+         }
+      );
 /*
 /ulb/swetest -b30.9.1997 -n1 -s1 -fpPlbRs -pd -eswe -utc14.11:45 -geopos47.3412,8.5772 
 date (dmy) 30.9.1997 greg.   14:00:00.379 UT    version 2.09.03
@@ -608,6 +1998,276 @@ Nutation          -0° 0' 3.9503   -0° 0' 8.4741
 11 true Node       169.7795649   0.0000000    0.002715947  -0.0070778
 12 mean Apogee     171.6641150   0.2739842    0.002710625   0.1107051
 */
+   TRIAL("to_aspects() kinds equal to_aspect()",
+      enum { PAIRS = 4099 };
+      static double a1[PAIRS];
+      static double a2[PAIRS];
+      static int kinds[PAIRS];
+      static float scores[PAIRS];
+      for( int i = 0; i < PAIRS; i++ )
+         {
+         a1[i] = g_test_rand_double_range( 0.0, 360.0 );
+         a2[i] = g_test_rand_double_range( 0.0, 360.0 );
+         // exact harmonic aspects are where rounding could bite
+         if( i%3 == 0 ) { a2[i] = fmod( a1[i] + 15.0 * (i%24), 360.0 ); }
+         }
+      to_aspects( a1, a2, PAIRS, kinds, scores );
+      for( int i = 0; i < PAIRS; i++ )
+         {
+         Aspect a = to_aspect( a1[i], a2[i] );
+         AVOID( a.kind != kinds[i] );
+         AVOID( fabs( a.score - scores[i] ) > ASPECT_TOLERANCE );
+         }
+      );
+   TRIAL("make_aspects_by_sweep() equals testing every pair",
+      enum { MANY = 600 };
+      static Point many[MANY];
+      Chart fake = { 0 };
+      fake.points = many;
+      for( int i = 0; i < MANY; i++ )
+         {
+         many[i].lon = g_test_rand_double_range( 0.0, 360.0 );
+         // points right on the orb border, and bunched at 0 Aries
+         if( i%5 == 0 ) { many[i].lon = fmod( many[i-1+(i==0)].lon + 60.0 + 3.0, 360.0 ); }
+         if( i%7 == 0 ) { many[i].lon = g_test_rand_double_range( 359.9, 360.0 ); }
+         }
+      for( int n = 2; n <= MANY; n *= 3 )
+         {
+         fake.pt_count = n;
+         Aspect* slow = brute_aspects( &fake );
+         Aspect* fast = make_aspects_by_sweep( &fake );
+         int k = 0;
+         for( ; slow[k].kind != 0; k++ )
+            {
+            AVOID( fast[k].kind != slow[k].kind );
+            AVOID( fast[k].point1 != slow[k].point1 );
+            AVOID( fast[k].point2 != slow[k].point2 );
+            AVOID( fast[k].score != slow[k].score );
+            AVOID( fast[k].diff != slow[k].diff );
+            }
+         ENSURE( fast[k].kind == 0 );
+         free( slow );
+         free( fast );
+         }
+      );
+   TRIAL("make_cross_aspects() equals testing every pair",
+      Chart* c1 = make_chart( "inner", 2450722.0833, 47.34, 8.57 );
+      Chart* c2 = make_chart( "outer", 2460000.5, -23.0, -43.0 );
+      Aspect* xs = make_cross_aspects( c1, c2 );
+      Aspect one;
+      int k = 0;
+      for_point_i( c1 )
+         {
+         for( int j = 0; j < c2->pt_count; j++ )
+            {
+            for( int m = 0; aspect_defs[m].kind != 0; m++ )
+               {
+               if( !aspect_of_pair( c1->points[i].lon, c2->points[j].lon, m, &one ) )
+                  { continue; }
+               AVOID( xs[k].point1 != i );
+               AVOID( xs[k].point2 != j );
+               AVOID( xs[k].kind != one.kind );
+               AVOID( xs[k].score != one.score );
+               k++;
+               }
+            }
+         }
+      ENSURE( xs[k].kind == 0 );
+      free( xs );
+      // a chart against itself: every point conjunct itself
+      xs = make_cross_aspects( c1, c1 );
+      k = 0;
+      for( Aspect* each = xs; each->kind; each++ )
+         {
+         if( each->point1 == each->point2 ) { k++; }
+         }
+      ENSURE( k == c1->pt_count );
+      free( xs );
+      dump_chart( c1 );
+      dump_chart( c2 );
+      );
+   TRIAL("charts from a Series are as accurate as asked",
+      int* pts = def_pts;
+      char* path = g_build_filename( g_get_tmp_dir(), "arf-astro.series", NULL );
+      double from = 2455000.0;
+      ENSURE( 9 == make_series_file( path, pts, from, from + 100.0, 12, 1e-7 ) );
+      Series* s = load_series( path );
+      ChartConfig* cf = make_chart_config( "PTK", pts );
+      ChartConfig* plain = make_chart_config( "PTK", pts );
+      set_chart_series( cf, s, 1e-6 );
+      for( int k = 0; k < 50; k++ )
+         {
+         jdn = g_test_rand_double_range( from, from + 100.0 );
+         Chart* c1 = make_chart_with( cf, "series", jdn, 10.0, 20.0 );
+         tc = make_chart_with( plain, "ephemeris", jdn, 10.0, 20.0 );
+         for_point_i( c1 )
+            {
+            AVOID( fabs( swe_difdeg2n( c1->points[i].lon, tc->points[i].lon ) ) > 2e-6 );
+            AVOID( fabs( c1->points[i].lat - tc->points[i].lat ) > 2e-6 );
+            }
+         AVOID( c1->house(1).lon != tc->house(1).lon );
+         dump_chart( c1 );
+         dump_chart( tc );
+         }
+      dump_chart_config( cf );
+      dump_chart_config( plain );
+      dump_series( s );
+      remove( path );
+      g_free( path );
+      );
+   TRIAL("charts of one moment share the point cache",
+      jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      clear_point_cache();
+      Chart* c1 = make_chart( "here", jdn, 10.0, 20.0 );
+      // besides its points, a chart also looks up the true node and nutation
+      PointCacheStats st = get_point_cache_stats();
+      int lookups = st.hits + st.misses;
+      ENSURE( st.misses > c1->pt_count );
+      tc = make_chart( "there", jdn, -33.0, 151.0 );
+      PointCacheStats st2 = get_point_cache_stats();
+      ENSURE( st2.hits - st.hits == lookups );
+      ENSURE( st2.misses == st.misses );
+      for_point_i( c1 )
+         {
+         AVOID( memcmp( c1->points[i].data, tc->points[i].data, sizeof( c1->points[i].data ) ) );
+         }
+      dump_chart( c1 );
+      dump_chart( tc );
+      c1 = make_chart( "later", jdn + 1.0, 10.0, 20.0 );
+      ENSURE( get_point_cache_stats().misses == st.misses + lookups );
+      dump_chart( c1 );
+      );
+   TRIAL("nearest_ingress() finds the March equinox of 2020",
+      double t = nearest_ingress( SE_SUN, 0.0, 2458900.0 );
+      ENSURE( fabs( t - 2458928.6595 ) < 0.01 ); // 2020-03-20 03:50 UT
+      );
+   TRIAL("returns, ingresses and stations land on the ephemeris",
+      double ret[6];
+      char err[AS_MAXCH];
+      for( int k = 0; k < 20; k++ )
+         {
+         jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+         double zlon = g_test_rand_double_range( 0.0, 360.0 );
+         for( int code = SE_SUN; code <= SE_PLUTO; code++ )
+            {
+            double t = nearest_ingress( code, zlon, jdn );
+            ENSURE( !isnan( t ) );
+            swe_calc_ut( t, code, SEFLG_SPEED, ret, err );
+            AVOID( fabs( swe_difdeg2n( ret[0], zlon ) ) > 1e-6 );
+            if( code == SE_SUN || code == SE_MOON )
+               {
+               AVOID( !isnan( nearest_station( code, jdn ) ) );
+               continue;
+               }
+            t = nearest_station( code, jdn );
+            ENSURE( !isnan( t ) );
+            swe_calc_ut( t, code, SEFLG_SPEED, ret, err );
+            AVOID( fabs( ret[3] ) > 1e-6 );
+            }
+         }
+      tc = make_chart( "return", jdn, 10.0, 20.0 );
+      double t = nearest_return( tc, SE_MOON, jdn + 10.0 );
+      // the natal moment is closer to jdn+10 than the next return is
+      AVOID( fabs( t - jdn ) > 1e-3 );
+      t = nearest_return( tc, SE_SUN, jdn + 200.0 );
+      AVOID( fabs( t - jdn - 365.25 ) > 1.0 );
+      ENSURE( isnan( nearest_return( tc, SE_CERES, jdn ) ) );
+      dump_chart( tc );
+      );
+   TRIAL("ingress right at a station of Mercury",
+      double ret[6];
+      char err[AS_MAXCH];
+      double st = nearest_station( SE_MERCURY, 2459000.0 );
+      swe_calc_ut( st - 1.0, SE_MERCURY, SEFLG_SPEED, ret, err );
+      int was_direct = ret[3] > 0.0;
+      swe_calc_ut( st, SE_MERCURY, SEFLG_SPEED, ret, err );
+      // just short of the turning point, it is crossed on both sides
+      double zlon = was_direct ? ret[0] - 0.01 : ret[0] + 0.01;
+      double before = nearest_ingress( SE_MERCURY, zlon, st - 0.5 );
+      double after = nearest_ingress( SE_MERCURY, zlon, st + 0.5 );
+      ENSURE( before < st );
+      ENSURE( after > st );
+      ENSURE( after - before < 10.0 );
+      );
+   TRIAL("charts in an arena equal charts from make_chart",
+      BOUND(
+         ChartArena* ar = make_chart_arena( 4096 );
+         Chart* in[50];
+         for( int i = 0; i < 50; i++ )
+            {
+            jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+            in[i] = make_chart_in( ar, get_chart_config(), "arena", jdn, 10.0, 20.0 );
+            SANITY_TEST_CHART( in[i] );
+            tc = make_chart( "heap", jdn, 10.0, 20.0 );
+            AVOID( strcmp( in[i]->ev->name, "arena" ) );
+            AVOID( in[i]->asp_count != tc->asp_count );
+            AVOID( memcmp( in[i]->cusps, tc->cusps,
+                  sizeof(Point) * (tc->pt_count + tc->cp_count) ) );
+            for( int k = 0; k < tc->asp_count; k++ )
+               {
+               AVOID( in[i]->aspects[k].kind != tc->aspects[k].kind );
+               AVOID( in[i]->aspects[k].point1 != tc->aspects[k].point1 );
+               AVOID( in[i]->aspects[k].point2 != tc->aspects[k].point2 );
+               AVOID( in[i]->aspects[k].score != tc->aspects[k].score );
+               }
+            dump_chart( tc );
+            }
+         // older charts must survive new blocks
+         AVOID( strcmp( in[0]->ev->name, "arena" ) );
+         ENSURE( 50 == ar->chart_count );
+         clear_chart_arena( ar );
+         ENSURE( 0 == ar->chart_count );
+         ENSURE( NULL == ar->block->prev );
+         in[0] = make_chart_in( ar, get_chart_config(), "again", jdn, 10.0, 20.0 );
+         SANITY_TEST_CHART( in[0] );
+         dump_chart_arena( ar );
+         );
+      );
+   TRIAL("make_chart_of_numbers() rebuilds a chart from its numbers",
+      BOUND(
+         jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+         tc = make_chart( "numbers", jdn, 10.0, 20.0 );
+         ChartConfig* cf = get_chart_config();
+         double pts[4 * tc->pt_count];
+         double defs[12];
+         for( int i = 0; i < tc->pt_count; i++ )
+            {
+            memcpy( pts + 4*i, tc->points[i].data, sizeof( double ) * 4 );
+            }
+         for( int i = 1; i <= 12; i++ ) { defs[i-1] = tc->house( i ).def; }
+         Chart* re = make_chart_of_numbers( cf, tc->ev, pts, tc->sys_cusps, tc->sys_codes, defs );
+         SANITY_TEST_CHART( re );
+         AVOID( strcmp( re->ev->name, "numbers" ) );
+         AVOID( memcmp( re->cusps, tc->cusps,
+               sizeof(Point) * (tc->pt_count + tc->cp_count) ) );
+         AVOID( memcmp( re->sys_cusps, tc->sys_cusps, sizeof( double ) * 12 * tc->sys_count ) );
+         AVOID( strcmp( re->sys_codes, tc->sys_codes ) );
+         ENSURE( re->asp_count == tc->asp_count );
+         dump_chart( re );
+         dump_chart( tc );
+         );
+      );
+   TRIAL("house_of() agrees with the cusps",
+      for( int i = 0; i < 20; i++ )
+         {
+         jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+         tc = make_chart( "houses", jdn, -23.0, -43.0 );
+         for( int s = 0; s < tc->sys_count; s++ )
+            {
+            for( int h = 1; h <= 12; h++ )
+               {
+               double from = tc->housealt( h, s );
+               double mid = from + 0.5 * fmod( tc->housealt( h % 12 + 1, s ) - from + 360.0, 360.0 );
+               AVOID( house_of( &tc->housealt( 1, s ), fmod( mid, 360.0 ) ) != h );
+               AVOID( house_of( &tc->housealt( 1, s ), from ) != h );
+               }
+            }
+         dump_chart( tc );
+         }
+      double nans[12];
+      for( int h = 0; h < 12; h++ ) { nans[h] = NAN; }
+      ENSURE( 0 == house_of( nans, 100.0 ) );
+      );
    TRIAL("Sweph birth chart = astro.com/swetest",
       tc = make_chart( "sweph", 2450722.083337721, 47.341200, 8.5772 );
 //0 Sun
@@ -0,0 +1,210 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file batch.c
+ *    keeps many charts as columns of numbers.
+ *
+ * A Chart is good for looking at one event, but research over a
+ * dataset usually wants the same number out of every chart, like "the
+ * Sun longitude". A ChartBatch keeps each of those numbers in its own
+ * contiguous column, so a scan only touches the data it needs and can
+ * be vectorized by the compiler.
+ **/
+
+#include "arfc.h"
+
+/** make_chart_batch() allocates an empty batch with room for charts.
+ * @param cf Pointer to a ChartConfig, must outlive the batch.
+ * @param size How many charts the batch can hold.
+ *
+ * @return pointer to a ChartBatch, that must be dumped.
+ */
+extern
+ChartBatch*
+make_chart_batch( ChartConfig* cf, int size )
+   {
+   ChartBatch* b;
+   b = malloc( sizeof( ChartBatch ) );
+   b->cf = cf;
+   b->count = 0;
+   b->size = size;
+   // one block: event columns, then points, then cusps
+   size_t cols = 3 + 4 * cf->pt_count + 12 * cf->sys_count;
+   b->jdn = calloc( sizeof( double ), cols * size );
+   enforce( "allocate chart batch", b->jdn );
+   b->lat = b->jdn + size;
+   b->lon = b->lat + size;
+   b->pts = b->lon + size;
+   b->cusps = b->pts + 4 * cf->pt_count * size;
+   return b;
+   }
+
+/** dump_chart_batch() deallocates a ChartBatch.
+ * @param b Pointer to a ChartBatch.
+ */
+extern
+void
+dump_chart_batch( ChartBatch* b )
+   {
+   free( b->jdn ); // also frees all other columns
+   free( b );
+   }
+
+/** batch_column() finds the column of a point by its code.
+ * @param b Pointer to a ChartBatch.
+ * @param code Swiss Ephemeris code of the point.
+ * @param field Index as in Point.data[]: 0 lon, 1 lat, 2 dist, 3 speed.
+ *
+ * @return pointer to b->count doubles, or NULL if there is no such
+ *         point in the batch.
+ */
+extern
+double*
+batch_column( ChartBatch* b, int code, int field )
+   {
+   for ( int i = 0; i < b->cf->pt_count; i++ )
+      {
+      if ( b->cf->pts[i] == code ) { return batch_col( b, i, field ); }
+      }
+   return NULL;
+   }
+
+/** fill_chart_batch() calculates a chart for each event, straight into
+ * the columns of a batch. Anything already in the batch is replaced.
+ * Points the ephemeris cannot calculate are NAN.
+ * @param b Pointer to a ChartBatch.
+ * @param evs Array of Events.
+ * @param n Number of events, only up to b->size are used.
+ *
+ * @return number of charts in the batch.
+ */
+extern
+int
+fill_chart_batch( ChartBatch* b, Event* evs, int n )
+   {
+   ChartConfig* cf = b->cf;
+   double ret[6];
+   double cusps[12 * cf->sys_count];
+   char tags[cf->sys_count];
+   double ascmc[10];
+   b->count = MIN( n, b->size );
+   for ( int k = 0; k < b->count; k++ )
+      {
+      b->jdn[k] = evs[k].jdn;
+      b->lat[k] = evs[k].lat;
+      b->lon[k] = evs[k].lon;
+      for ( int i = 0; i < cf->pt_count; i++ )
+         {
+         if ( calc_point( cf, evs[k].jdn, cf->pts[i], ret ) < 0 )
+            {
+            ret[0] = ret[1] = ret[2] = ret[3] = NAN;
+            }
+         for ( int f = 0; f < 4; f++ ) { batch_col( b, i, f )[k] = ret[f]; }
+         }
+      calc_houses( cf, evs[k].jdn, evs[k].lat, evs[k].lon, cusps, tags, ascmc );
+      for ( int s = 0; s < cf->sys_count; s++ )
+         {
+         for ( int h = 1; h <= 12; h++ )
+            {
+            batch_house( b, s, h )[k] = cusps[12*s + h-1]; // NAN if it failed
+            }
+         }
+      }
+   return b->count;
+   }
+
+/** add_chart_to_batch() copies the numbers of a Chart into a batch.
+ * The chart must have been made with the same config as the batch.
+ * @param b Pointer to a ChartBatch.
+ * @param c Pointer to a Chart.
+ *
+ * @return index of the chart in the batch, or -1 if it is full.
+ */
+extern
+int
+add_chart_to_batch( ChartBatch* b, Chart* c )
+   {
+   if ( b->count >= b->size ) { return -1; }
+   int k = b->count++;
+   b->jdn[k] = c->ev->jdn;
+   b->lat[k] = c->ev->lat;
+   b->lon[k] = c->ev->lon;
+   for ( int i = 0; i < c->pt_count; i++ )
+      {
+      for ( int f = 0; f < 4; f++ ) { batch_col( b, i, f )[k] = c->points[i].data[f]; }
+      }
+   for ( int s = 0; s < c->sys_count; s++ )
+      {
+      for ( int h = 1; h <= 12; h++ ) { batch_house( b, s, h )[k] = c->housealt( h, s ); }
+      }
+   return k;
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+#define EVCOUNT 20
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( "PKRCEO", NULL );
+   ChartConfig* cf = get_chart_config();
+   Event evs[EVCOUNT];
+   for ( int i = 0; i < EVCOUNT; i++ )
+      {
+      evs[i].jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      evs[i].lat = g_test_rand_double_range( -60.0, 60.0 );
+      evs[i].lon = g_test_rand_double_range( -180.0, 180.0 );
+      evs[i].name = "batch";
+      }
+   //
+   TRIAL( "no leaks on make_chart_batch()",
+      BOUND(
+         ChartBatch* b = make_chart_batch( cf, EVCOUNT );
+         PROBE( b );
+         PROBE( b->jdn );
+         ENSURE( EVCOUNT == fill_chart_batch( b, evs, EVCOUNT ) );
+         dump_chart_batch( b );
+         );
+      );
+   TRIAL( "fill_chart_batch() columns equal make_chart_with()",
+      ChartBatch* b = make_chart_batch( cf, EVCOUNT );
+      fill_chart_batch( b, evs, EVCOUNT );
+      for ( int k = 0; k < EVCOUNT; k++ )
+         {
+         Chart* c = make_chart_with( cf, evs[k].name, evs[k].jdn, evs[k].lat, evs[k].lon );
+         AVOID( b->jdn[k] != c->ev->jdn );
+         for ( int i = 0; i < c->pt_count; i++ )
+            {
+            AVOID( batch_col( b, i, 0 )[k] != c->points[i].lon );
+            AVOID( batch_col( b, i, 3 )[k] != c->points[i].speed );
+            }
+         for ( int s = 0; s < c->sys_count; s++ )
+            {
+            for ( int h = 1; h <= 12; h++ )
+               {
+               AVOID( batch_house( b, s, h )[k] != c->housealt( h, s ) );
+               }
+            }
+         dump_chart( c );
+         }
+      ENSURE( batch_column( b, SE_MOON, 0 ) == batch_col( b, 1, 0 ) );
+      ENSURE( batch_column( b, SE_CERES, 0 ) == NULL );
+      dump_chart_batch( b );
+      );
+   TRIAL( "add_chart_to_batch() stops when full",
+      ChartBatch* b = make_chart_batch( cf, 2 );
+      Chart* c = make_chart_with( cf, "added", evs[0].jdn, evs[0].lat, evs[0].lon );
+      ENSURE( 0 == add_chart_to_batch( b, c ) );
+      ENSURE( 1 == add_chart_to_batch( b, c ) );
+      ENSURE( -1 == add_chart_to_batch( b, c ) );
+      ENSURE( b->count == 2 );
+      ENSURE( batch_column( b, SE_SUN, 0 )[1] == c->points[0].lon );
+      ENSURE( batch_house( b, 5, 12 )[0] == c->housealt( 12, 5 ) );
+      dump_chart( c );
+      dump_chart_batch( b );
+      );
+   end_swiss_ephemeris();
+END_TESTS
+#endif //TEST
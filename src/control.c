@@ -0,0 +1,406 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file control.c
+ *    makes control groups of a dataset, and tests a dataset against them.
+ *
+ * A control of a list of events is the same list with the times of day
+ * shuffled among the events, or the places shuffled, or the dates drawn
+ * evenly over the range of the list: whatever is astrological about the
+ * real dataset should not be there in its controls. make_control_stats()
+ * makes many controls and counts each into its own ChartStats, so that
+ * control_p_value() can tell how often chance alone does as well as the
+ * real dataset.
+ *
+ * Each control has its own random stream, seeded by the seed and the
+ * number of the control, so the controls are the same for a given seed
+ * whatever the number of threads that make them. Controls with shuffled
+ * places keep the points of the real events, and only make the houses.
+ **/
+
+#include "arfc.h"
+
+#define CONTROL_BATCH 256 // charts per ChartBatch in a control
+
+/** make_control_events() makes a control of a list of events.
+ * @param evs Array of Events.
+ * @param n Number of events.
+ * @param kind CONTROL_TIMES, CONTROL_PLACES or CONTROL_DATES.
+ * @param r GRand to shuffle or draw with.
+ * @param out Array of @p n Events, that gets the control. The names are
+ *        those of @p evs, not copies.
+ */
+extern
+void
+make_control_events( Event* evs, int n, int kind, GRand* r, Event* out )
+   {
+   double from = INFINITY;
+   double to = -INFINITY;
+   memcpy( out, evs, sizeof( Event ) * n );
+   switch ( kind )
+      {
+      case CONTROL_TIMES:
+         // shuffle the fractions of day, then put back the days
+         for ( int k = 0; k < n; k++ )
+            {
+            out[k].jdn = evs[k].jdn + 0.5 - floor( evs[k].jdn + 0.5 );
+            }
+         for ( int k = n - 1; k > 0; k-- )
+            {
+            int j = g_rand_int_range( r, 0, k + 1 );
+            double day = out[k].jdn;
+            out[k].jdn = out[j].jdn;
+            out[j].jdn = day;
+            }
+         for ( int k = 0; k < n; k++ )
+            {
+            out[k].jdn += floor( evs[k].jdn + 0.5 ) - 0.5;
+            }
+         break;
+      case CONTROL_PLACES:
+         for ( int k = n - 1; k > 0; k-- )
+            {
+            int j = g_rand_int_range( r, 0, k + 1 );
+            double lat = out[k].lat;
+            double lon = out[k].lon;
+            out[k].lat = out[j].lat;
+            out[k].lon = out[j].lon;
+            out[j].lat = lat;
+            out[j].lon = lon;
+            }
+         break;
+      case CONTROL_DATES:
+         for ( int k = 0; k < n; k++ )
+            {
+            from = MIN( from, evs[k].jdn );
+            to = MAX( to, evs[k].jdn );
+            }
+         for ( int k = 0; k < n; k++ )
+            {
+            out[k].jdn = from < to ? g_rand_double_range( r, from, to ) : from;
+            }
+         break;
+      }
+   }
+
+/** struct ControlWork is what the threads of make_control_stats() share */
+typedef struct ControlWork
+   {
+   ChartConfig* cf;
+   Event* evs;
+   int n;
+   int kind;
+   int count; // controls to make
+   guint32 seed;
+   ChartBatch* real; // points of the real events, with CONTROL_PLACES
+   ChartStats** out;
+   gint next; // next control to make, taken by any thread
+   }
+ControlWork;
+
+/** fill_control_houses() fills a batch with the points of the real
+ * events, already made, and the houses of the control events.
+ */
+intern
+void
+fill_control_houses( ChartBatch* b, ChartBatch* real, int from, Event* evs, int n )
+   {
+   ChartConfig* cf = b->cf;
+   double cusps[12 * cf->sys_count];
+   char tags[cf->sys_count];
+   double ascmc[10];
+   b->count = MIN( n, b->size );
+   for ( int i = 0; i < cf->pt_count; i++ )
+      {
+      for ( int f = 0; f < 4; f++ )
+         {
+         memcpy( batch_col( b, i, f ), batch_col( real, i, f ) + from,
+                 sizeof( double ) * b->count );
+         }
+      }
+   for ( int k = 0; k < b->count; k++ )
+      {
+      b->jdn[k] = evs[k].jdn;
+      b->lat[k] = evs[k].lat;
+      b->lon[k] = evs[k].lon;
+      calc_houses( cf, evs[k].jdn, evs[k].lat, evs[k].lon, cusps, tags, ascmc );
+      for ( int s = 0; s < cf->sys_count; s++ )
+         {
+         for ( int h = 1; h <= 12; h++ )
+            {
+            batch_house( b, s, h )[k] = tags[s] == '?' ? NAN : cusps[12*s + h-1];
+            }
+         }
+      }
+   }
+
+/** make_controls() makes and counts controls, taking the next one to
+ * make until there are none left.
+ */
+intern
+void
+make_controls( ControlWork* w )
+   {
+   ChartBatch* b = make_chart_batch( w->cf, CONTROL_BATCH );
+   Event* evs = malloc( sizeof( Event ) * MAX( w->n, 1 ) );
+   int c;
+   while ( ( c = g_atomic_int_add( &w->next, 1 ) ) < w->count )
+      {
+      guint32 seeds[2] = { 0 };
+      seeds[0] = w->seed;
+      seeds[1] = c;
+      GRand* r = g_rand_new_with_seed_array( seeds, 2 );
+      make_control_events( w->evs, w->n, w->kind, r, evs );
+      g_rand_free( r );
+      ChartStats* st = make_chart_stats( w->cf );
+      for ( int k = 0; k < w->n; k += CONTROL_BATCH )
+         {
+         int m = MIN( CONTROL_BATCH, w->n - k );
+         if ( w->real ) { fill_control_houses( b, w->real, k, evs + k, m ); }
+         else { fill_chart_batch( b, evs + k, m ); }
+         add_batch_to_stats( st, b );
+         }
+      w->out[c] = st;
+      }
+   free( evs );
+   dump_chart_batch( b );
+   }
+
+intern
+gpointer
+control_worker( gpointer data )
+   {
+   init_ephemeris_thread();
+   make_controls( data );
+   end_ephemeris_thread();
+   return NULL;
+   }
+
+/** make_control_stats() makes many controls of a list of events, on
+ * many threads, and counts each into its own ChartStats.
+ * @param cf Pointer to the ChartConfig of the charts.
+ * @param evs Array of Events, the real dataset.
+ * @param n Number of events.
+ * @param kind CONTROL_TIMES, CONTROL_PLACES or CONTROL_DATES.
+ * @param count Number of controls.
+ * @param seed Seed of the random streams of the controls.
+ * @param threads Number of threads, counting the calling one.
+ *
+ * @return array of @p count ChartStats, to be dumped with
+ *         dump_control_stats().
+ */
+extern
+ChartStats**
+make_control_stats( ChartConfig* cf, Event* evs, int n, int kind, int count,
+                    guint32 seed, int threads )
+   {
+   ControlWork w = { 0 };
+   w.cf = cf;
+   w.evs = evs;
+   w.n = n;
+   w.kind = kind;
+   w.count = count;
+   w.seed = seed;
+   w.out = calloc( MAX( count, 1 ), sizeof( ChartStats* ) );
+   if ( kind == CONTROL_PLACES )
+      {
+      // the points stay where they were, only the houses change
+      w.real = make_chart_batch( cf, MAX( n, 1 ) );
+      fill_chart_batch( w.real, evs, n );
+      }
+   threads = MAX( 1, MIN( threads, count ) );
+   GThread* th[threads];
+   for ( int t = 1; t < threads; t++ )
+      {
+      th[t] = g_thread_new( "control_worker", control_worker, &w );
+      }
+   make_controls( &w );
+   for ( int t = 1; t < threads; t++ ) { g_thread_join( th[t] ); }
+   if ( w.real ) { dump_chart_batch( w.real ); }
+   return w.out;
+   }
+
+/** dump_control_stats() deallocates the stats of make_control_stats().
+ * @param controls Array of ChartStats.
+ * @param count Number of controls.
+ */
+extern
+void
+dump_control_stats( ChartStats** controls, int count )
+   {
+   for ( int c = 0; c < count; c++ ) { dump_chart_stats( controls[c] ); }
+   free( controls );
+   }
+
+/** merge_control_stats() adds up the stats of many controls, which is a
+ * baseline for test_chart_stats().
+ * @return pointer to a ChartStats, that must be dumped, or NULL if
+ *         there are no controls.
+ */
+extern
+ChartStats*
+merge_control_stats( ChartStats** controls, int count )
+   {
+   if ( count < 1 ) { return NULL; }
+   ChartStats* all = make_chart_stats( controls[0]->cf );
+   for ( int c = 0; c < count; c++ ) { merge_chart_stats( all, controls[c] ); }
+   return all;
+   }
+
+/** control_chi2() is the chi-square statistic of a set of counts against
+ * the same counts of all controls, without those of one control.
+ */
+intern
+double
+control_chi2( long* obs, long* all, long* less, int bins )
+   {
+   double expected[bins];
+   double sum = 0.0;
+   double ref_sum = 0.0;
+   for ( int b = 0; b < bins; b++ )
+      {
+      sum += obs[b];
+      ref_sum += all[b] - ( less ? less[b] : 0 );
+      }
+   if ( sum == 0.0 || ref_sum == 0.0 ) { return 0.0; }
+   for ( int b = 0; b < bins; b++ )
+      {
+      expected[b] = ( all[b] - ( less ? less[b] : 0 ) ) * sum / ref_sum;
+      }
+   return chi_square( obs, expected, bins ).chi2;
+   }
+
+/** control_p_value() tells how often a control deviates from the rest
+ * of the controls as much as the real dataset deviates from all of them,
+ * by the chi-square statistic of a set of counts. Unlike the p-value of
+ * test_chart_stats(), this needs no assumption about the distribution
+ * of the counts, so it holds for houses and aspects, where charts of the
+ * same dataset are far from independent.
+ * @param st Pointer to the ChartStats of the real dataset.
+ * @param controls Array of ChartStats of its controls.
+ * @param count Number of controls.
+ * @param all Pointer to the merge_control_stats() of the controls.
+ * @param what, i, j Which counts, as in stats_bins().
+ *
+ * @return the empirical p-value, from 1/(count+1) to 1, or -1 if
+ *         there are no such counts.
+ */
+extern
+double
+control_p_value( ChartStats* st, ChartStats** controls, int count,
+                 ChartStats* all, int what, int i, int j )
+   {
+   int bins;
+   int all_bins = 0;
+   long* obs = stats_bins( st, what, i, j, &bins );
+   long* ref = all ? stats_bins( all, what, i, j, &all_bins ) : NULL;
+   if ( !obs || !ref || all_bins != bins ) { return -1.0; }
+   double real = control_chi2( obs, ref, NULL, bins );
+   int as_far = 0;
+   for ( int c = 0; c < count; c++ )
+      {
+      long* ctl = stats_bins( controls[c], what, i, j, &bins );
+      if ( control_chi2( ctl, ref, ctl, bins ) >= real ) { as_far++; }
+      }
+   return ( as_far + 1.0 ) / ( count + 1.0 );
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+#define EVCOUNT 300
+#define CONTROLS 6
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( "PKR", NULL );
+   ChartConfig* cf = get_chart_config();
+   Event evs[EVCOUNT];
+   Event out[EVCOUNT];
+   for ( int i = 0; i < EVCOUNT; i++ )
+      {
+      evs[i].jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      evs[i].lat = g_test_rand_double_range( -60.0, 60.0 );
+      evs[i].lon = g_test_rand_double_range( -180.0, 180.0 );
+      evs[i].name = "control";
+      }
+   //
+   TRIAL( "controls keep what they should",
+      GRand* r = g_rand_new_with_seed( 42 );
+      double sum = 0.0;
+      double day = 0.0;
+      make_control_events( evs, EVCOUNT, CONTROL_TIMES, r, out );
+      for ( int k = 0; k < EVCOUNT; k++ )
+         {
+         ENSURE( floor( out[k].jdn + 0.5 ) == floor( evs[k].jdn + 0.5 ) );
+         ENSURE( out[k].lat == evs[k].lat );
+         sum += evs[k].jdn + 0.5 - floor( evs[k].jdn + 0.5 );
+         day += out[k].jdn + 0.5 - floor( out[k].jdn + 0.5 );
+         }
+      AVOID( fabs( sum - day ) > 1e-6 );
+      sum = day = 0.0;
+      make_control_events( evs, EVCOUNT, CONTROL_PLACES, r, out );
+      for ( int k = 0; k < EVCOUNT; k++ )
+         {
+         ENSURE( out[k].jdn == evs[k].jdn );
+         sum += evs[k].lat * evs[k].lon;
+         day += out[k].lat * out[k].lon;
+         }
+      AVOID( fabs( sum - day ) > 1e-6 );
+      make_control_events( evs, EVCOUNT, CONTROL_DATES, r, out );
+      for ( int k = 0; k < EVCOUNT; k++ )
+         {
+         AVOID( out[k].jdn < 2435000.0 || out[k].jdn > 2460000.0 );
+         ENSURE( out[k].lon == evs[k].lon );
+         }
+      g_rand_free( r );
+      );
+   TRIAL( "controls are the same for any number of threads",
+      ChartStats** one = make_control_stats( cf, evs, EVCOUNT, CONTROL_TIMES, CONTROLS, 7, 1 );
+      ChartStats** many = make_control_stats( cf, evs, EVCOUNT, CONTROL_TIMES, CONTROLS, 7, 3 );
+      for ( int c = 0; c < CONTROLS; c++ )
+         {
+         ENSURE( many[c]->count == EVCOUNT );
+         AVOID( memcmp( one[c]->lon, many[c]->lon, sizeof( long ) * one[c]->size ) );
+         }
+      // and differ from each other
+      ENSURE( memcmp( one[0]->lon, one[1]->lon, sizeof( long ) * one[0]->size ) );
+      dump_control_stats( one, CONTROLS );
+      dump_control_stats( many, CONTROLS );
+      );
+   TRIAL( "controls of places count as charts of their events",
+      ChartStats** places = make_control_stats( cf, evs, EVCOUNT, CONTROL_PLACES, 2, 9, 2 );
+      ChartStats* st = make_chart_stats( cf );
+      guint32 seeds[2] = { 0 };
+      seeds[0] = 9;
+      seeds[1] = 1;
+      GRand* r = g_rand_new_with_seed_array( seeds, 2 );
+      make_control_events( evs, EVCOUNT, CONTROL_PLACES, r, out );
+      g_rand_free( r );
+      fill_chart_stats( st, out, EVCOUNT, 1 );
+      AVOID( memcmp( st->lon, places[1]->lon, sizeof( long ) * st->size ) );
+      dump_chart_stats( st );
+      dump_control_stats( places, 2 );
+      );
+   TRIAL( "control_p_value() finds what is there",
+      ChartStats** dates = make_control_stats( cf, evs, EVCOUNT, CONTROL_DATES, CONTROLS, 3, 2 );
+      ChartStats* all = merge_control_stats( dates, CONTROLS );
+      ChartStats* st = make_chart_stats( cf );
+      ENSURE( all->count == EVCOUNT * CONTROLS );
+      // every Sun in Aries is as far as it gets from chance
+      for ( int k = 0; k < EVCOUNT; k++ ) { out[k] = evs[k]; }
+      for ( int k = 0; k < EVCOUNT; k++ ) { out[k].jdn = 2451265.0 + k % 20; }
+      fill_chart_stats( st, out, EVCOUNT, 1 );
+      double p = control_p_value( st, dates, CONTROLS, all, STATS_SIGNS, 0, 0 );
+      AVOID( fabs( p - 1.0 / ( CONTROLS + 1 ) ) > 1e-9 );
+      p = control_p_value( dates[0], dates, CONTROLS, all, STATS_LON, 1, 0 );
+      AVOID( p <= 0.0 || p > 1.0 );
+      ENSURE( control_p_value( st, dates, CONTROLS, all, STATS_ASPECTS, 1, 0 ) < 0 );
+      dump_chart_stats( st );
+      dump_chart_stats( all );
+      dump_control_stats( dates, CONTROLS );
+      );
+   end_swiss_ephemeris();
+END_TESTS
+#endif
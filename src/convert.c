@@ -272,6 +272,520 @@ jdn_of_timestring( char* str )
    return ret;
    }
 
+//---- PARSING SLICES ------------------------------------------------//
+//-- The parsers below work on a slice of a string, which they neither
+//-- copy nor change, and which need not end in '\0'. They understand
+//-- dates and times without the locale, turn them into jdn with integer
+//-- arithmetic, and tell where and why they fail, so they are what bulk
+//-- input goes through; the functions above stay for the odd formats.
+#define MS_PER_DAY 86400000LL
+#define JDN_OF_EPOCH 2440587.5 // 1970-01-01T00:00:00Z
+
+/** struct Scan is a slice of a string being parsed */
+typedef struct Scan
+   {
+   const char* s;
+   int len;
+   int i; // next char
+   int at; // where it failed
+   const char* why;
+   }
+Scan;
+
+#define scan_peek(sc) ( (sc)->i < (sc)->len ? (sc)->s[(sc)->i] : '\0' )
+#define scan_end(sc) ( (sc)->i >= (sc)->len )
+
+intern
+int
+scan_fail( Scan* sc, int at, const char* why )
+   {
+   sc->at = at;
+   sc->why = why;
+   return -1;
+   }
+
+intern
+void
+scan_spaces( Scan* sc )
+   {
+   while ( scan_peek( sc ) == ' ' || scan_peek( sc ) == '\t' ) { sc->i++; }
+   }
+
+/** scan_digits() reads up to @p max digits.
+ * @return number of digits read, with their value in @p n.
+ */
+intern
+int
+scan_digits( Scan* sc, int max, long long* n )
+   {
+   int count = 0;
+   *n = 0;
+   while ( count < max && g_ascii_isdigit( scan_peek( sc ) ) )
+      {
+      *n = *n * 10 + ( sc->s[sc->i++] - '0' );
+      count++;
+      }
+   return count;
+   }
+
+/** scan_month_name() reads an English month name, or its abbreviation.
+ * @return the month, from 1 to 12, or 0.
+ */
+intern
+int
+scan_month_name( Scan* sc )
+   {
+   static const char* months[] =
+      { "january", "february", "march", "april", "may", "june", "july",
+        "august", "september", "october", "november", "december" };
+   int from = sc->i;
+   while ( g_ascii_isalpha( scan_peek( sc ) ) ) { sc->i++; }
+   int n = sc->i - from;
+   if ( scan_peek( sc ) == '.' ) { sc->i++; }
+   for ( int m = 0; n >= 3 && m < 12; m++ )
+      {
+      if ( n <= strlen( months[m] )
+           && g_ascii_strncasecmp( sc->s + from, months[m], n ) == 0 ) { return m + 1; }
+      }
+   return 0;
+   }
+
+/** days_of_civil() counts the days from 1970-01-01 to a date of the
+ * proleptic Gregorian calendar, in integers only.
+ */
+intern
+long long
+days_of_civil( long long y, int m, int d )
+   {
+   y -= m <= 2;
+   long long era = ( y >= 0 ? y : y - 399 ) / 400;
+   long long yoe = y - era * 400;
+   long long doy = ( 153 * ( m > 2 ? m - 3 : m + 9 ) + 2 ) / 5 + d - 1;
+   long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+   return era * 146097 + doe - 719468;
+   }
+
+intern
+int
+days_in_month( long long y, int m )
+   {
+   static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+   gboolean leap = ( y % 4 == 0 && y % 100 != 0 ) || y % 400 == 0;
+   return m == 2 && leap ? 29 : days[m-1];
+   }
+
+/** scan_date() reads a date as YYYY-MM-DD (or with / or .), YYYYMMDD,
+ * M/D/YYYY (D/M/YYYY if the first number is over 12), D.M.YYYY,
+ * D-M-YYYY, or with the month by name as in "Sep 30 1997" or
+ * "30 Sep 1997".
+ * @return 0, or -1 on error.
+ */
+intern
+int
+scan_date( Scan* sc, long long* days )
+   {
+   long long a;
+   long long b;
+   long long y = 0;
+   int m = 0;
+   int d = 0;
+   int at_m = 0;
+   int at_d = 0;
+   scan_spaces( sc );
+   int from = sc->i;
+   if ( g_ascii_isalpha( scan_peek( sc ) ) )
+      {
+      at_m = sc->i;
+      if ( !( m = scan_month_name( sc ) ) ) { return scan_fail( sc, at_m, "expected a month" ); }
+      scan_spaces( sc );
+      at_d = sc->i;
+      if ( !scan_digits( sc, 2, &a ) ) { return scan_fail( sc, sc->i, "expected a day" ); }
+      d = a;
+      scan_spaces( sc );
+      if ( scan_digits( sc, 4, &y ) != 4 ) { return scan_fail( sc, sc->i, "expected a four digit year" ); }
+      }
+   else
+      {
+      int n = scan_digits( sc, 8, &a );
+      char sep = scan_peek( sc );
+      if ( n == 8 )
+         {
+         y = a / 10000;
+         m = a / 100 % 100;
+         d = a % 100;
+         at_m = from + 4;
+         at_d = from + 6;
+         }
+      else if ( n == 4 && ( sep == '-' || sep == '/' || sep == '.' ) )
+         {
+         y = a;
+         sc->i++;
+         at_m = sc->i;
+         if ( !scan_digits( sc, 2, &b ) ) { return scan_fail( sc, sc->i, "expected a month" ); }
+         m = b;
+         if ( scan_peek( sc ) != sep ) { return scan_fail( sc, sc->i, "expected the same separator" ); }
+         sc->i++;
+         at_d = sc->i;
+         if ( !scan_digits( sc, 2, &b ) ) { return scan_fail( sc, sc->i, "expected a day" ); }
+         d = b;
+         }
+      else if ( ( n == 1 || n == 2 ) && ( sep == ' ' || g_ascii_isalpha( sep ) ) )
+         {
+         at_d = from;
+         d = a;
+         scan_spaces( sc );
+         at_m = sc->i;
+         if ( !( m = scan_month_name( sc ) ) ) { return scan_fail( sc, at_m, "expected a month" ); }
+         scan_spaces( sc );
+         if ( scan_digits( sc, 4, &y ) != 4 ) { return scan_fail( sc, sc->i, "expected a four digit year" ); }
+         }
+      else if ( ( n == 1 || n == 2 ) && ( sep == '/' || sep == '.' || sep == '-' ) )
+         {
+         sc->i++;
+         int at_b = sc->i;
+         if ( !scan_digits( sc, 2, &b ) ) { return scan_fail( sc, sc->i, "expected a number" ); }
+         if ( scan_peek( sc ) != sep ) { return scan_fail( sc, sc->i, "expected the same separator" ); }
+         sc->i++;
+         if ( scan_digits( sc, 4, &y ) != 4 ) { return scan_fail( sc, sc->i, "expected a four digit year" ); }
+         // slashes are month first, as in the US, unless that cannot be
+         gboolean month_first = sep == '/' && a <= 12;
+         m = month_first ? a : b;
+         d = month_first ? b : a;
+         at_m = month_first ? from : at_b;
+         at_d = month_first ? at_b : from;
+         }
+      else { return scan_fail( sc, from, "expected a date" ); }
+      }
+   if ( y < 1 ) { return scan_fail( sc, from, "year out of range" ); }
+   if ( m < 1 || m > 12 ) { return scan_fail( sc, at_m, "month out of range" ); }
+   if ( d < 1 || d > days_in_month( y, m ) ) { return scan_fail( sc, at_d, "day out of range" ); }
+   *days = days_of_civil( y, m, d );
+   return 0;
+   }
+
+/** scan_time() reads a time of day as HH:MM[:SS[.sss]], 6h, 6h18, HHMM
+ * or HHMMSS, maybe followed by AM or PM, and by a time zone as Z, UTC,
+ * +HH, +HH:MM or +HHMM (or with -).
+ * @param ms Gets the time in milliseconds from midnight UT, which is
+ *        under 0 or over a day when the zone moves it to another date.
+ * @return 0, or -1 on error.
+ */
+intern
+int
+scan_time( Scan* sc, long long* ms )
+   {
+   long long h;
+   long long min = 0;
+   long long s = 0;
+   long long frac = 0;
+   gboolean seconds = FALSE;
+   scan_spaces( sc );
+   int from = sc->i;
+   int n = scan_digits( sc, 6, &h );
+   if ( n == 4 || n == 6 )
+      {
+      seconds = n == 6;
+      if ( seconds ) { s = h % 100; h /= 100; }
+      min = h % 100;
+      h /= 100;
+      }
+   else if ( n == 1 || n == 2 )
+      {
+      char sep = scan_peek( sc );
+      if ( sep == ':' || sep == 'h' || sep == 'H' )
+         {
+         sc->i++;
+         if ( !scan_digits( sc, 2, &min ) && sep == ':' )
+            {
+            return scan_fail( sc, sc->i, "expected minutes" );
+            }
+         if ( scan_peek( sc ) == ':' )
+            {
+            sc->i++;
+            if ( !scan_digits( sc, 2, &s ) ) { return scan_fail( sc, sc->i, "expected seconds" ); }
+            seconds = TRUE;
+            }
+         }
+      }
+   else { return scan_fail( sc, from, "expected a time" ); }
+   if ( scan_peek( sc ) == '.' && seconds )
+      {
+      // fractions of a second, to the millisecond
+      sc->i++;
+      int digits = scan_digits( sc, 3, &frac );
+      for ( int k = digits; k < 3; k++ ) { frac *= 10; }
+      while ( g_ascii_isdigit( scan_peek( sc ) ) ) { sc->i++; }
+      }
+   scan_spaces( sc );
+   char c = g_ascii_tolower( scan_peek( sc ) );
+   if ( ( c == 'a' || c == 'p' ) && sc->i + 1 < sc->len )
+      {
+      int at = sc->i;
+      sc->i++;
+      if ( scan_peek( sc ) == '.' ) { sc->i++; }
+      if ( g_ascii_tolower( scan_peek( sc ) ) != 'm' ) { return scan_fail( sc, at, "expected AM or PM" ); }
+      sc->i++;
+      if ( scan_peek( sc ) == '.' ) { sc->i++; }
+      if ( h < 1 || h > 12 ) { return scan_fail( sc, from, "hour out of range" ); }
+      h = h % 12 + ( c == 'p' ? 12 : 0 );
+      scan_spaces( sc );
+      }
+   if ( h > 23 ) { return scan_fail( sc, from, "hour out of range" ); }
+   if ( min > 59 ) { return scan_fail( sc, from, "minutes out of range" ); }
+   if ( s > 60 ) { return scan_fail( sc, from, "seconds out of range" ); }
+   *ms = ( ( h * 60 + min ) * 60 + s ) * 1000 + frac;
+   // and the time zone, which is subtracted to get to UT
+   c = scan_peek( sc );
+   if ( c == 'Z' || c == 'z' )
+      {
+      sc->i++;
+      return 0;
+      }
+   if ( sc->len - sc->i >= 3 && ( g_ascii_strncasecmp( sc->s + sc->i, "UTC", 3 ) == 0
+                                  || g_ascii_strncasecmp( sc->s + sc->i, "GMT", 3 ) == 0 ) )
+      {
+      sc->i += 3;
+      c = scan_peek( sc );
+      }
+   if ( c != '+' && c != '-' ) { return 0; }
+   sc->i++;
+   int at = sc->i;
+   long long zh;
+   long long zm = 0;
+   n = scan_digits( sc, 4, &zh );
+   if ( n == 4 )
+      {
+      zm = zh % 100;
+      zh /= 100;
+      }
+   else if ( n == 1 || n == 2 )
+      {
+      if ( scan_peek( sc ) == ':' )
+         {
+         sc->i++;
+         if ( scan_digits( sc, 2, &zm ) != 2 ) { return scan_fail( sc, sc->i, "expected zone minutes" ); }
+         }
+      }
+   else { return scan_fail( sc, at, "expected a time zone" ); }
+   if ( zh > 14 || zm > 59 ) { return scan_fail( sc, at, "time zone out of range" ); }
+   long long zone = ( zh * 60 + zm ) * 60000;
+   *ms += c == '+' ? -zone : zone;
+   return 0;
+   }
+
+/** scan_coord() reads a latitude or longitude, in degrees, signed or
+ * with a letter for the hemisphere, before or after: S or W (the
+ * letters of @p neg) make it negative. Decimals are read without the
+ * locale.
+ * @return 0, or -1 on error.
+ */
+intern
+int
+scan_coord( Scan* sc, const char* pos, const char* neg, double max, double* ret )
+   {
+   static const long long tens[] =
+      { 1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+        100000000LL, 1000000000LL, 10000000000LL, 100000000000LL,
+        1000000000000LL };
+   int sign = 1;
+   int hemi = 0;
+   long long ip;
+   long long fp = 0;
+   int places = 0;
+   scan_spaces( sc );
+   int from = sc->i;
+   char c = g_ascii_toupper( scan_peek( sc ) );
+   if ( c && ( strchr( pos, c ) || strchr( neg, c ) ) )
+      {
+      hemi = strchr( neg, c ) ? -1 : 1;
+      sc->i++;
+      scan_spaces( sc );
+      }
+   if ( scan_peek( sc ) == '-' || scan_peek( sc ) == '+' )
+      {
+      sign = sc->s[sc->i++] == '-' ? -1 : 1;
+      }
+   int n = scan_digits( sc, 3, &ip );
+   if ( scan_peek( sc ) == '.' )
+      {
+      sc->i++;
+      places = scan_digits( sc, 12, &fp );
+      while ( g_ascii_isdigit( scan_peek( sc ) ) ) { sc->i++; }
+      }
+   if ( n + places == 0 ) { return scan_fail( sc, sc->i, "expected degrees" ); }
+   scan_spaces( sc );
+   c = g_ascii_toupper( scan_peek( sc ) );
+   if ( !hemi && c && ( strchr( pos, c ) || strchr( neg, c ) ) )
+      {
+      hemi = strchr( neg, c ) ? -1 : 1;
+      sc->i++;
+      scan_spaces( sc );
+      }
+   // both exact, so the quotient is as close as strtod() gets
+   double deg = (double) ( ip * tens[places] + fp ) / (double) tens[places];
+   if ( deg > max ) { return scan_fail( sc, from, "degrees out of range" ); }
+   *ret = hemi < 0 || sign < 0 ? -deg : deg;
+   return 0;
+   }
+
+/** jdn_of_date_slice() parses a date, as jdn_of_datestring() does, but
+ * without the locale.
+ * @param str A string, not changed.
+ * @param len Length of the date in @p str, or -1 if it ends in '\0'.
+ * @param at If not NULL, gets where the date is wrong, or -1.
+ *
+ * @return jdn of midnight UT of the date, or NaN.
+ */
+extern
+double
+jdn_of_date_slice( const char* str, int len, int* at )
+   {
+   Scan sc = { .s = str, .len = len < 0 ? strlen( str ) : len, .at = -1 };
+   long long days = 0;
+   if ( scan_date( &sc, &days ) == 0 )
+      {
+      scan_spaces( &sc );
+      if ( !scan_end( &sc ) ) { scan_fail( &sc, sc.i, "unexpected text after the date" ); }
+      }
+   if ( at ) { *at = sc.at; }
+   return sc.at < 0 ? JDN_OF_EPOCH + days : NAN;
+   }
+
+/** jdn_of_time_slice() parses a time and zone, as jdn_of_timestring()
+ * does, and also tells where it is wrong.
+ * @param str A string, not changed.
+ * @param len Length of the time in @p str, or -1 if it ends in '\0'.
+ * @param at If not NULL, gets where the time is wrong, or -1.
+ *
+ * @return fraction of a day since midnight UT, or NaN.
+ */
+extern
+double
+jdn_of_time_slice( const char* str, int len, int* at )
+   {
+   Scan sc = { .s = str, .len = len < 0 ? strlen( str ) : len, .at = -1 };
+   long long ms = 0;
+   if ( scan_time( &sc, &ms ) == 0 )
+      {
+      scan_spaces( &sc );
+      if ( !scan_end( &sc ) ) { scan_fail( &sc, sc.i, "unexpected text after the time" ); }
+      }
+   if ( at ) { *at = sc.at; }
+   return sc.at < 0 ? (double) ms / MS_PER_DAY : NAN;
+   }
+
+/** scan_moment() reads a date and a time, as an ISO 8601 tag, with T
+ * (or a space) between them, or as two fields, with a comma between.
+ * @return 0, or -1 on error.
+ */
+intern
+int
+scan_moment( Scan* sc, double* jdn )
+   {
+   long long days;
+   long long ms;
+   if ( scan_date( sc, &days ) < 0 ) { return -1; }
+   char c = scan_peek( sc );
+   if ( c == 'T' || c == 't' || ( c == ' ' && sc->i + 1 < sc->len
+                                  && g_ascii_isdigit( sc->s[sc->i + 1] ) ) )
+      {
+      sc->i++;
+      }
+   else
+      {
+      scan_spaces( sc );
+      if ( scan_peek( sc ) != ',' ) { return scan_fail( sc, sc->i, "expected a comma after the date" ); }
+      sc->i++;
+      }
+   if ( scan_time( sc, &ms ) < 0 ) { return -1; }
+   // one rounding, from an exact count of milliseconds
+   *jdn = JDN_OF_EPOCH + (double) ( days * MS_PER_DAY + ms ) / MS_PER_DAY;
+   return 0;
+   }
+
+/** jdn_of_iso_slice() parses an ISO 8601 date and time, as
+ * jdn_of_isotag() does, without allocating.
+ * @param str A string, not changed.
+ * @param len Length of the tag in @p str, or -1 if it ends in '\0'.
+ * @param at If not NULL, gets where the tag is wrong, or -1.
+ *
+ * @return date in swiss ephemeris format or NaN
+ */
+extern
+double
+jdn_of_iso_slice( const char* str, int len, int* at )
+   {
+   Scan sc = { .s = str, .len = len < 0 ? strlen( str ) : len, .at = -1 };
+   double jdn = NAN;
+   if ( scan_moment( &sc, &jdn ) == 0 )
+      {
+      scan_spaces( &sc );
+      if ( !scan_end( &sc ) ) { scan_fail( &sc, sc.i, "unexpected text after the time" ); }
+      }
+   if ( at ) { *at = sc.at; }
+   return sc.at < 0 ? jdn : NAN;
+   }
+
+/** parse_event() parses an event as "name,date,time,lat,lon", or as
+ * "name,ISO 8601 tag,lat,lon", with the coordinates optional (and 0,0
+ * if missing), like make_event_of_string() does, but without copying
+ * or changing the string, nor allocating anything.
+ * @param str A string, not changed.
+ * @param len Length of the event in @p str, or -1 if it ends in '\0'.
+ * @param es Gets the event, whose name is left in @p str, or where and
+ *        why the parse failed.
+ *
+ * @return 0, or -1 on error.
+ */
+extern
+int
+parse_event( const char* str, int len, EventSlice* es )
+   {
+   Scan sc = { .s = str, .len = len < 0 ? strlen( str ) : len, .at = -1 };
+   es->ev.name = NULL;
+   es->ev.jdn = NAN;
+   es->ev.lat = es->ev.lon = 0.0;
+   es->at = -1;
+   es->why = NULL;
+   // the name is all up to the first comma, without spaces around it
+   scan_spaces( &sc );
+   es->name = str + sc.i;
+   while ( !scan_end( &sc ) && scan_peek( &sc ) != ',' ) { sc.i++; }
+   es->name_len = str + sc.i - es->name;
+   while ( es->name_len > 0 && g_ascii_isspace( es->name[es->name_len - 1] ) ) { es->name_len--; }
+   if ( es->name_len == 0 ) { scan_fail( &sc, es->name - str, "expected a name" ); }
+   else if ( scan_end( &sc ) ) { scan_fail( &sc, sc.i, "expected a comma after the name" ); }
+   else
+      {
+      sc.i++;
+      scan_moment( &sc, &es->ev.jdn );
+      }
+   if ( sc.at < 0 )
+      {
+      scan_spaces( &sc );
+      char c = scan_peek( &sc );
+      if ( c == ',' || c == ';' )
+         {
+         sc.i++;
+         if ( scan_coord( &sc, "N", "S", 90.0, &es->ev.lat ) == 0 )
+            {
+            c = scan_peek( &sc );
+            if ( c != ',' && c != ';' ) { scan_fail( &sc, sc.i, "expected a comma after the latitude" ); }
+            else
+               {
+               sc.i++;
+               scan_coord( &sc, "E", "W", 180.0, &es->ev.lon );
+               }
+            }
+         }
+      if ( sc.at < 0 && !scan_end( &sc ) ) { scan_fail( &sc, sc.i, "unexpected text" ); }
+      }
+   es->at = sc.at;
+   es->why = sc.why;
+   if ( es->at >= 0 ) { es->ev.jdn = NAN; }
+   return es->at < 0 ? 0 : -1;
+   }
+
 //####################################################################//
 //---- TEST ----------------------------------------------------------//
 //####################################################################//
@@ -408,6 +922,82 @@ BEGIN_TESTS
       AVOID( dt.lat != -23.0 );
       AVOID( dt.lon != -43.0 );
       );
+   //
+   // TEST: parse_event( ) and the other slice parsers
+   char* lines[] =
+      {
+      "sweph,9/30/1997,14:00,47.34N,8.57E",
+      "rio,1997-09-30,21:00+03:00,-23,-43",
+      "sw,1997-09-30,6h9,23S,43W",
+      "pm,1997-09-30,06:00PM",
+      "leap,2000-02-29,15:00-03:00,-25S,-45W",
+      };
+   TRIAL("parse_event() agrees with make_event_of_string()",
+      for ( int i = 0; i < G_N_ELEMENTS( lines ); i++ )
+         {
+         EventSlice es;
+         Event* ev = make_event_of_string( lines[i] );
+         ENSURE( ev );
+         ENSURE( 0 == parse_event( lines[i], -1, &es ) );
+         if ( !ev ) { continue; }
+         ENSURE( NEAR( es.ev.jdn, ev->jdn ) );
+         ENSURE( NEAR( es.ev.lat, ev->lat ) );
+         ENSURE( NEAR( es.ev.lon, ev->lon ) );
+         AVOID( strncmp( es.name, ev->name, es.name_len ) || ev->name[es.name_len] );
+         dump_event( ev );
+         }
+      );
+   TRIAL("slice parsers agree with the GLib ones",
+      ENSURE( jdn_of_date_slice( "1997-09-30", -1, NULL ) == jdn_of_datestring( "1997-09-30" ) );
+      ENSURE( jdn_of_date_slice( "9/30/1997", -1, NULL ) == jdn_of_datestring( "9/30/1997" ) );
+      ENSURE( jdn_of_date_slice( "Sep 30 1997", -1, NULL ) == 2450721.5 );
+      ENSURE( jdn_of_date_slice( "30.09.1997", -1, NULL ) == 2450721.5 );
+      ENSURE( NEAR( jdn_of_time_slice( "10:23:45", -1, NULL ), jdn_of_timestring( "10:23:45" ) ) );
+      ENSURE( NEAR( jdn_of_time_slice( "21:00+03:00", -1, NULL ), jdn_of_timestring( "21:00+03:00" ) ) );
+      ENSURE( NEAR( jdn_of_time_slice( "6h18", -1, NULL ), jdn_of_timestring( "6h18" ) ) );
+      ENSURE( NEAR( jdn_of_iso_slice( "1997-09-30T16:00:00+02", -1, NULL ), swebday ) );
+      ENSURE( NEAR( jdn_of_iso_slice( "19970930T140000Z", -1, NULL ), swebday ) );
+      ENSURE( NEAR( jdn_of_iso_slice( "2024-02-29T23:59:00-03:30", -1, NULL ),
+                    jdn_of_isotag( "2024-02-29T23:59:00-03:30" ) ) );
+      ENSURE( isnan( jdn_of_iso_slice( "Invalid", -1, NULL ) ) );
+      ENSURE( isnan( jdn_of_date_slice( "2023-02-29", -1, NULL ) ) );
+      );
+   TRIAL("parse_event() says where it failed",
+      EventSlice es;
+      ENSURE( -1 == parse_event( "sweph,9/31/1997,14:00", -1, &es ) );
+      ENSURE( es.at == 8 );
+      ENSURE( es.why );
+      ENSURE( -1 == parse_event( "x,1997-13-01,10:00", -1, &es ) );
+      ENSURE( es.at == 7 );
+      ENSURE( -1 == parse_event( "x,1997-09-30,25:00", -1, &es ) );
+      ENSURE( es.at == 13 );
+      ENSURE( -1 == parse_event( "x,1997-09-30,10:00,95N,0", -1, &es ) );
+      ENSURE( es.at == 19 );
+      ENSURE( -1 == parse_event( ",1997-09-30,10:00", -1, &es ) );
+      ENSURE( es.at == 0 );
+      ENSURE( -1 == parse_event( "x,1997-09-30", -1, &es ) );
+      ENSURE( es.at == 12 );
+      ENSURE( isnan( es.ev.jdn ) );
+      ENSURE( -1 == parse_event( "aksjddfadshf", -1, &es ) );
+      );
+   TRIAL("parse_event() stays in its slice",
+      char text[] = "a,1997-09-30,14:00,1,2\nbb,1997-09-30T16:00+02,3,4\n";
+      EventSlice es;
+      char* nl = strchr( text, '\n' );
+      BOUND(
+         ENSURE( 0 == parse_event( text, nl - text, &es ) );
+         );
+      ENSURE( es.name == text );
+      ENSURE( es.name_len == 1 );
+      ENSURE( es.ev.lon == 2.0 );
+      ENSURE( 0 == parse_event( nl + 1, strchr( nl + 1, '\n' ) - nl - 1, &es ) );
+      ENSURE( es.name_len == 2 );
+      ENSURE( NEAR( es.ev.jdn, swebday ) );
+      ENSURE( es.ev.lat == 3.0 );
+      // without its last char, the slice ends before the longitude
+      ENSURE( -1 == parse_event( text, nl - text - 1, &es ) );
+      ENSURE( es.at == 21 );
+      );
 END_TESTS
 #endif //TEST
 
@@ -970,9 +970,67 @@ void basic_aspects( Figure* F, double r1, double r2 )
       }
    }
 
-void fancy_aspects( Figure* F, double r1, double r2 )
+/** aspect_stroke() draws one aspect line, styled by its kind. */
+static
+void
+aspect_stroke( Figure* F, Aspect* each, double lon1, double lon2, double r1 )
    {
    double conj_r = l_of_deg_at_r(4.0,r1);
+   switch ( each->kind )
+      {
+      default:
+      prep( line, 0, 1 );
+      cairo( set_source_rgba, 0.0, 0.0, 0.0, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      case 1: // conjunction
+      prep( line, 0, (each->score/25.0) );
+      cairo( set_source_rgba, 0.99, 0.6, 0.1, (each->score/120.0) );
+      if ( lon1 > lon2 )
+      draw( arc_2pt_r, r1, lon1, r1, lon2, conj_r );
+      else
+      draw( arc_2pt_r, r1, lon2, r1, lon1, conj_r );
+      break;
+      case 2: // opposition
+      prep( line, 220, (each->score/25.0) );
+      cairo( set_source_rgba, 0.85, 0.25, 0.25, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      case 4: // square
+      prep( line, 320, (each->score/25.0) );
+      cairo( set_source_rgba, 0.8, 0.3, 0.0, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      case 3: // trine
+      prep( line, 110, (each->score/25.0) );
+      cairo( set_source_rgba, 0.4, 0.7, 0.0, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      case 6: // sextile
+      prep( line, 180, (each->score/25.0) );
+      cairo( set_source_rgba, 0.2, 0.7, 0.2, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      case 12: // inconjunct
+      prep( line, 420, (each->score/25.0) );
+      cairo( set_source_rgba, 0.8, 0.7, 0.3, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      case 5: // pentagons
+      prep( line, 4, (each->score/30.0) );
+      cairo( set_source_rgba, 0.5, 0.7, 0.9, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      case 7: // septile
+      prep( line, 7, (each->score/30.0) );
+      cairo( set_source_rgba, 0.8, 0.3, 0.9, (each->score/120.0) );
+      draw( line, r1, lon1, r1, lon2 );
+      break;
+      }
+   }
+
+void fancy_aspects( Figure* F, double r1, double r2 )
+   {
    for ( Aspect* each = F->c->aspects;
       each < (F->c->aspects + F->c->asp_count);
       each++
@@ -980,60 +1038,69 @@ void fancy_aspects( Figure* F, double r1, double r2 )
       {
       Point* pt1 = &( F->c->points[ each->point1 ] );
       Point* pt2 = &( F->c->points[ each->point2 ] );
-      switch ( each->kind )
-         {
-         default:
-         prep( line, 0, 1 );
-         cairo( set_source_rgba, 0.0, 0.0, 0.0, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         case 1: // conjunction
-         prep( line, 0, (each->score/25.0) );
-         cairo( set_source_rgba, 0.99, 0.6, 0.1, (each->score/120.0) );
-         if ( pt1->lon > pt2-> lon )
-         draw( arc_2pt_r, r1, pt1->lon, r1, pt2->lon, conj_r );
-         else
-         draw( arc_2pt_r, r1, pt2->lon, r1, pt1->lon, conj_r );
-         break;
-         case 2: // opposition
-         prep( line, 220, (each->score/25.0) );
-         cairo( set_source_rgba, 0.85, 0.25, 0.25, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         case 4: // square
-         prep( line, 320, (each->score/25.0) );
-         cairo( set_source_rgba, 0.8, 0.3, 0.0, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         case 3: // trine
-         prep( line, 110, (each->score/25.0) );
-         cairo( set_source_rgba, 0.4, 0.7, 0.0, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         case 6: // sextile
-         prep( line, 180, (each->score/25.0) );
-         cairo( set_source_rgba, 0.2, 0.7, 0.2, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         case 12: // inconjunct
-         prep( line, 420, (each->score/25.0) );
-         cairo( set_source_rgba, 0.8, 0.7, 0.3, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         case 5: // pentagons
-         prep( line, 4, (each->score/30.0) );
-         cairo( set_source_rgba, 0.5, 0.7, 0.9, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         case 7: // septile
-         prep( line, 7, (each->score/30.0) );
-         cairo( set_source_rgba, 0.8, 0.3, 0.9, (each->score/120.0) );
-         draw( line, r1, pt1->lon, r1, pt2->lon );
-         break;
-         }
+      aspect_stroke( F, each, pt1->lon, pt2->lon, r1 );
       }
    }
 
+//-- BI-WHEELS -------------------------------------------------------//
+//-- A bi-wheel is F->c (inner) with F->c2 (outer) around it. Rings that
+//-- do not depend on a chart, like the zodiac, are painted only once;
+//-- the houses are always those of the inner chart.
+
+/** outer_points() paints the points of the outer chart of a bi-wheel
+ * against the houses of the inner chart. */
+void outer_points( Figure* F, double r1, double r2 )
+   {
+   if ( !F->c2 ) { return; }
+   Chart* inner = F->c;
+   F->c = F->c2;
+   dot_dot_points( F, r1, r2 );
+   F->c = inner;
+   }
+
+/** harmonic_of_def pairs the kinds of aspect_defs[] with the harmonic
+ * kinds aspect_stroke() styles; 30 and 150 degrees are both of the 12th */
+static const int harmonic_of_def[][2] =
+   {
+   { 1, 1 }, { 2, 2 }, { 3, 3 }, { 4, 4 }, { 6, 6 }, { 121, 12 }, { 125, 12 }
+   };
+
+/** as_harmonic() makes an aspect of aspect_defs[], scored from 0 up to
+ * its orb, into one of a harmonic kind, scored from 0 to 100, to be
+ * styled by aspect_stroke(). */
+static
+Aspect
+as_harmonic( Aspect* each )
+   {
+   Aspect a = *each;
+   a.kind = 0;
+   for ( int k = 0; k < G_N_ELEMENTS( harmonic_of_def ); k++ )
+      {
+      if ( harmonic_of_def[k][0] == each->kind ) { a.kind = harmonic_of_def[k][1]; }
+      }
+   for ( const AspectDef* d = aspect_defs; d->kind; d++ )
+      {
+      if ( d->kind == each->kind ) { a.score = 100.0 * each->score / d->orb; }
+      }
+   return a;
+   }
+
+/** cross_aspects() paints the aspects between the points of the inner
+ * and the outer chart of a bi-wheel. */
+void cross_aspects( Figure* F, double r1, double r2 )
+   {
+   if ( !F->c2 ) { return; }
+   Aspect* xs = make_cross_aspects( F->c, F->c2 );
+   for ( Aspect* each = xs; each->kind; each++ )
+      {
+      Point* pt1 = &( F->c->points[ each->point1 ] );
+      Point* pt2 = &( F->c2->points[ each->point2 ] );
+      Aspect a = as_harmonic( each );
+      aspect_stroke( F, &a, pt1->lon, pt2->lon, r1 );
+      }
+   free( xs );
+   }
+
 
 
 
@@ -1203,6 +1270,15 @@ BEGIN_TESTS
       ENSURE( ts[6].begin == ts[0].begin );
       ENSURE( ts[6].end == ts[0].end );
       );
+   TRIAL("cross aspects are styled as harmonics, scored up to 100",
+      for ( const AspectDef* d = aspect_defs; d->kind; d++ )
+         {
+         Aspect exact = { .kind = d->kind, .score = d->orb };
+         Aspect a = as_harmonic( &exact );
+         AVOID( a.kind == 0 );
+         AVOID( !NEAR( a.score, 100.0 ) );
+         }
+      );
 END_TESTS
 #endif //TEST
 
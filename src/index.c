@@ -0,0 +1,763 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file index.c
+ *    finds charts by where their points are, with bitmaps.
+ *
+ * A ChartIndex has, for each point, one bitmap of charts per sign, per
+ * degree and per house of each house system. A question like "Sun
+ * 10-12 Leo, Moon water, Mars angular P" is then a few ORs of bitmaps
+ * (the degrees, the signs of the element, the houses) and an AND of
+ * those, without looking at any chart.
+ *
+ * Bitmaps are kept as in roaring bitmaps: the rows of the charts are
+ * split in chunks of 65536, and each chunk is a sorted array of its
+ * low 16 bits while it has up to 4096 rows, or 1024 words of bits once
+ * it has more. Sparse bitmaps, like a degree of a slow planet, stay
+ * small, and dense ones, like a sign of the Sun in a big dataset, are
+ * ANDed a word at a time.
+ **/
+
+#include "arfc.h"
+
+#define ARRAY_MAX 4096 // rows in a chunk kept as an array
+#define BITS_WORDS 1024 // 65536 bits
+#define INDEX_SIGNS 0
+#define INDEX_DEGREES 12
+#define INDEX_HOUSES 372
+#define index_keys(cf) ( INDEX_HOUSES + 12 * (cf)->sys_count )
+#define index_map(ix,p,key) ( (ix)->maps + (p) * index_keys( (ix)->cf ) + (key) )
+
+/** struct Container is a chunk of 65536 rows of a bitmap */
+typedef struct Container
+   {
+   int key; // high bits of the rows
+   int card; // rows in it
+   int size; // room in vals
+   guint16* vals; // low bits of the rows, sorted, or NULL...
+   guint64* bits; // ...and these are BITS_WORDS words
+   }
+Container;
+
+/** struct Bitmap is a set of rows, in chunks ordered by key */
+typedef struct Bitmap
+   {
+   int count;
+   int size;
+   Container* cs;
+   }
+Bitmap;
+
+//---- BITMAPS -------------------------------------------------------//
+intern
+void
+clear_bitmap( Bitmap* b )
+   {
+   for ( int i = 0; i < b->count; i++ )
+      {
+      if ( b->cs[i].vals ) { free( b->cs[i].vals ); }
+      if ( b->cs[i].bits ) { free( b->cs[i].bits ); }
+      }
+   if ( b->cs ) { free( b->cs ); }
+   *b = (Bitmap) { 0 };
+   }
+
+intern
+void
+dump_bitmap( Bitmap* b )
+   {
+   clear_bitmap( b );
+   free( b );
+   }
+
+/** new_container() adds an empty chunk to the end of a bitmap. */
+intern
+Container*
+new_container( Bitmap* b, int key )
+   {
+   if ( b->count == b->size )
+      {
+      b->size = b->size ? 2 * b->size : 4;
+      if ( b->cs ) { b->cs = realloc( b->cs, sizeof( Container ) * b->size ); }
+      else { b->cs = malloc( sizeof( Container ) * b->size ); }
+      enforce( "grow bitmap", b->cs );
+      }
+   Container* k = b->cs + b->count++;
+   *k = (Container) { .key = key };
+   return k;
+   }
+
+/** set_words() sets a chunk as words of bits, made into an array if it
+ * has few enough rows.
+ */
+intern
+void
+set_words( Container* k, guint64* words )
+   {
+   k->card = 0;
+   for ( int w = 0; w < BITS_WORDS; w++ ) { k->card += __builtin_popcountll( words[w] ); }
+   if ( k->card > ARRAY_MAX )
+      {
+      k->bits = malloc( sizeof( guint64 ) * BITS_WORDS );
+      memcpy( k->bits, words, sizeof( guint64 ) * BITS_WORDS );
+      return;
+      }
+   k->size = MAX( k->card, 1 );
+   k->vals = malloc( sizeof( guint16 ) * k->size );
+   int n = 0;
+   for ( int w = 0; w < BITS_WORDS; w++ )
+      {
+      for ( guint64 bits = words[w]; bits; bits &= bits - 1 )
+         {
+         k->vals[n++] = w * 64 + __builtin_ctzll( bits );
+         }
+      }
+   }
+
+/** get_words() writes a chunk as words of bits. */
+intern
+void
+get_words( Container* k, guint64* words )
+   {
+   if ( k->bits )
+      {
+      memcpy( words, k->bits, sizeof( guint64 ) * BITS_WORDS );
+      return;
+      }
+   memset( words, 0, sizeof( guint64 ) * BITS_WORDS );
+   for ( int i = 0; i < k->card; i++ )
+      {
+      words[k->vals[i] >> 6] |= 1ULL << ( k->vals[i] & 63 );
+      }
+   }
+
+/** bitmap_add() adds a row to a bitmap, after all rows it has. */
+intern
+void
+bitmap_add( Bitmap* b, long row )
+   {
+   int key = row >> 16;
+   guint16 low = row & 0xFFFF;
+   Container* k = b->count && b->cs[b->count-1].key == key
+                  ? b->cs + b->count-1 : new_container( b, key );
+   if ( k->bits )
+      {
+      k->bits[low >> 6] |= 1ULL << ( low & 63 );
+      k->card++;
+      return;
+      }
+   if ( k->card == ARRAY_MAX )
+      {
+      guint64 words[BITS_WORDS];
+      get_words( k, words );
+      words[low >> 6] |= 1ULL << ( low & 63 );
+      free( k->vals );
+      k->vals = NULL;
+      k->size = 0;
+      set_words( k, words );
+      return;
+      }
+   if ( k->card == k->size )
+      {
+      k->size = k->size ? 2 * k->size : 4;
+      if ( k->vals ) { k->vals = realloc( k->vals, sizeof( guint16 ) * k->size ); }
+      else { k->vals = malloc( sizeof( guint16 ) * k->size ); }
+      enforce( "grow bitmap chunk", k->vals );
+      }
+   k->vals[k->card++] = low;
+   }
+
+/** copy_container() adds a copy of a chunk to the end of a bitmap. */
+intern
+void
+copy_container( Bitmap* b, Container* from )
+   {
+   Container* k = new_container( b, from->key );
+   guint64 words[BITS_WORDS];
+   get_words( from, words );
+   set_words( k, words );
+   }
+
+/** and_containers() adds the rows in both chunks to a bitmap. */
+intern
+void
+and_containers( Bitmap* b, Container* x, Container* y )
+   {
+   guint16 vals[ARRAY_MAX];
+   int n = 0;
+   if ( x->bits && y->bits )
+      {
+      guint64 words[BITS_WORDS];
+      guint64 any = 0;
+      for ( int w = 0; w < BITS_WORDS; w++ ) { any |= words[w] = x->bits[w] & y->bits[w]; }
+      if ( any ) { set_words( new_container( b, x->key ), words ); }
+      return;
+      }
+   if ( x->bits ) { Container* t = x; x = y; y = t; }
+   if ( y->bits )
+      {
+      // x is an array
+      for ( int i = 0; i < x->card; i++ )
+         {
+         guint16 v = x->vals[i];
+         if ( y->bits[v >> 6] & ( 1ULL << ( v & 63 ) ) ) { vals[n++] = v; }
+         }
+      }
+   else
+      {
+      for ( int i = 0, j = 0; i < x->card && j < y->card; )
+         {
+         if ( x->vals[i] < y->vals[j] ) { i++; }
+         else if ( x->vals[i] > y->vals[j] ) { j++; }
+         else { vals[n++] = x->vals[i]; i++; j++; }
+         }
+      }
+   if ( n == 0 ) { return; }
+   Container* k = new_container( b, x->key );
+   k->vals = malloc( sizeof( guint16 ) * n );
+   memcpy( k->vals, vals, sizeof( guint16 ) * n );
+   k->card = k->size = n;
+   }
+
+/** or_containers() adds the rows in either chunk to a bitmap. */
+intern
+void
+or_containers( Bitmap* b, Container* x, Container* y )
+   {
+   Container* k = new_container( b, x->key );
+   if ( !x->bits && !y->bits && x->card + y->card <= ARRAY_MAX )
+      {
+      k->size = MAX( x->card + y->card, 1 );
+      k->vals = malloc( sizeof( guint16 ) * k->size );
+      int i = 0, j = 0;
+      while ( i < x->card || j < y->card )
+         {
+         if ( j == y->card || ( i < x->card && x->vals[i] < y->vals[j] ) ) { k->vals[k->card++] = x->vals[i++]; }
+         else if ( i == x->card || y->vals[j] < x->vals[i] ) { k->vals[k->card++] = y->vals[j++]; }
+         else { k->vals[k->card++] = x->vals[i++]; j++; }
+         }
+      return;
+      }
+   guint64 words[BITS_WORDS];
+   guint64 more[BITS_WORDS];
+   get_words( x, words );
+   get_words( y, more );
+   for ( int w = 0; w < BITS_WORDS; w++ ) { words[w] |= more[w]; }
+   set_words( k, words );
+   }
+
+/** and_bitmaps() is a new bitmap of the rows in both @p a and @p b. */
+intern
+Bitmap*
+and_bitmaps( Bitmap* a, Bitmap* b )
+   {
+   Bitmap* ret;
+   ret = calloc( 1, sizeof( Bitmap ) );
+   for ( int i = 0, j = 0; i < a->count && j < b->count; )
+      {
+      if ( a->cs[i].key < b->cs[j].key ) { i++; }
+      else if ( a->cs[i].key > b->cs[j].key ) { j++; }
+      else { and_containers( ret, a->cs + i++, b->cs + j++ ); }
+      }
+   return ret;
+   }
+
+/** or_bitmaps() is a new bitmap of the rows in @p a or @p b. */
+intern
+Bitmap*
+or_bitmaps( Bitmap* a, Bitmap* b )
+   {
+   Bitmap* ret;
+   ret = calloc( 1, sizeof( Bitmap ) );
+   int i = 0, j = 0;
+   while ( i < a->count || j < b->count )
+      {
+      if ( j == b->count || ( i < a->count && a->cs[i].key < b->cs[j].key ) ) { copy_container( ret, a->cs + i++ ); }
+      else if ( i == a->count || b->cs[j].key < a->cs[i].key ) { copy_container( ret, b->cs + j++ ); }
+      else { or_containers( ret, a->cs + i++, b->cs + j++ ); }
+      }
+   return ret;
+   }
+
+intern
+long
+bitmap_count( Bitmap* b )
+   {
+   long ret = 0;
+   for ( int i = 0; i < b->count; i++ ) { ret += b->cs[i].card; }
+   return ret;
+   }
+
+/** bitmap_rows() lists the first rows of a bitmap, in order.
+ * @return number of rows, which can be more than @p max.
+ */
+intern
+long
+bitmap_rows( Bitmap* b, long* rows, long max )
+   {
+   long n = 0;
+   for ( int i = 0; i < b->count; i++ )
+      {
+      Container* k = b->cs + i;
+      long high = (long) k->key << 16;
+      if ( n >= max ) { n += k->card; continue; }
+      if ( k->vals )
+         {
+         for ( int v = 0; v < k->card; v++, n++ )
+            {
+            if ( n < max ) { rows[n] = high | k->vals[v]; }
+            }
+         continue;
+         }
+      for ( int w = 0; w < BITS_WORDS; w++ )
+         {
+         for ( guint64 bits = k->bits[w]; bits; bits &= bits - 1, n++ )
+            {
+            if ( n < max ) { rows[n] = high | ( w * 64 + __builtin_ctzll( bits ) ); }
+            }
+         }
+      }
+   return n;
+   }
+
+//---- THE INDEX -----------------------------------------------------//
+/** make_chart_index() makes an empty index.
+ * @param cf Pointer to the ChartConfig of the charts to index, must
+ *        outlive the index.
+ *
+ * @return pointer to a ChartIndex, that must be dumped.
+ */
+extern
+ChartIndex*
+make_chart_index( ChartConfig* cf )
+   {
+   ChartIndex* ix;
+   ix = calloc( 1, sizeof( ChartIndex ) );
+   ix->cf = cf;
+   ix->maps = calloc( cf->pt_count * index_keys( cf ), sizeof( Bitmap ) );
+   return ix;
+   }
+
+/** dump_chart_index() deallocates a ChartIndex.
+ * @param ix Pointer to a ChartIndex.
+ */
+extern
+void
+dump_chart_index( ChartIndex* ix )
+   {
+   for ( int i = 0; i < ix->cf->pt_count * index_keys( ix->cf ); i++ )
+      {
+      clear_bitmap( ix->maps + i );
+      }
+   free( ix->maps );
+   if ( ix->ids ) { free( ix->ids ); }
+   free( ix );
+   }
+
+/** index_numbers() adds a chart to an index from its numbers only, as
+ * kept in a ChartStore, without making the chart.
+ * @param ix Pointer to a ChartIndex.
+ * @param id Number that queries give for this chart.
+ * @param lons Longitude of each point of the index, NAN if it failed.
+ * @param cusps 12 cusps per house system, as Chart.sys_cusps.
+ * @param codes Letter of each house system, '?' if it failed.
+ *
+ * @return the row of the chart in the index.
+ */
+extern
+long
+index_numbers( ChartIndex* ix, long id, double* lons, double* cusps, char* codes )
+   {
+   ChartConfig* cf = ix->cf;
+   if ( ix->count == ix->size )
+      {
+      ix->size = ix->size ? 2 * ix->size : 1024;
+      if ( ix->ids ) { ix->ids = realloc( ix->ids, sizeof( long ) * ix->size ); }
+      else { ix->ids = malloc( sizeof( long ) * ix->size ); }
+      enforce( "grow chart index", ix->ids );
+      }
+   long row = ix->count++;
+   ix->ids[row] = id;
+   for ( int i = 0; i < cf->pt_count; i++ )
+      {
+      // points the ephemeris failed on are in no bitmap
+      if ( isnan( lons[i] ) ) { continue; }
+      double lon = fmod( lons[i] + 360.0, 360.0 );
+      int deg = MIN( (int) lon, 359 );
+      bitmap_add( index_map( ix, i, INDEX_SIGNS + deg / 30 ), row );
+      bitmap_add( index_map( ix, i, INDEX_DEGREES + deg ), row );
+      for ( int s = 0; s < cf->sys_count; s++ )
+         {
+         int h = codes[s] == '?' ? 0 : house_of( cusps + 12 * s, lon );
+         if ( h ) { bitmap_add( index_map( ix, i, INDEX_HOUSES + 12 * s + h-1 ), row ); }
+         }
+      }
+   return row;
+   }
+
+/** index_chart() adds a chart to an index.
+ * @param ix Pointer to a ChartIndex.
+ * @param c Pointer to a Chart, made with the points and house systems
+ *        of the index.
+ * @param id Number that queries give for this chart, such as its id
+ *        in a ChartStore.
+ *
+ * @return the row of the chart in the index, or -1 on error.
+ */
+extern
+long
+index_chart( ChartIndex* ix, Chart* c, long id )
+   {
+   ChartConfig* cf = ix->cf;
+   int fits = c->pt_count == cf->pt_count && c->sys_count == cf->sys_count;
+   for ( int i = 0; fits && i < c->pt_count; i++ ) { fits = c->points[i].code == cf->pts[i]; }
+   if ( !fits )
+      {
+      complain( "chart index: %s has other points or houses\n", c->ev->name );
+      return -1;
+      }
+   double lons[MAX( c->pt_count, 1 )];
+   for_point_i( c )
+      {
+      lons[i] = strcmp( c->points[i].symbol, "?" ) ? c->points[i].lon : NAN;
+      }
+   return index_numbers( ix, id, lons, c->sys_cusps, c->sys_codes );
+   }
+
+//---- QUERIES -------------------------------------------------------//
+static const char* const sign_names[12] =
+   {
+   "Aries", "Taurus", "Gemini", "Cancer", "Leo", "Virgo",
+   "Libra", "Scorpio", "Sagittarius", "Capricorn", "Aquarius", "Pisces"
+   };
+static const char* const sign_abbrs[12] =
+   {"Ar","Ta","Gm","Cn","Le","Vi","Lb","Sc","Sg","Cp","Aq","Pi" };
+// signs of each element are those with the same sign % 4
+static const char* const elements[4] = { "fire", "earth", "air", "water" };
+// signs and houses of each quality are those with the same n % 3
+static const char* const qualities[3] = { "cardinal", "fixed", "mutable" };
+static const char* const angularities[3] = { "angular", "succedent", "cadent" };
+
+/** word_in() is the position of a word in a list, or -1. */
+intern
+int
+word_in( char* word, const char* const* list, int n )
+   {
+   for ( int i = 0; i < n; i++ )
+      {
+      if ( !g_ascii_strcasecmp( word, list[i] ) ) { return i; }
+      }
+   return -1;
+   }
+
+/** point_named() is the position of a point in an index, by its
+ * Swiss Ephemeris name or code, or -1.
+ */
+intern
+int
+point_named( ChartIndex* ix, char* word )
+   {
+   char buff[50]; /* SWEPH address for planet name, at least 20 char */
+   char* end;
+   long code = strtol( word, &end, 10 );
+   for ( int i = 0; i < ix->cf->pt_count; i++ )
+      {
+      if ( *end == '\0' && code == ix->cf->pts[i] ) { return i; }
+      swe_get_planet_name( ix->cf->pts[i], buff );
+      if ( !g_ascii_strcasecmp( word, buff ) ) { return i; }
+      }
+   return -1;
+   }
+
+/** term_keys() reads a term of a query, as "Sun 10-12 Leo", into the
+ * keys of the bitmaps to OR for it, see query_chart_index().
+ *
+ * @return number of keys, or -1 if the term cannot be read.
+ */
+intern
+int
+term_keys( ChartIndex* ix, char* term, int* pt, int* keys )
+   {
+   char* words[5];
+   char* state;
+   int n = 0;
+   for ( char* w = strtok_r( term, " \t", &state ); w; w = strtok_r( NULL, " \t", &state ) )
+      {
+      if ( n == 5 ) { return -1; }
+      words[n++] = w;
+      }
+   if ( n < 2 || ( *pt = point_named( ix, words[0] ) ) < 0 ) { return -1; }
+   int count = 0;
+   int k;
+   if ( n == 2 && ( k = word_in( words[1], sign_names, 12 ) ) >= 0 ) { keys[count++] = INDEX_SIGNS + k; }
+   else if ( n == 2 && ( k = word_in( words[1], sign_abbrs, 12 ) ) >= 0 ) { keys[count++] = INDEX_SIGNS + k; }
+   else if ( n == 2 && ( k = word_in( words[1], elements, 4 ) ) >= 0 )
+      {
+      for ( int s = k; s < 12; s += 4 ) { keys[count++] = INDEX_SIGNS + s; }
+      }
+   else if ( n == 2 && ( k = word_in( words[1], qualities, 3 ) ) >= 0 )
+      {
+      for ( int s = k; s < 12; s += 3 ) { keys[count++] = INDEX_SIGNS + s; }
+      }
+   else if ( g_ascii_isdigit( words[1][0] ) && n <= 3 )
+      {
+      // degrees, as "10-12 Leo" or "130-132", and "355-5" goes over 0
+      char* end;
+      int from = strtol( words[1], &end, 10 );
+      if ( *end != '-' ) { return -1; }
+      int to = strtol( end + 1, &end, 10 );
+      if ( *end != '\0' ) { return -1; }
+      int base = 0;
+      int span = 360;
+      if ( n == 3 )
+         {
+         int s = word_in( words[2], sign_names, 12 );
+         if ( s < 0 ) { s = word_in( words[2], sign_abbrs, 12 ); }
+         if ( s < 0 ) { return -1; }
+         base = 30 * s;
+         span = 30;
+         }
+      if ( from >= span || to > span || ( n == 3 && to <= from ) ) { return -1; }
+      if ( to <= from ) { to += 360; }
+      for ( int d = from; d < to; d++ ) { keys[count++] = INDEX_DEGREES + ( base + d ) % 360; }
+      }
+   else
+      {
+      // houses, as "house 10 P" or "angular P", first system if none
+      int first = 0;
+      int step = 12;
+      int at = 2;
+      if ( !g_ascii_strcasecmp( words[1], "house" ) && n >= 3 )
+         {
+         first = atoi( words[2] ) - 1;
+         at = 3;
+         if ( first < 0 || first > 11 ) { return -1; }
+         }
+      else if ( ( k = word_in( words[1], angularities, 3 ) ) >= 0 )
+         {
+         first = k;
+         step = 3;
+         }
+      else { return -1; }
+      int sys = 0;
+      if ( n > at + 1 ) { return -1; }
+      if ( n == at + 1 )
+         {
+         char* s = strchr( ix->cf->systems, words[at][0] );
+         if ( !s || words[at][1] != '\0' ) { return -1; }
+         sys = s - ix->cf->systems;
+         }
+      for ( int h = first; h < 12; h += step ) { keys[count++] = INDEX_HOUSES + 12 * sys + h; }
+      }
+   return count;
+   }
+
+/** query_chart_index() finds the charts where every term of a query is
+ * true. Terms are separated by commas, and each is a point, by name or
+ * code, and where it is:
+ *   - a sign: "Moon Cancer", "Moon Cn";
+ *   - an element or quality of signs: "Moon water", "Sun fixed";
+ *   - degrees, within a sign or of the zodiac: "Sun 10-12 Leo",
+ *     "Sun 130-132", going over 0 Aries if the second is less; a range
+ *     is half-open, "10-12 Leo" is from 10 Leo up to, but not
+ *     including, 12 Leo;
+ *   - a house, or a kind of houses, of the first house system or of
+ *     the one given by its letter: "Mars house 10", "Mars angular P",
+ *     and "succedent" and "cadent".
+ * @param ix Pointer to a ChartIndex.
+ * @param query The query, as "Sun 10-12 Leo, Moon water, Mars angular P".
+ * @param ids Gets the ids of the charts found, as given to index_chart(),
+ *        in the order they were indexed.
+ * @param max Room in @p ids.
+ *
+ * @return number of charts found, which can be more than @p max, or -1
+ *         if the query cannot be read.
+ */
+extern
+long
+query_chart_index( ChartIndex* ix, char* query, long* ids, long max )
+   {
+   char* copy;
+   copy = strdup( query );
+   int term_count = 1;
+   for ( char* p = copy; *p; p++ ) { term_count += *p == ','; }
+   char* terms[term_count];
+   Bitmap* maps[term_count];
+   int n = 0;
+   for ( char* t = copy; t; n++ )
+      {
+      terms[n] = t;
+      t = strchr( t, ',' );
+      if ( t ) { *t++ = '\0'; }
+      }
+   // each term is an OR of bitmaps of one point
+   long ret = 0;
+   int made = 0;
+   for ( ; made < term_count; made++ )
+      {
+      int keys[360];
+      int pt;
+      char shown[strlen( terms[made] ) + 1];
+      strcpy( shown, terms[made] );
+      int k = term_keys( ix, terms[made], &pt, keys );
+      if ( k < 0 )
+         {
+         complain( "cannot read query term: %s\n", g_strstrip( shown ) );
+         ret = -1;
+         break;
+         }
+      Bitmap none = { 0 };
+      maps[made] = or_bitmaps( &none, index_map( ix, pt, keys[0] ) );
+      for ( int i = 1; i < k; i++ )
+         {
+         Bitmap* more = or_bitmaps( maps[made], index_map( ix, pt, keys[i] ) );
+         dump_bitmap( maps[made] );
+         maps[made] = more;
+         }
+      }
+   if ( ret == 0 )
+      {
+      // AND the smallest first, so the rest have less to go through
+      for ( int i = 1; i < term_count; i++ )
+         {
+         for ( int j = i; j > 0 && bitmap_count( maps[j] ) < bitmap_count( maps[j-1] ); j-- )
+            {
+            Bitmap* t = maps[j]; maps[j] = maps[j-1]; maps[j-1] = t;
+            }
+         }
+      Bitmap* all = maps[0];
+      maps[0] = NULL;
+      for ( int i = 1; i < term_count && all->count; i++ )
+         {
+         Bitmap* both = and_bitmaps( all, maps[i] );
+         dump_bitmap( all );
+         all = both;
+         }
+      ret = bitmap_rows( all, ids, max );
+      for ( long i = 0; i < MIN( ret, max ); i++ ) { ids[i] = ix->ids[ids[i]]; }
+      dump_bitmap( all );
+      }
+   for ( int i = 0; i < made; i++ )
+      {
+      if ( maps[i] ) { dump_bitmap( maps[i] ); }
+      }
+   free( copy );
+   return ret;
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+#define EVCOUNT 400
+#define ROWS 200000
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( "PKR", NULL );
+   ChartConfig* cf = get_chart_config();
+   //
+   TRIAL( "bitmap AND and OR equal those of plain sets",
+      BOUND(
+         char* in_a;
+         in_a = calloc( ROWS, 1 );
+         char* in_b;
+         in_b = calloc( ROWS, 1 );
+         long* rows;
+         rows = malloc( sizeof( long ) * ROWS );
+         Bitmap a = { 0 };
+         Bitmap b = { 0 };
+         // dense and sparse chunks, of each kind against each kind
+         for ( long r = 0; r < ROWS; r++ )
+            {
+            int chunk = r >> 16;
+            in_a[r] = g_test_rand_int_range( 0, 100 ) < ( chunk % 2 ? 90 : 3 );
+            in_b[r] = g_test_rand_int_range( 0, 100 ) < ( chunk / 2 ? 80 : 4 );
+            if ( in_a[r] ) { bitmap_add( &a, r ); }
+            if ( in_b[r] ) { bitmap_add( &b, r ); }
+            }
+         Bitmap* both = and_bitmaps( &a, &b );
+         Bitmap* either = or_bitmaps( &a, &b );
+         long n = bitmap_rows( both, rows, ROWS );
+         long want = 0;
+         for ( long r = 0; r < ROWS; r++ ) { want += in_a[r] && in_b[r]; }
+         ENSURE( n == want );
+         for ( long i = 0; i < n && i < ROWS; i++ ) { AVOID( !( in_a[rows[i]] && in_b[rows[i]] ) ); }
+         n = bitmap_rows( either, rows, ROWS );
+         want = 0;
+         for ( long r = 0; r < ROWS; r++ ) { want += in_a[r] || in_b[r]; }
+         ENSURE( n == want );
+         ENSURE( bitmap_count( either ) == want );
+         for ( long i = 1; i < n && i < ROWS; i++ ) { AVOID( rows[i] <= rows[i-1] ); }
+         for ( long i = 0; i < n && i < ROWS; i++ ) { AVOID( !( in_a[rows[i]] || in_b[rows[i]] ) ); }
+         dump_bitmap( both );
+         dump_bitmap( either );
+         clear_bitmap( &a );
+         clear_bitmap( &b );
+         free( rows );
+         free( in_a );
+         free( in_b );
+         );
+      );
+   Chart* cs[EVCOUNT];
+   for ( int i = 0; i < EVCOUNT; i++ )
+      {
+      double jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      double lat = g_test_rand_double_range( -60.0, 60.0 );
+      double lon = g_test_rand_double_range( -180.0, 180.0 );
+      cs[i] = make_chart( "indexed", jdn, lat, lon );
+      }
+   TRIAL( "query_chart_index() equals a scan of the charts",
+      BOUND(
+         ChartIndex* ix = make_chart_index( cf );
+         for ( int i = 0; i < EVCOUNT; i++ ) { AVOID( index_chart( ix, cs[i], 1000 + i ) != i ); }
+         long ids[EVCOUNT];
+         char query[100];
+         for ( int t = 0; t < 200; t++ )
+            {
+            int sign = g_test_rand_int_range( 0, 12 );
+            int from = g_test_rand_int_range( 0, 30 );
+            int to = g_test_rand_int_range( from + 1, 31 );
+            int elem = g_test_rand_int_range( 0, 4 );
+            int ang = g_test_rand_int_range( 0, 3 );
+            sprintf( query, "Sun %d-%d %s, Moon %s,Mars %s K",
+                     from, to, sign_names[sign], elements[elem], angularities[ang] );
+            if ( t % 2 ) { sprintf( query, "moon %s", sign_abbrs[sign] ); }
+            long n = query_chart_index( ix, query, ids, EVCOUNT );
+            long want = 0;
+            for ( int i = 0; i < EVCOUNT; i++ )
+               {
+               Chart* c = cs[i];
+               int moon = (int) c->points[1].lon / 30;
+               double sun = c->points[0].lon - 30 * sign;
+               int is = moon == sign;
+               if ( t % 2 == 0 )
+                  {
+                  is = sun >= from && sun < to && moon % 4 == elem
+                       && ( house_of( &c->housealt( 1, 1 ), c->points[4].lon ) - 1 ) % 3 == ang;
+                  }
+               if ( !is ) { continue; }
+               AVOID( want < n && ids[want] != 1000 + i );
+               want++;
+               }
+            AVOID( n != want );
+            }
+         ENSURE( -1 == query_chart_index( ix, "Sun", ids, EVCOUNT ) );
+         ENSURE( -1 == query_chart_index( ix, "Sun 10-40 Leo", ids, EVCOUNT ) );
+         ENSURE( -1 == query_chart_index( ix, "Sun Leo, Moon house 10 X", ids, EVCOUNT ) );
+         ENSURE( -1 == query_chart_index( ix, "Vulcan Leo", ids, EVCOUNT ) );
+         ENSURE( EVCOUNT == query_chart_index( ix, "Sun 0-0", ids, EVCOUNT ) );
+         ENSURE( 0 == query_chart_index( ix, "0 fire, 0 earth", ids, 0 ) );
+         ENSURE( -1 == query_chart_index( ix, "Sun 20-10 Leo", ids, EVCOUNT ) );
+         long by_elements = query_chart_index( ix, "0 fire", ids, 0 )
+                            + query_chart_index( ix, " Sun earth ", ids, 0 )
+                            + query_chart_index( ix, "Sun air", ids, 0 )
+                            + query_chart_index( ix, "SUN water", ids, 0 );
+         ENSURE( by_elements == EVCOUNT );
+         dump_chart_index( ix );
+         );
+      );
+   for ( int i = 0; i < EVCOUNT; i++ ) { dump_chart( cs[i] ); }
+   end_swiss_ephemeris();
+END_TESTS
+#endif //TEST
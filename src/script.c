@@ -0,0 +1,694 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file script.c
+ *    runs Lua scripts on charts.
+ *
+ * Charts, points and aspects are seen from Lua as views: userdata that
+ * hold only a pointer into the Chart, and read its numbers as they are
+ * asked for, so no chart is ever copied into tables. In a script:
+ *
+ *    function map( c )            -- c is a Chart view
+ *       local sun = c[1]          -- points by index, as in the config
+ *       if sun.sign == 5 then return c.name .. " " .. sun.lon end
+ *       end
+ *
+ * Charts have name, jdn, lat, lon, #c points, and the methods point(code
+ * or name), aspect(i), aspects(), cusp(n, [sys]) and house(i, [sys]).
+ * Points have lon, lat, dist, speed, code, name, symbol, index and sign,
+ * and aspects have kind, score, diff, symbol, and the views p1 and p2.
+ *
+ * The charts given to a script live only for the call: a view kept past
+ * it raises an error when used, not a crash. Charts made by the script,
+ * with arf.chart() or arf.chart_of(), live as long as their views.
+ *
+ * map_script() runs a function on the charts of many events, each thread
+ * with its own lua_State, all loaded with the same script.
+ **/
+
+#include "arfc.h"
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#define SCRIPT_ARENA 256 // charts between clears of the arena of a thread
+#define CHART_VIEW "arf.Chart"
+#define POINT_VIEW "arf.Point"
+#define ASPECT_VIEW "arf.Aspect"
+
+/** struct ChartView is the userdata of a Chart in Lua */
+typedef struct ChartView
+   {
+   Chart* c; // NULL once a borrowed chart is gone
+   gboolean owned; // dumped by the garbage collector
+   }
+ChartView;
+
+/** struct PartView is the userdata of a Point or an Aspect in Lua, which
+ * keeps the view of its chart alive as its user value */
+typedef struct PartView
+   {
+   ChartView* of;
+   int i; // index in c->points or c->aspects
+   }
+PartView;
+
+//---- VIEWS ---------------------------------------------------------//
+/** push_chart_view() pushes a view of a chart.
+ * @return pointer to the view, to expire it with ->c = NULL.
+ */
+intern
+ChartView*
+push_chart_view( lua_State* L, Chart* c, gboolean owned )
+   {
+   ChartView* v = lua_newuserdata( L, sizeof( ChartView ) );
+   v->c = c;
+   v->owned = owned;
+   luaL_setmetatable( L, CHART_VIEW );
+   return v;
+   }
+
+/** push_part_view() pushes a view of a point or aspect of the chart
+ * whose view is at @p at in the stack.
+ */
+intern
+void
+push_part_view( lua_State* L, int at, int i, const char* kind )
+   {
+   at = lua_absindex( L, at );
+   PartView* p = lua_newuserdata( L, sizeof( PartView ) );
+   p->of = lua_touserdata( L, at );
+   p->i = i;
+   luaL_setmetatable( L, kind );
+   lua_pushvalue( L, at );
+   lua_setuservalue( L, -2 );
+   }
+
+intern
+Chart*
+check_chart( lua_State* L, int at )
+   {
+   ChartView* v = luaL_checkudata( L, at, CHART_VIEW );
+   if ( !v->c ) { luaL_error( L, "chart is gone, keep numbers instead of views" ); }
+   return v->c;
+   }
+
+intern
+Chart*
+check_part( lua_State* L, int at, const char* kind, PartView** p )
+   {
+   *p = luaL_checkudata( L, at, kind );
+   if ( !(*p)->of->c ) { luaL_error( L, "chart is gone, keep numbers instead of views" ); }
+   return (*p)->of->c;
+   }
+
+/** find_point_index() finds a point of a chart by code or name.
+ * @return index in c->points, or -1.
+ */
+intern
+int
+find_point_index( lua_State* L, Chart* c, int at )
+   {
+   if ( lua_type( L, at ) == LUA_TNUMBER )
+      {
+      int code = lua_tointeger( L, at );
+      for_point_i( c ) { if ( c->points[i].code == code ) { return i; } }
+      return -1;
+      }
+   const char* name = luaL_checkstring( L, at );
+   for_point_i( c ) { if ( g_ascii_strcasecmp( c->points[i].name, name ) == 0 ) { return i; } }
+   return -1;
+   }
+
+/** chart:point( code or name ) is the view of a point, or nil. */
+intern
+int
+chart_point( lua_State* L )
+   {
+   Chart* c = check_chart( L, 1 );
+   int i = find_point_index( L, c, 2 );
+   if ( i < 0 ) { lua_pushnil( L ); }
+   else { push_part_view( L, 1, i, POINT_VIEW ); }
+   return 1;
+   }
+
+/** chart:aspect( i ) is the view of the i-th aspect, or nil. */
+intern
+int
+chart_aspect( lua_State* L )
+   {
+   Chart* c = check_chart( L, 1 );
+   lua_Integer i = luaL_checkinteger( L, 2 );
+   if ( i < 1 || i > c->asp_count ) { lua_pushnil( L ); }
+   else { push_part_view( L, 1, i - 1, ASPECT_VIEW ); }
+   return 1;
+   }
+
+/** chart:aspects() is the number of aspects. */
+intern
+int
+chart_aspects( lua_State* L )
+   {
+   lua_pushinteger( L, check_chart( L, 1 )->asp_count );
+   return 1;
+   }
+
+/** chart:cusp( n, [sys] ) is the cusp of house n, by the first house
+ * system or by the one at index sys, or nil if that system failed. */
+intern
+int
+chart_cusp( lua_State* L )
+   {
+   Chart* c = check_chart( L, 1 );
+   lua_Integer n = luaL_checkinteger( L, 2 );
+   lua_Integer s = luaL_optinteger( L, 3, 1 );
+   luaL_argcheck( L, n >= 1 && n <= 12, 2, "houses go from 1 to 12" );
+   if ( s < 1 || s > c->sys_count || c->syscode( s-1 ) == '?' ) { lua_pushnil( L ); }
+   else { lua_pushnumber( L, c->housealt( n, s-1 ) ); }
+   return 1;
+   }
+
+/** chart:house( i, [sys] ) is the house of the i-th point, or nil. */
+intern
+int
+chart_house( lua_State* L )
+   {
+   Chart* c = check_chart( L, 1 );
+   lua_Integer i = luaL_checkinteger( L, 2 );
+   lua_Integer s = luaL_optinteger( L, 3, 1 );
+   int h = 0;
+   if ( i >= 1 && i <= c->pt_count && s >= 1 && s <= c->sys_count
+        && c->syscode( s-1 ) != '?' )
+      {
+      h = house_of( &c->housealt( 1, s-1 ), c->points[i-1].lon );
+      }
+   if ( h ) { lua_pushinteger( L, h ); }
+   else { lua_pushnil( L ); }
+   return 1;
+   }
+
+intern
+int
+chart_index( lua_State* L )
+   {
+   Chart* c = check_chart( L, 1 );
+   if ( lua_type( L, 2 ) == LUA_TNUMBER )
+      {
+      lua_Integer i = lua_tointeger( L, 2 );
+      if ( i < 1 || i > c->pt_count ) { lua_pushnil( L ); }
+      else { push_part_view( L, 1, i - 1, POINT_VIEW ); }
+      return 1;
+      }
+   const char* key = luaL_checkstring( L, 2 );
+   if ( strcmp( key, "name" ) == 0 ) { lua_pushstring( L, c->ev->name ); }
+   else if ( strcmp( key, "jdn" ) == 0 ) { lua_pushnumber( L, c->ev->jdn ); }
+   else if ( strcmp( key, "lat" ) == 0 ) { lua_pushnumber( L, c->ev->lat ); }
+   else if ( strcmp( key, "lon" ) == 0 ) { lua_pushnumber( L, c->ev->lon ); }
+   else if ( luaL_getmetafield( L, 1, key ) == LUA_TNIL ) { lua_pushnil( L ); }
+   return 1;
+   }
+
+intern
+int
+chart_len( lua_State* L )
+   {
+   lua_pushinteger( L, check_chart( L, 1 )->pt_count );
+   return 1;
+   }
+
+intern
+int
+chart_tostring( lua_State* L )
+   {
+   ChartView* v = luaL_checkudata( L, 1, CHART_VIEW );
+   if ( v->c ) { lua_pushfstring( L, "Chart %s %f", v->c->ev->name, v->c->ev->jdn ); }
+   else { lua_pushliteral( L, "Chart (gone)" ); }
+   return 1;
+   }
+
+intern
+int
+chart_gc( lua_State* L )
+   {
+   ChartView* v = luaL_checkudata( L, 1, CHART_VIEW );
+   if ( v->owned && v->c ) { dump_chart( v->c ); }
+   v->c = NULL;
+   return 0;
+   }
+
+intern
+int
+point_index( lua_State* L )
+   {
+   PartView* p;
+   Chart* c = check_part( L, 1, POINT_VIEW, &p );
+   Point* pt = c->points + p->i;
+   const char* key = luaL_checkstring( L, 2 );
+   if ( strcmp( key, "lon" ) == 0 ) { lua_pushnumber( L, pt->lon ); }
+   else if ( strcmp( key, "lat" ) == 0 ) { lua_pushnumber( L, pt->lat ); }
+   else if ( strcmp( key, "dist" ) == 0 ) { lua_pushnumber( L, pt->dist ); }
+   else if ( strcmp( key, "speed" ) == 0 ) { lua_pushnumber( L, pt->speed ); }
+   else if ( strcmp( key, "sign" ) == 0 && !isnan( pt->lon ) )
+      {
+      lua_pushinteger( L, (int) ( pt->lon / 30.0 ) % 12 + 1 );
+      }
+   else if ( strcmp( key, "code" ) == 0 ) { lua_pushinteger( L, pt->code ); }
+   else if ( strcmp( key, "index" ) == 0 ) { lua_pushinteger( L, p->i + 1 ); }
+   else if ( strcmp( key, "name" ) == 0 ) { lua_pushstring( L, pt->name ); }
+   else if ( strcmp( key, "symbol" ) == 0 ) { lua_pushstring( L, pt->symbol ); }
+   else { lua_pushnil( L ); }
+   return 1;
+   }
+
+intern
+int
+point_tostring( lua_State* L )
+   {
+   PartView* p;
+   Chart* c = check_part( L, 1, POINT_VIEW, &p );
+   lua_pushfstring( L, "%s %f", c->points[p->i].name, c->points[p->i].lon );
+   return 1;
+   }
+
+intern
+int
+aspect_index( lua_State* L )
+   {
+   PartView* p;
+   Chart* c = check_part( L, 1, ASPECT_VIEW, &p );
+   Aspect* a = c->aspects + p->i;
+   const char* key = luaL_checkstring( L, 2 );
+   if ( strcmp( key, "kind" ) == 0 ) { lua_pushinteger( L, a->kind ); }
+   else if ( strcmp( key, "score" ) == 0 ) { lua_pushnumber( L, a->score ); }
+   else if ( strcmp( key, "diff" ) == 0 ) { lua_pushnumber( L, a->diff ); }
+   else if ( strcmp( key, "symbol" ) == 0 ) { lua_pushstring( L, a->symbol ); }
+   else if ( strcmp( key, "p1" ) == 0 || strcmp( key, "p2" ) == 0 )
+      {
+      lua_getuservalue( L, 1 ); // the view of the chart
+      push_part_view( L, -1, key[1] == '1' ? a->point1 : a->point2, POINT_VIEW );
+      }
+   else { lua_pushnil( L ); }
+   return 1;
+   }
+
+//---- THE arf MODULE ------------------------------------------------//
+/** arf.chart( jdn, lat, lon, [name] ) makes a chart. */
+intern
+int
+arf_chart( lua_State* L )
+   {
+   double jdn = luaL_checknumber( L, 1 );
+   double lat = luaL_checknumber( L, 2 );
+   double lon = luaL_checknumber( L, 3 );
+   char* name = (char*) luaL_optstring( L, 4, "" );
+   push_chart_view( L, make_chart( name, jdn, lat, lon ), TRUE );
+   return 1;
+   }
+
+/** arf.chart_of( line ) makes the chart of an event, written as for ar,
+ * or is nil if the line is wrong. */
+intern
+int
+arf_chart_of( lua_State* L )
+   {
+   char* line = g_strdup( luaL_checkstring( L, 1 ) );
+   Event* ev = make_event_of_string( line );
+   g_free( line );
+   if ( !ev )
+      {
+      lua_pushnil( L );
+      return 1;
+      }
+   push_chart_view( L, make_chart_of_event( ev ), TRUE );
+   dump_event( ev );
+   return 1;
+   }
+
+/** arf.zodiac( lon ) writes a longitude as degrees of a sign. */
+intern
+int
+arf_zodiac( lua_State* L )
+   {
+   char str[NAME_SIZE * 2] = "";
+   double lon = fmod( luaL_checknumber( L, 1 ), 360.0 );
+   to_zodiac_ascii( str, lon < 0.0 ? lon + 360.0 : lon );
+   lua_pushstring( L, str );
+   return 1;
+   }
+
+intern
+void
+open_arf( lua_State* L )
+   {
+   const luaL_Reg chart_meta[] =
+      {
+         { "__index", chart_index },
+         { "__len", chart_len },
+         { "__tostring", chart_tostring },
+         { "__gc", chart_gc },
+         { "point", chart_point },
+         { "aspect", chart_aspect },
+         { "aspects", chart_aspects },
+         { "cusp", chart_cusp },
+         { "house", chart_house },
+         { NULL, NULL }
+      };
+   const luaL_Reg point_meta[] =
+      {
+         { "__index", point_index },
+         { "__tostring", point_tostring },
+         { NULL, NULL }
+      };
+   const luaL_Reg aspect_meta[] =
+      {
+         { "__index", aspect_index },
+         { NULL, NULL }
+      };
+   const luaL_Reg arf[] =
+      {
+         { "chart", arf_chart },
+         { "chart_of", arf_chart_of },
+         { "zodiac", arf_zodiac },
+         { NULL, NULL }
+      };
+   luaL_newmetatable( L, CHART_VIEW );
+   luaL_setfuncs( L, chart_meta, 0 );
+   luaL_newmetatable( L, POINT_VIEW );
+   luaL_setfuncs( L, point_meta, 0 );
+   luaL_newmetatable( L, ASPECT_VIEW );
+   luaL_setfuncs( L, aspect_meta, 0 );
+   lua_pop( L, 3 );
+   luaL_newlib( L, arf );
+   lua_setglobal( L, "arf" );
+   }
+
+//---- SCRIPTS -------------------------------------------------------//
+/** load_script() loads a Lua script into as many states as threads that
+ * will run it.
+ * @param path Path of the script.
+ * @param fn Name of the global function to call on each chart.
+ * @param threads Number of states, at least 1.
+ *
+ * @return pointer to a Script, that must be dumped, or NULL if the
+ *         script fails to load, or has no such function.
+ */
+extern
+Script*
+load_script( char* path, char* fn, int threads )
+   {
+   Script* s;
+   s = malloc( sizeof( Script ) );
+   s->count = MAX( threads, 1 );
+   s->states = calloc( s->count, sizeof( lua_State* ) );
+   s->fn = strdup( fn );
+   for ( int t = 0; t < s->count; t++ )
+      {
+      lua_State* L = s->states[t] = luaL_newstate();
+      enforce( "make a lua state", L );
+      luaL_openlibs( L );
+      open_arf( L );
+      if ( luaL_dofile( L, path ) != LUA_OK )
+         {
+         fprintf( stderr, "%s\n", lua_tostring( L, -1 ) );
+         dump_script( s );
+         return NULL;
+         }
+      if ( lua_getglobal( L, fn ) != LUA_TFUNCTION )
+         {
+         fprintf( stderr, "%s has no function %s\n", path, fn );
+         dump_script( s );
+         return NULL;
+         }
+      lua_pop( L, 1 );
+      }
+   return s;
+   }
+
+/** dump_script() closes the states of a script and deallocates it.
+ * @param s Pointer to a Script.
+ */
+extern
+void
+dump_script( Script* s )
+   {
+   for ( int t = 0; t < s->count; t++ )
+      {
+      if ( s->states[t] ) { lua_close( s->states[t] ); }
+      }
+   free( s->states );
+   free( s->fn );
+   free( s );
+   }
+
+/** call_to_string() calls the function at 1 on the view at 2, and
+ * turns what it returned into a string, or nil if it was nil or false.
+ * It runs under lua_pcall(), since __tostring of a view may fail.
+ */
+intern
+int
+call_to_string( lua_State* L )
+   {
+   lua_call( L, 1, 1 );
+   if ( !lua_toboolean( L, -1 ) ) { lua_pushnil( L ); }
+   else { luaL_tolstring( L, -1, NULL ); }
+   return 1;
+   }
+
+/** call_on_chart() calls the function of a script on a borrowed chart.
+ * @return what it returned, as a string to be freed, or NULL if it
+ *         returned nil or false, or failed.
+ */
+intern
+char*
+call_on_chart( lua_State* L, char* fn, Chart* c )
+   {
+   char* text = NULL;
+   lua_pushcfunction( L, call_to_string );
+   lua_getglobal( L, fn );
+   ChartView* v = push_chart_view( L, c, FALSE );
+   int failed = lua_pcall( L, 2, 1, 0 );
+   v->c = NULL; // views kept by the script now fail, instead of crashing
+   if ( failed )
+      {
+      fprintf( stderr, "%s: %s\n", c->ev->name, lua_tostring( L, -1 ) );
+      }
+   else if ( lua_isstring( L, -1 ) )
+      {
+      text = strdup( lua_tostring( L, -1 ) );
+      }
+   lua_pop( L, 1 );
+   return text;
+   }
+
+/** run_script() calls the function of a script on one chart, with the
+ * first state of the script.
+ * @param s Pointer to a Script.
+ * @param c Pointer to a Chart, which the script may not keep.
+ *
+ * @return what the function returned, as a string to be freed, or NULL
+ *         if it returned nil or false, or failed.
+ */
+extern
+char*
+run_script( Script* s, Chart* c )
+   {
+   return call_on_chart( s->states[0], s->fn, c );
+   }
+
+/** struct ScriptWork is the share of map_script() of one thread */
+typedef struct ScriptWork
+   {
+   lua_State* L;
+   char* fn;
+   Event* evs;
+   int n;
+   char** texts; // what the function returned for each event
+   }
+ScriptWork;
+
+/** run_share() makes the charts of a share of events, in an arena, and
+ * calls the function of the script on each.
+ */
+intern
+void
+run_share( ScriptWork* w )
+   {
+   ChartConfig* cf = get_chart_config();
+   ChartArena* a = make_chart_arena( 0 );
+   for ( int k = 0; k < w->n; k++ )
+      {
+      if ( k % SCRIPT_ARENA == 0 ) { clear_chart_arena( a ); }
+      Event* ev = w->evs + k;
+      Chart* c = make_chart_in( a, cf, ev->name ? ev->name : "", ev->jdn, ev->lat, ev->lon );
+      w->texts[k] = call_on_chart( w->L, w->fn, c );
+      }
+   dump_chart_arena( a );
+   }
+
+intern
+gpointer
+script_worker( gpointer data )
+   {
+   init_ephemeris_thread();
+   run_share( data );
+   end_ephemeris_thread();
+   return NULL;
+   }
+
+/** map_script() calls the function of a script on the charts of many
+ * events, on as many threads as the script has states, and gives what
+ * it returned for each, in the order of the events.
+ * @param s Pointer to a Script.
+ * @param evs Array of Events.
+ * @param n Number of events.
+ * @param found Called with each event and what the function returned
+ *        for it, if not nil or false.
+ * @param data Passed to @p found.
+ *
+ * @return number of charts the function returned something for.
+ */
+extern
+long
+map_script( Script* s, Event* evs, int n, ScriptResult* found, void* data )
+   {
+   int threads = MAX( 1, MIN( s->count, n / SCRIPT_ARENA + 1 ) );
+   ScriptWork work[threads];
+   GThread* th[threads];
+   char** texts = calloc( MAX( n, 1 ), sizeof( char* ) );
+   for ( int t = 0; t < threads; t++ )
+      {
+      int from = (long) n * t / threads;
+      work[t].L = s->states[t];
+      work[t].fn = s->fn;
+      work[t].evs = evs + from;
+      work[t].n = (long) n * ( t+1 ) / threads - from;
+      work[t].texts = texts + from;
+      if ( t > 0 ) { th[t] = g_thread_new( "script_worker", script_worker, work + t ); }
+      }
+   // the first share runs here, where the ephemeris is set up
+   run_share( work );
+   for ( int t = 1; t < threads; t++ ) { g_thread_join( th[t] ); }
+   long count = 0;
+   for ( int k = 0; k < n; k++ )
+      {
+      if ( !texts[k] ) { continue; }
+      found( evs + k, texts[k], data );
+      free( texts[k] );
+      count++;
+      }
+   free( texts );
+   return count;
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+#define EVCOUNT 600
+#define TEST_SCRIPT \
+   "function sun( c ) return string.format( '%s %.6f', c.name, c[1].lon ) end\n" \
+   "function odd( c ) if c[2].sign % 2 == 1 then return c:point( 'sun' ).sign end end\n" \
+   "function own( c )\n" \
+   "   local o = arf.chart( c.jdn, c.lat, c.lon, 'own' )\n" \
+   "   return o[1].lon == c[1].lon and #o == #c and o:aspects() == c:aspects()\n" \
+   "   end\n" \
+   "function pairs_ok( c )\n" \
+   "   for i = 1, c:aspects() do\n" \
+   "      local a = c:aspect( i )\n" \
+   "      if a.p1.index >= a.p2.index or a.kind < 1 then return 'bad' end\n" \
+   "      end\n" \
+   "   return c:house( 1 ) ~= nil or c:cusp( 1 ) == nil\n" \
+   "   end\n" \
+   "function keep( c ) kept = c[1]; return 1 end\n" \
+   "function late( c ) return kept.lon end\n" \
+   "function first( c ) return c[1] end\n"
+
+intern
+void
+gather( Event* ev, const char* text, void* data )
+   {
+   GPtrArray* got = data;
+   g_ptr_array_add( got, g_strdup( text ) );
+   }
+
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( "PKR", NULL );
+   ChartConfig* cf = get_chart_config();
+   Event evs[EVCOUNT];
+   for ( int i = 0; i < EVCOUNT; i++ )
+      {
+      evs[i].jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      evs[i].lat = g_test_rand_double_range( -60.0, 60.0 );
+      evs[i].lon = g_test_rand_double_range( -180.0, 180.0 );
+      evs[i].name = "script";
+      }
+   char* path = g_build_filename( g_get_tmp_dir(), "arf-test.lua", NULL );
+   g_file_set_contents( path, TEST_SCRIPT, -1, NULL );
+   //
+   TRIAL( "map_script() sees the same charts as C, in order",
+      Script* s = load_script( path, "sun", 3 );
+      ENSURE( s );
+      GPtrArray* got = g_ptr_array_new_with_free_func( g_free );
+      ENSURE( EVCOUNT == map_script( s, evs, EVCOUNT, gather, got ) );
+      char want[NAME_SIZE * 2];
+      for ( int k = 0; k < EVCOUNT; k += 37 )
+         {
+         Chart* c = make_chart_with( cf, "script", evs[k].jdn, evs[k].lat, evs[k].lon );
+         g_snprintf( want, sizeof( want ), "script %.6f", c->points[0].lon );
+         AVOID( strcmp( want, g_ptr_array_index( got, k ) ) );
+         dump_chart( c );
+         }
+      g_ptr_array_free( got, TRUE );
+      dump_script( s );
+      );
+   TRIAL( "views reach points, aspects and houses",
+      Script* odd = load_script( path, "odd", 2 );
+      Script* own = load_script( path, "own", 1 );
+      Script* pairs = load_script( path, "pairs_ok", 2 );
+      GPtrArray* got = g_ptr_array_new_with_free_func( g_free );
+      long found = map_script( odd, evs, EVCOUNT, gather, got );
+      AVOID( found == 0 || found == EVCOUNT );
+      g_ptr_array_set_size( got, 0 );
+      ENSURE( 50 == map_script( own, evs, 50, gather, got ) );
+      AVOID( strcmp( "true", g_ptr_array_index( got, 49 ) ) );
+      g_ptr_array_set_size( got, 0 );
+      ENSURE( EVCOUNT == map_script( pairs, evs, EVCOUNT, gather, got ) );
+      for ( int k = 0; k < EVCOUNT; k++ ) { AVOID( strcmp( "true", g_ptr_array_index( got, k ) ) ); }
+      g_ptr_array_free( got, TRUE );
+      dump_script( odd );
+      dump_script( own );
+      dump_script( pairs );
+      );
+   TRIAL( "views kept past the call fail, but do not crash",
+      Script* keep = load_script( path, "keep", 1 );
+      Chart* c = make_chart_with( cf, "kept", evs[0].jdn, evs[0].lat, evs[0].lon );
+      char* text = run_script( keep, c );
+      ENSURE( text );
+      free( text );
+      // the same state, with another function
+      free( keep->fn );
+      keep->fn = strdup( "late" );
+      ENSURE( NULL == run_script( keep, c ) );
+      free( keep->fn );
+      keep->fn = strdup( "sun" );
+      text = run_script( keep, c );
+      ENSURE( text );
+      free( text );
+      // a view returned is made a string before it expires
+      free( keep->fn );
+      keep->fn = strdup( "first" );
+      text = run_script( keep, c );
+      ENSURE( text );
+      AVOID( strncmp( text, c->points[0].name, strlen( c->points[0].name ) ) );
+      free( text );
+      dump_chart( c );
+      dump_script( keep );
+      ENSURE( NULL == load_script( path, "none", 1 ) );
+      );
+   remove( path );
+   g_free( path );
+   end_swiss_ephemeris();
+END_TESTS
+#endif
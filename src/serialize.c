@@ -3,13 +3,197 @@
  * (by) Marcio Baraco <marciorps@gmail.com>
  */
 /** @file serialize.c
- * Allocates and fills long char-arrays (strings) representing Chart
- * data. */
+ * Writes text representing Chart data, to a Sink or to long
+ * char-arrays (strings) it allocates. */
 
 #include "arfc.h"
+#include <stdarg.h>
+
+//---- SINKS ---------------------------------------------------------//
+//-- Serializers write to a Sink, which can be a FILE, a buffer that
+//-- grows as needed, or a callback. The make_* functions are put_* to a
+//-- buffer, so there is only one version of each format.
+#define SINK_FIRST_SIZE 256
+#define SINK_SMALL 256
+
+/** sink_of_file() makes a Sink that writes to a FILE.
+ * @param f An open FILE*.
+ */
+extern
+Sink
+sink_of_file( FILE* f )
+   {
+   return ( Sink ) { .file = f };
+   }
+
+/** sink_of_buffer() makes a Sink that writes to a buffer, which grows as
+ * needed and is always a string.
+ *
+ * @return a Sink, whose @a buf must be freed.
+ */
+extern
+Sink
+sink_of_buffer()
+   {
+   Sink s = { .size = SINK_FIRST_SIZE };
+   s.buf = malloc( s.size );
+   enforce( "allocate sink buffer", s.buf );
+   s.buf[0] = '\0';
+   return s;
+   }
+
+/** sink_of_callback() makes a Sink that hands each piece of text to a
+ * function, which must not keep the pointer.
+ * @param write Function called with each piece of text and its length.
+ * @param data Passed to @p write as is.
+ */
+extern
+Sink
+sink_of_callback( SinkWriter* write, void* data )
+   {
+   return ( Sink ) { .write = write, .data = data };
+   }
+
+/** sink_room() makes the buffer of a Sink fit @p more bytes and a '\0'. */
+intern
+void
+sink_room( Sink* s, size_t more )
+   {
+   if ( s->len + more < s->size ) { return; }
+   while ( s->len + more >= s->size ) { s->size *= 2; }
+   s->buf = realloc( s->buf, s->size );
+   enforce( "grow sink buffer", s->buf );
+   }
+
+/** sink_put() writes @p len bytes of @p str to a Sink. */
+extern
+void
+sink_put( Sink* s, const char* str, size_t len )
+   {
+   if ( s->file ) { fwrite( str, 1, len, s->file ); }
+   else if ( s->write ) { s->write( str, len, s->data ); }
+   else
+      {
+      sink_room( s, len );
+      memcpy( s->buf + s->len, str, len );
+      s->len += len;
+      s->buf[s->len] = '\0';
+      }
+   }
+
+/** sink_printf() writes to a Sink as printf() would. */
+extern
+void
+sink_printf( Sink* s, const char* fmt, ... )
+   {
+   va_list ap;
+   va_list again;
+   va_start( ap, fmt );
+   va_copy( again, ap );
+   if ( s->file ) { vfprintf( s->file, fmt, ap ); }
+   else if ( s->write )
+      {
+      char small[SINK_SMALL];
+      int n = vsnprintf( small, SINK_SMALL, fmt, ap );
+      if ( n < SINK_SMALL ) { s->write( small, n, s->data ); }
+      else
+         {
+         char big[n+1];
+         vsnprintf( big, n+1, fmt, again );
+         s->write( big, n, s->data );
+         }
+      }
+   else
+      {
+      size_t room = s->size - s->len;
+      int n = vsnprintf( s->buf + s->len, room, fmt, ap );
+      if ( (size_t) n >= room )
+         {
+         sink_room( s, n );
+         vsnprintf( s->buf + s->len, n+1, fmt, again );
+         }
+      s->len += n;
+      }
+   va_end( again );
+   va_end( ap );
+   }
+
+//---- CSV LIST ------------------------------------------------------//
+/** alt_house() makes house @p n of the systems after the first three
+ * into a Point of up to 4 systems, as charts used to keep them after
+ * the first 12 cusps: block 1 has systems 4 to 7, block 2 systems 8 to
+ * 11, and so on.
+ * @param c Pointer to a Chart.
+ * @param block From 1 to sys_count/4.
+ * @param n House number, from 1 to 12.
+ */
+intern
+Point
+alt_house( Chart* c, int block, int n )
+   {
+   Point p = { .code = -n };
+   to_roman( p.name, n );
+   for ( int k = 0; k < 4 && 4*block-1+k < c->sys_count; k++ )
+      {
+      p.data[k] = c->housealt( n, 4*block-1+k );
+      p.symbol[k] = c->syscode( 4*block-1+k );
+      }
+   return p;
+   }
+
+/** listed_point() is Point @p k of those that lists show, in the order
+ * charts used to keep them: the blocks of extra house systems, last
+ * first, then the 12 houses and the points, 12*(sys_count/4) + 12 +
+ * pt_count in all.
+ * @param alt Where to make the Point, if it is of an extra block.
+ */
+intern
+Point*
+listed_point( Chart* c, int k, Point* alt )
+   {
+   int extra = 12 * ( c->sys_count/4 );
+   if ( k >= extra ) { return c->cusps + k - extra; }
+   *alt = alt_house( c, c->sys_count/4 - k/12, 12 - k%12 );
+   return alt;
+   }
+
+/** put_csv_list() writes all the information from a chart, one line
+ *     per point and cusp.
+ * @param s Pointer to a Sink.
+ * @param c a chart from where to take information
+ */
+extern
+void
+put_csv_list( Sink* s, Chart* c )
+   {
+   char zod[NAME_SIZE];
+   Point alt;
+   int count = 12 * ( c->sys_count/4 ) + c->cp_count + c->pt_count;
+   for ( int i = 0; i < count; i++ )
+      {
+      Point* el = listed_point( c, i, &alt );
+      zod[0] = '\0'; // stays empty if lon is NAN
+      to_zodiac_ascii( zod, el->lon );
+      sink_printf( s,
+                   "%4d, #%02hhX%02hhX%02hhX%02hhX, %s, %.5f, %.5f, %.5f, %s\n",
+                   el->code,
+                   el->symbol[0],
+                   el->symbol[1],
+                   el->symbol[2],
+                   el->symbol[3],
+                   zod,
+                   //", %+g, %+g, %+g",
+                   //", %+.4e, %+.4e, %+.4e",
+                   el->lat,
+                   el->dist,
+                   el->speed,
+                   ///@todo ???print char symbol[SYMB_SIZE];???
+                   el->name );
+      }
+   }
 
 /** make_csv_list() allocates a string with all the information from
- *     a chart.
+ *     a chart, as put_csv_list().
  * @param a chart from where to take information
  *
  * @return a pointer to a string (char array) that must be freed
@@ -17,43 +201,47 @@
 char*
 make_csv_list( Chart* c )
    {
-   // allocate large string
-   int linelen = 75;
-   int ptlen   = c->pt_count + c->cp_count;
-   char* rets = malloc( ptlen * linelen );
-   char* sp = rets;
-   // fill it with values from Chart *c
-   Point* el = (Point*) c->cusps;
-   for ( int i = 0; i < (c->pt_count+c->cp_count) ; i++ )
+   Sink s = sink_of_buffer();
+   put_csv_list( &s, c );
+   return s.buf;
+   }
+
+//---- C LITERAL -----------------------------------------------------//
+/** put_c_literal() writes a c literal representation of chart data.
+ * @param s Pointer to a Sink.
+ * @param c: Pointer to a Chart structure.
+ */
+extern
+void
+put_c_literal( Sink* s, Chart* c )
+   {
+   Point alt;
+   int count = 12 * ( c->sys_count/4 ) + c->cp_count + c->pt_count;
+   sink_printf( s, "Point ps[] =\n{\n\t{\n" );
+   for ( int i = 0; i<count; )
       {
-      sp += sprintf( sp, "%4d", el[i].code );
-      sp += sprintf( sp,
-                     ", #%02hhX%02hhX%02hhX%02hhX, ",
-                     el[i].symbol[0],
-                     el[i].symbol[1],
-                     el[i].symbol[2],
-                     el[i].symbol[3] );
-      sp += to_zodiac_ascii( sp, el[i].lon );
-      //-- (to avoid full lon precision) sp -= 4;
-      sp += sprintf( sp,
-                     ", %.5f, %.5f, %.5f",
-                     //", %+g, %+g, %+g",
-                     //", %+.4e, %+.4e, %+.4e",
-                     el[i].lat,
-                     el[i].dist,
-                     el[i].speed );
-      ///@todo ???print char symbol[SYMB_SIZE];???
-      sp += sprintf( sp, ", %s\n", el[i].name );
+      Point* el = listed_point( c, i, &alt );
+      sink_printf( s, "\t.data = {%8.8f,%8.8f,%8.8f,%8.8f},\n",
+               el->data[0],
+               el->data[1],
+               el->data[2],
+               el->data[3] );
+      sink_printf( s, "\t.code = %i,", el->code );
+      sink_printf( s, ".symbol = {%hhu,%hhu,%hhu,%hhu},",
+               el->symbol[0],
+               el->symbol[1],
+               el->symbol[2],
+               el->symbol[3] );
+      sink_printf( s, ".name = \"%s\"\n", el->name );
+      i++;
+      if ( i == count ) { sink_printf( s, "\t}\n" ); }
+      else { sink_printf( s, "\t}, {\n" ); }
       }
-   // realloc to final size (ie free rest)
-   char* tmp = realloc( rets, sp - rets + 1 );
-   enforce( "reallocate memory", tmp == rets );
-   // return pointer to free-able string
-   return rets;
+   sink_printf( s, "};\n" );
    }
 
 /** make_c_lieral() allocates a string with a c literal representation
- *    of chart data.
+ *    of chart data, as put_c_literal().
  * @param c: Pointer to a Chart structure.
  *
  * @return pointer to a char-array that must be freed.
@@ -61,229 +249,447 @@ make_csv_list( Chart* c )
 char*
 make_c_literal( Chart* c )
    {
-   // allocate large string
-   int linelen = 200;
-   int count = c->pt_count + c->cp_count;
-   char* rets = calloc( sizeof(char), linelen * count );
-   char* sp = rets;
-   // fill it with values from Chart *c
-   sp += sprintf( sp, "Point ps[] =\n{\n\t{\n" );
-   for ( int i = 0; i<count; )
-      {
-      sp += sprintf( sp, "\t.data = {%8.8f,%8.8f,%8.8f,%8.8f},\n",
-               c->cusps[i].data[0],
-               c->cusps[i].data[1],
-               c->cusps[i].data[2],
-               c->cusps[i].data[3] );
-      sp += sprintf( sp, "\t.code = %i,", c->cusps[i].code );
-      sp += sprintf( sp, ".symbol = {%hhu,%hhu,%hhu,%hhu},",
-               c->cusps[i].symbol[0],
-               c->cusps[i].symbol[1],
-               c->cusps[i].symbol[2],
-               c->cusps[i].symbol[3] );
-      sp += sprintf( sp, ".name = \"%s\"\n", c->cusps[i].name );
-      i++;
-      if ( i == count ) { sp += sprintf( sp, "\t}\n" ); }
-      else { sp += sprintf( sp, "\t}, {\n" ); }
-      }
-   sp += sprintf( sp, "};\n" );
-   sp += 4;
-   // realloc to final size (ie free rest)
-   enforce( "allocation was wide enoug", (sp-rets+1)<(linelen*count) );
-   char* tmp = realloc( rets, sp - rets + 1 );
-   enforce( "reallocate memory", tmp == rets );
-   // return pointer to free-able string
-   return rets;
+   Sink s = sink_of_buffer();
+   put_c_literal( &s, c );
+   return s.buf;
    }
 
-/** make_point_table() allocates a string with data about chart points.
- * @param c: Pointer to a Chart structure.
+//---- POINT TABLE ---------------------------------------------------//
+//-- A format like "|$N|$Z|" is compiled once by make_point_format()
+//-- into columns, so a table for many charts does not parse it again.
+//-- The widths of the columns that depend on the data are either fixed
+//-- when compiled, or measured in one pass over the points of a chart,
+//-- for the columns the format uses only.
+
+/** the measures a column width can depend on */
+enum { BY_NAME, BY_CODE, BY_LON, BY_LAT, BY_SPEED, BY_DIST, BY_SYMB, BY_NONE };
+
+/** struct PointField is what each $ letter of a format shows */
+typedef struct PointField
+   {
+   char key;
+   char* title;
+   int by; // measure the width comes from...
+   int width; // ...plus this, or this for BY_NONE
+   int hidden; // bytes that take no room on screen (UTF-8)
+   int decimals;
+   }
+PointField;
+
+intern
+const PointField point_fields[] =
+   {
+      { 'N', "Planet    ", BY_NAME,   0, 0, 0 },
+      { 'C', "SEph      ", BY_CODE,   0, 0, 0 },
+      { 'O', "Sky longit", BY_LON,    0, 0, 3 },
+      { 'o', "Sky longit", BY_LON,   -2, 0, 1 },
+      { 'L', "Sky latitu", BY_LAT,    0, 0, 3 },
+      { 'l', "Sky latitu", BY_LAT,   -2, 0, 1 },
+      { 'S', "Speed long", BY_SPEED,  0, 0, 3 },
+      { 's', "Speed long", BY_SPEED, -2, 0, 1 },
+      { 'D', "Distance  ", BY_DIST,   0, 0, 3 },
+      { 'd', "Distance  ", BY_DIST,  -2, 0, 1 },
+      { 'Z', "Zodiac pos", BY_NONE,  10, 0, 0 },
+      { 'z', "Zodiac pos", BY_NONE,   6, 0, 0 },
+      { 'U', "Zodiac pos", BY_NONE,  11, 1, 0 },
+      { 'u', "Zodiac pos", BY_NONE,   7, 1, 0 },
+      { 'Y', "Symbol    ", BY_SYMB,   0, 2, 0 },
+      { 0 }
+   };
+
+// widths used by make_point_format( fmt, TRUE ), for any chart
+intern
+const int fixed_widths[BY_NONE] = { 10, 6, 7, 7, 7, 8, 3 };
+
+/** struct PointColumn is a $ field or a run of text of a PointFormat */
+struct PointColumn
+   {
+   const PointField* field; // NULL for text
+   const char* text;
+   int len;
+   };
+
+/** fixed3_width() is the length of "%.3f" of @p x, without printing it */
+intern
+int
+fixed3_width( double x )
+   {
+   if ( !isfinite( x ) ) { return signbit( x ) ? 4 : 3; }
+   int w = signbit( x ) ? 6 : 5; // sign, a digit, the point and 3 more
+   double v = fabs( x );
+   double p = 10.0;
+   for ( ; v >= p && p < 1e15; p *= 10.0 ) { w++; }
+   // just below a power of ten rounding may carry into one more digit,
+   // and past 1e15 powers of ten are not exact, so the printer decides
+   if ( p - v < 0.001 ) { return snprintf( NULL, 0, "%.3f", x ); }
+   return w;
+   }
+
+/** make_point_format() compiles a format for put_point_table_with().
+ * @param fmt The columns, as text and $ and a letter:
+ *        N name, C code, O o longitude, L l latitude, S s speed,
+ *        D d distance, Z z zodiac position, U u the same in UTF-8,
+ *        Y symbol; lowercase letters have fewer decimals.
+ * @param fixed If TRUE, the columns have the same width for all
+ *        charts, else widths fit the points of each chart.
  *
- * @return pointer to a char-array that must be freed.
+ * @return pointer to a PointFormat, that must be dumped.
  */
-char* make_point_table( Chart* c, char* fmt )
+extern
+PointFormat*
+make_point_format( char* fmt, gboolean fixed )
    {
-   // this X_MACRO is the basic API for this func
-   #define X_VARS \
-   X('N',"Planet    ","%-*s", 0,namesz, each->name, ) \
-   X('C',"SEph      ","%*i",  0,codesz, each->code, ) \
-   X('O',"Sky longit","%*.3f",0,lonsz,  each->lon, ) \
-   X('o',"Sky longit","%*.1f",0,lonsz-2,each->lon, ) \
-   X('L',"Sky latitu","%*.3f",0,latsz,  each->lat, ) \
-   X('l',"Sky latitu","%*.1f",0,latsz-2,each->lat, ) \
-   X('S',"Speed long","%*.3f",0,spdsz,  each->speed, ) \
-   X('s',"Speed long","%*.1f",0,spdsz-2,each->speed, ) \
-   X('D',"Distance  ","%*.3f",0,distsz,  each->dist, ) \
-   X('d',"Distance  ","%*.1f",0,distsz-2,each->dist, ) \
-   X('Z',"Zodiac pos","%.*s", 0,10, buff, to_zodiac_ascii( buff, each->lon ) ) \
-   X('z',"Zodiac pos","%.*s", 0,6,  buff, to_zodiac_ascii( buff, each->lon ) ) \
-   X('U',"Zodiac pos","%.*s", 1,11, buff, to_zodiac_utf( buff, each->lon ) ) \
-   X('u',"Zodiac pos","%.*s", 1,7,  buff, to_zodiac_utf( buff, each->lon ) ) \
-   X('Y',"Symbol    ","%-*s", 2,symbsz, buff, snprintf(buff,4,"%s",each->symbol) )
-   //(A, T, B,      H,C,  D,    E )
-   // find out field sizes
-   char buff[NAME_MAX];
-   int i,l;
-   char* sp;
-   int latsz = 0;
-   int lonsz = 0;
-   int namesz = 0;
-   int codesz = 0;
-   int spdsz = 0;
-   int distsz = 0;
-   int symbsz = 0;
-   for_each_point( c )
+   int n = strlen( fmt );
+   PointFormat* pf;
+   // one block: the format, its columns, then a copy of the text
+   pf = malloc( sizeof( PointFormat ) + sizeof( struct PointColumn ) * n + n + 1 );
+   enforce( "allocate point format", pf );
+   pf->cols = (struct PointColumn*) ( pf + 1 );
+   char* text = (char*) ( pf->cols + n );
+   memcpy( text, fmt, n + 1 );
+   pf->count = 0;
+   pf->fixed = fixed;
+   pf->uses = 0;
+   for ( int i = 0; i < n; )
       {
-      int temp;
-      #define SZ(var,exp) temp=(exp);var=var>temp?var:temp;
-      SZ( namesz, strlen( each->name ) );
-      SZ( codesz, sprintf( buff, "%i", each->code ) );
-      SZ( latsz, sprintf( buff, "%.3f", each->lat ) );
-      SZ( lonsz, sprintf( buff, "%.3f", each->lon ) );
-      SZ( spdsz, sprintf( buff, "%.3f", each->speed ) );
-      SZ( distsz, sprintf( buff, "%.3f", each->dist ) );
-      SZ( symbsz, sprintf( buff, "%s", each->symbol ) );
-      #undef SZ
-      }
-   // find out line length
-   int len = 0;
-   for( i = 0; fmt[i]; i++ )
-      {
-      if( fmt[i]=='$' )
+      struct PointColumn* col = pf->cols + pf->count;
+      if ( text[i] == '$' )
          {
-         i++;
-         #define X(A,T,B,H,C,D,E) case A: len += C; break;
-         switch( fmt[i] )
-            {
-            X_VARS
-            }
-         #undef X
+         const PointField* f = point_fields;
+         while ( f->key && f->key != text[i+1] ) { f++; }
+         i += text[i+1] ? 2 : 1;
+         if ( !f->key ) { continue; } // unknown letters show nothing
+         *col = ( struct PointColumn ) { f, NULL, 0 };
+         pf->uses |= 1 << f->by;
          }
-      else { len++; }
-      }
-   // synth a separator
-   char* separator = malloc( len+1 );
-   sp = separator;
-   for( i = 0; fmt[i]; i++ )
-      {
-      if( fmt[i]=='$' )
+      else
          {
-         i++;
-         #define X(A,T,B,H,C,D,E) case A: for(l=H;l<C;l++) *sp++='-'; break;
-         switch( fmt[i] )
-            {
-            X_VARS
-            }
-         #undef X
+         int len = strcspn( text + i, "$" );
+         *col = ( struct PointColumn ) { NULL, text + i, len };
+         i += len;
          }
-      else
-      if ( fmt[i]=='|' )
-         { *sp++ = '+'; }
-      else
-         { *sp++ = '-'; }
+      pf->count++;
       }
-   //*sp++ = '\0';
-   sp[len] = '\0';
-   // allocate large string
-   int totalsz = (len+10) * (c->pt_count+4);
-   char* rets = calloc( sizeof(char), totalsz );
-   sp = rets;
-   // fill header
-   sp += sprintf( sp, "%s\n", separator );
-   for( i = 0; fmt[i]; i++ )
+   for ( int m = 0; m < BY_NONE; m++ ) { pf->widths[m] = fixed ? fixed_widths[m] : 0; }
+   return pf;
+   }
+
+/** dump_point_format() deallocates a PointFormat.
+ * @param pf Pointer to a PointFormat.
+ */
+extern
+void
+dump_point_format( PointFormat* pf )
+   {
+   free( pf );
+   }
+
+intern
+int
+column_width( const PointField* f, int* widths )
+   {
+   return f->by == BY_NONE ? f->width : widths[f->by] + f->width;
+   }
+
+/** put_separator() writes a line like +-----+--+ under a format. */
+intern
+void
+put_separator( Sink* s, PointFormat* pf, int* widths )
+   {
+   char dashes[64];
+   memset( dashes, '-', sizeof( dashes ) );
+   for ( int k = 0; k < pf->count; k++ )
       {
-      if( fmt[i]=='$' )
+      struct PointColumn* col = pf->cols + k;
+      if ( col->field )
          {
-         i++;
-         #define X(A,T,B,H,C,D,E) case A: sp+=sprintf(sp,"%*.*s",C-H,C-H,T); break;
-         switch( fmt[i] )
+         int len = column_width( col->field, widths ) - col->field->hidden;
+         for ( ; len > 0; len -= sizeof( dashes ) )
             {
-            X_VARS
+            sink_put( s, dashes, MIN( len, (int) sizeof( dashes ) ) );
             }
-         #undef X
+         continue;
          }
-      else
-         { *sp++ = fmt[i]; }
+      for ( int i = 0; i < col->len; i++ )
+         {
+         sink_put( s, col->text[i] == '|' ? "+" : "-", 1 );
+         }
+      }
+   }
+
+/** put_point_table_with() writes a table with data about chart points,
+ * in a compiled format.
+ * @param s Pointer to a Sink.
+ * @param c Pointer to a Chart structure.
+ * @param pf Pointer to a PointFormat from make_point_format().
+ */
+extern
+void
+put_point_table_with( Sink* s, Chart* c, PointFormat* pf )
+   {
+   char buff[NAME_MAX];
+   int widths[BY_NONE];
+   memcpy( widths, pf->widths, sizeof( widths ) );
+   // one pass over the points, for the widths this format needs
+   for_each_point( c )
+      {
+      if ( pf->fixed ) { break; }
+      #define SZ(by,exp) \
+         if ( pf->uses & 1 << (by) ) { widths[by] = MAX( widths[by], (int) (exp) ); }
+      SZ( BY_NAME, strlen( each->name ) );
+      SZ( BY_CODE, snprintf( NULL, 0, "%i", each->code ) );
+      SZ( BY_LON, fixed3_width( each->lon ) );
+      SZ( BY_LAT, fixed3_width( each->lat ) );
+      SZ( BY_SPEED, fixed3_width( each->speed ) );
+      SZ( BY_DIST, fixed3_width( each->dist ) );
+      SZ( BY_SYMB, strnlen( each->symbol, SYMB_SIZE ) );
+      #undef SZ
+      }
+   // header
+   put_separator( s, pf, widths );
+   sink_put( s, "\n", 1 );
+   for ( int k = 0; k < pf->count; k++ )
+      {
+      struct PointColumn* col = pf->cols + k;
+      if ( !col->field ) { sink_put( s, col->text, col->len ); continue; }
+      int w = column_width( col->field, widths ) - col->field->hidden;
+      sink_printf( s, "%*.*s", w, w, col->field->title );
       }
-   sp += sprintf( sp, "\n%s\n", separator );
-   // fill it with values from Chart *c
+   sink_put( s, "\n", 1 );
+   put_separator( s, pf, widths );
+   sink_put( s, "\n", 1 );
+   // values from Chart *c
    for_each_point( c )
       {
-      for( i = 0; fmt[i]; i++ )
+      for ( int k = 0; k < pf->count; k++ )
          {
-         if( fmt[i]=='$' )
+         struct PointColumn* col = pf->cols + k;
+         if ( !col->field ) { sink_put( s, col->text, col->len ); continue; }
+         int w = column_width( col->field, widths );
+         int dec = col->field->decimals;
+         switch ( col->field->key )
             {
-            i++;
-            #define X(A,T,B,H,C,D,E) case A: E; sp+=sprintf(sp,B,C,D); break;
-            switch( fmt[i] )
-               {
-               default: break;
-               X_VARS
-               }
-            #undef X
-            }
-         else
-            {
-            *sp++ = fmt[i];
+            case 'N': sink_printf( s, "%-*s", w, each->name ); break;
+            case 'C': sink_printf( s, "%*i", w, each->code ); break;
+            case 'O': case 'o': sink_printf( s, "%*.*f", w, dec, each->lon ); break;
+            case 'L': case 'l': sink_printf( s, "%*.*f", w, dec, each->lat ); break;
+            case 'S': case 's': sink_printf( s, "%*.*f", w, dec, each->speed ); break;
+            case 'D': case 'd': sink_printf( s, "%*.*f", w, dec, each->dist ); break;
+            case 'Z': case 'z':
+               buff[0] = '\0';
+               to_zodiac_ascii( buff, each->lon );
+               sink_printf( s, "%.*s", w, buff );
+               break;
+            case 'U': case 'u':
+               buff[0] = '\0';
+               to_zodiac_utf( buff, each->lon );
+               sink_printf( s, "%.*s", w, buff );
+               break;
+            case 'Y':
+               snprintf( buff, SYMB_SIZE, "%s", each->symbol );
+               sink_printf( s, "%-*s", w, buff );
+               break;
             }
          }
-      sp += sprintf( sp, "\n" );
+      sink_put( s, "\n", 1 );
       }
-   sp += sprintf( sp, "%s", separator );
-   // realloc to final size (ie free rest)
-   enforce( "allocation was wide enoug", (sp-rets+1)<(totalsz) );
-   char* tmp = realloc( rets, sp - rets + 1 );
-   enforce( "reallocate memory", tmp == rets );
-   free( separator );
-   // return pointer to free-able string
-   return rets;
-   #undef X_VARS
+   put_separator( s, pf, widths );
+   }
+
+/** put_point_table() writes a table with data about chart points.
+ * To write many tables in the same format, use put_point_table_with().
+ * @param s Pointer to a Sink.
+ * @param c: Pointer to a Chart structure.
+ * @param fmt The columns, as in make_point_format().
+ */
+extern
+void
+put_point_table( Sink* s, Chart* c, char* fmt )
+   {
+   PointFormat* pf = make_point_format( fmt, FALSE );
+   put_point_table_with( s, c, pf );
+   dump_point_format( pf );
    }
 
-/** make_house_table() allocates a string with data about house cusps.
+/** make_point_table() allocates a string with data about chart points,
+ * as put_point_table().
  * @param c: Pointer to a Chart structure.
  *
  * @return pointer to a char-array that must be freed.
  */
-char* make_house_table( Chart* c )
+char* make_point_table( Chart* c, char* fmt )
    {
-   #define SPACER() sp += sprintf( sp, "+-------" ); \
-      for( int s = 0; c->sys_count>s; s++ ) \
-         { sp += sprintf( sp, "+----------" ); } \
-      sp += sprintf( sp, "+\n" );
+   Sink s = sink_of_buffer();
+   put_point_table( &s, c, fmt );
+   return s.buf;
+   }
+
+//---- HOUSE TABLE ---------------------------------------------------//
+/** put_house_table() writes a table with data about house cusps.
+ * @param s Pointer to a Sink.
+ * @param c: Pointer to a Chart structure.
+ */
+extern
+void
+put_house_table( Sink* s, Chart* c )
+   {
+   #define SPACER() sink_printf( s, "+-------" ); \
+      for( int y = 0; c->sys_count>y; y++ ) \
+         { sink_printf( s, "+----------" ); } \
+      sink_printf( s, "+\n" );
    char buf[NAME_SIZE];
-   char* rets = malloc( (12 + 12*c->sys_count) * 16 );
-   char* sp = rets;
    SPACER();
-   sp += sprintf( sp, "| house |");
-   for( int s = 0; c->sys_count>s; s++ )
+   sink_printf( s, "| house |");
+   for( int y = 0; c->sys_count>y; y++ )
       {
-      sp += sprintf( sp, " %-8.8s |", swe_house_name( c->syscode(s) ) );
+      sink_printf( s, " %-8.8s |", swe_house_name( c->syscode(y) ) );
       }
-   sp += sprintf( sp, "\n");
+   sink_printf( s, "\n");
    SPACER();
    for( int i = 1; i<= 12; i++ )
       {
       to_roman( buf, i );
-      sp += sprintf( sp, "| %-5s |", buf );
-      for( int s = 0; c->sys_count>s; s ++ )
+      sink_printf( s, "| %-5s |", buf );
+      for( int y = 0; c->sys_count>y; y ++ )
          {
-         //to_zodiac_utf( buf, c->housealt(i,s) );
-         to_zodiac_ascii( buf, c->housealt(i,s) );
-         sp += sprintf( sp, " %.8s |", buf );
+         //to_zodiac_utf( buf, c->housealt(i,y) );
+         to_zodiac_ascii( buf, c->housealt(i,y) );
+         sink_printf( s, " %.8s |", buf );
          }
-      sp += sprintf( sp, "\n" );
+      sink_printf( s, "\n" );
       }
    SPACER();
-   //--printf("strlen = %li; calc = %i\n", strlen( rets ), (12 + 12*syscount) * 16 );
-   // realloc to final size (ie free rest)
-   char* tmp = realloc( rets, sp - rets + 1 );
-   enforce( "reallocate memory", tmp == rets );
-   // return pointer to free-able string
-   return rets;
    #undef SPACER
    }
 
+/** make_house_table() allocates a string with data about house cusps,
+ * as put_house_table().
+ * @param c: Pointer to a Chart structure.
+ *
+ * @return pointer to a char-array that must be freed.
+ */
+char* make_house_table( Chart* c )
+   {
+   Sink s = sink_of_buffer();
+   put_house_table( &s, c );
+   return s.buf;
+   }
+
+//---- JSON ----------------------------------------------------------//
+/** put_json_number() writes the shortest text that reads back as the
+ * same double, or null for NAN and infinities, which JSON lacks. */
+intern
+void
+put_json_number( Sink* s, double x )
+   {
+   char buf[32];
+   if ( !isfinite( x ) ) { sink_put( s, "null", 4 ); return; }
+   int len = 0;
+   for ( int digits = 15; digits <= 17; digits++ )
+      {
+      len = snprintf( buf, sizeof( buf ), "%.*g", digits, x );
+      if ( strtod( buf, NULL ) == x ) { break; }
+      }
+   sink_put( s, buf, len );
+   }
+
+/** put_json_float() is put_json_number() for a float. */
+intern
+void
+put_json_float( Sink* s, float x )
+   {
+   char buf[32];
+   if ( !isfinite( x ) ) { sink_put( s, "null", 4 ); return; }
+   int len = 0;
+   for ( int digits = 6; digits <= 9; digits++ )
+      {
+      len = snprintf( buf, sizeof( buf ), "%.*g", digits, x );
+      if ( strtof( buf, NULL ) == x ) { break; }
+      }
+   sink_put( s, buf, len );
+   }
+
+/** put_json_string() writes a string with JSON quotes and escapes. */
+intern
+void
+put_json_string( Sink* s, const char* str )
+   {
+   sink_put( s, "\"", 1 );
+   const char* run = str;
+   for ( ; *str; str++ )
+      {
+      unsigned char ch = *str;
+      if ( ch >= 0x20 && ch != '"' && ch != '\\' ) { continue; }
+      sink_put( s, run, str - run );
+      if ( ch == '"' || ch == '\\' ) { sink_printf( s, "\\%c", ch ); }
+      else { sink_printf( s, "\\u%04x", ch ); }
+      run = str + 1;
+      }
+   sink_put( s, run, str - run );
+   sink_put( s, "\"", 1 );
+   }
+
+/** put_json() writes a chart as one line of JSON: the event, the
+ * points, the cusps of every house system and the aspects. Houses are
+ * keyed by the letters of the config, and a system that failed for the
+ * chart has null for its cusps.
+ * @param s Pointer to a Sink.
+ * @param c: Pointer to a Chart structure.
+ * @param cf: Pointer to the ChartConfig the chart was made with.
+ */
+extern
+void
+put_json( Sink* s, Chart* c, ChartConfig* cf )
+   {
+   sink_put( s, "{\"name\":", 8 );
+   put_json_string( s, c->ev->name ? c->ev->name : "" );
+   sink_put( s, ",\"jdn\":", 7 );
+   put_json_number( s, c->ev->jdn );
+   sink_put( s, ",\"lat\":", 7 );
+   put_json_number( s, c->ev->lat );
+   sink_put( s, ",\"lon\":", 7 );
+   put_json_number( s, c->ev->lon );
+   sink_put( s, ",\"points\":[", 11 );
+   for_point_i( c )
+      {
+      Point* p = c->points + i;
+      sink_printf( s, "%s{\"code\":%d,\"name\":", i ? "," : "", p->code );
+      put_json_string( s, p->name );
+      char* keys[] = { "lon", "lat", "dist", "speed" };
+      for ( int f = 0; f < 4; f++ )
+         {
+         sink_printf( s, ",\"%s\":", keys[f] );
+         put_json_number( s, p->data[f] );
+         }
+      sink_put( s, "}", 1 );
+      }
+   sink_put( s, "],\"houses\":{", 12 );
+   for ( int y = 0; y < c->sys_count; y++ )
+      {
+      sink_printf( s, "%s\"%c\":", y ? "," : "", cf->systems[y] );
+      if ( c->syscode( y ) == '?' ) { sink_put( s, "null", 4 ); continue; }
+      sink_put( s, "[", 1 );
+      for ( int h = 1; h <= 12; h++ )
+         {
+         if ( h > 1 ) { sink_put( s, ",", 1 ); }
+         put_json_number( s, c->housealt( h, y ) );
+         }
+      sink_put( s, "]", 1 );
+      }
+   sink_put( s, "},\"aspects\":[", 13 );
+   for ( int k = 0; k < c->asp_count; k++ )
+      {
+      Aspect* a = c->aspects + k;
+      sink_printf( s, "%s{\"point1\":%d,\"point2\":%d,\"kind\":%d,\"diff\":",
+                   k ? "," : "", a->point1, a->point2, a->kind );
+      put_json_number( s, a->diff );
+      sink_put( s, ",\"score\":", 9 );
+      put_json_float( s, a->score );
+      sink_put( s, "}", 1 );
+      }
+   sink_put( s, "]}\n", 3 );
+   }
+
 /** make_aspect_table() allocates a string with data about aspects.
  * @param c: Pointer to a Chart structure.
  *
@@ -343,6 +749,14 @@ aspect_list( Chart* c )
 #include "test.tc.data"
 // this includes a populated Chart structure -- named tc
 
+// a callback sink that copies into a buffer sink
+intern
+void
+collect_text( const char* str, size_t len, void* data )
+   {
+   sink_put( data, str, len );
+   }
+
 BEGIN_TESTS
 //---- MAKE_POINT_TABLE()
    TRIAL( "bounds check make_house_table()",
@@ -381,6 +795,141 @@ BEGIN_TESTS
          free(buf);
          );
       );
+//---- MAKE_POINT_FORMAT()
+   TRIAL( "no leaks on make_point_format()",
+      BOUND(
+         PointFormat* pf = make_point_format( "|$Y| $N | $U |$S |$d |$C| $Q $", FALSE );
+         PROBE( pf );
+         dump_point_format( pf );
+         );
+      );
+   TRIAL( "point tables are as they were before formats were compiled",
+      Point pts[] =
+         {
+            { .lon = 280.36912, .lat = 0.00021, .dist = 0.98331, .speed = 1.01943,
+              .code = 0, .symbol = "\u2609", .name = "Sun" },
+            { .lon = 223.32375, .lat = 5.17006, .dist = 0.00269, .speed = 12.94071,
+              .code = 1, .symbol = "\u263D", .name = "Moon" },
+            { .lon = 271.88992, .lat = -2.10224, .dist = 1.41577, .speed = -0.41302,
+              .code = 2, .symbol = "\u263F", .name = "Mercury" },
+         };
+      Chart few = { .points = pts, .pt_count = 3 };
+      // as written by put_point_table() when it parsed the format itself
+      char* want =
+         "+-+---------+------------+-------+----+-+\n"
+         "|S| Planet  | Zodiac pos |Speed  |Dis |S|\n"
+         "+-+---------+------------+-------+----+-+\n"
+         "|\u2609| Sun     | 10Cp22.147 | 1.019 |1.0 |0|\n"
+         "|\u263D| Moon    | 13Sc19.425 |12.941 |0.0 |1|\n"
+         "|\u263F| Mercury | 01Cp53.395 |-0.413 |1.4 |2|\n"
+         "+-+---------+------------+-------+----+-+";
+      char* got = make_point_table( &few, "|$Y| $N | $Z |$S |$d |$C|" );
+      ENSURE( 0 == strcmp( got, want ) );
+      free( got );
+      );
+   double xs[] = { 0.0, -0.0, 0.0004, -0.0004, 9.9994, 9.9996, -99.9996, 359.9999, 1e6, NAN,
+                   9.9995, -9.9995, 99.9995, -99.9995, 0.9995, -1e300 };
+   char* three = "%.3f";
+   TRIAL( "fixed3_width() is the length of %.3f",
+      for ( int i = 0; i < sizeof( xs ) / sizeof( *xs ); i++ )
+         {
+         AVOID( fixed3_width( xs[i] ) != snprintf( NULL, 0, three, xs[i] ) );
+         }
+      );
+   TRIAL( "fixed widths do not depend on the chart",
+      PointFormat* pf = make_point_format( "|$N|$O|$C|", TRUE );
+      Sink bs = sink_of_buffer();
+      put_point_table_with( &bs, &tc, pf );
+      ENSURE( 0 == strncmp( bs.buf, "+----------+-------+------+", 27 ) );
+      free( bs.buf );
+      dump_point_format( pf );
+      );
+//---- PUT_JSON()
+   double reals[] = { 0.1, 1.0/3.0, 359.99999999999994, -2.5e-300, 2451545.0 };
+   TRIAL( "JSON numbers read back the same",
+      for ( int i = 0; i < sizeof( reals ) / sizeof( *reals ); i++ )
+         {
+         Sink bs = sink_of_buffer();
+         put_json_number( &bs, reals[i] );
+         AVOID( strtod( bs.buf, NULL ) != reals[i] );
+         free( bs.buf );
+         }
+      Sink bs = sink_of_buffer();
+      put_json_number( &bs, 0.1 );
+      put_json_number( &bs, NAN );
+      ENSURE( 0 == strcmp( bs.buf, "0.1null" ) );
+      free( bs.buf );
+      );
+   TRIAL( "JSON strings are escaped",
+      Sink bs = sink_of_buffer();
+      put_json_string( &bs, "a\"b\\c\nd" );
+      ENSURE( 0 == strcmp( bs.buf, "\"a\\\"b\\\\c\\u000ad\"" ) );
+      free( bs.buf );
+      );
+   TRIAL( "put_json() writes the chart as one line, failed systems as null",
+      Event ev = { .lon = -46.5, .lat = -23.5, .jdn = 2451545.0, .name = "A \"B\"" };
+      Point pts[] =
+         {
+            { .lon = 280.5, .lat = 0.25, .dist = 1.0, .speed = 1.0, .code = 0, .name = "Sun" },
+            { .lon = 223.25, .lat = -5.0, .dist = 0.0025, .speed = 13.0, .code = 1, .name = "Moon" },
+         };
+      double cusps[24];
+      for ( int h = 0; h < 12; h++ ) { cusps[h] = 30.0 * ( h+1 ); cusps[12 + h] = NAN; }
+      Aspect asp = { .kind = 3, .score = 0.5f, .point1 = 0, .point2 = 1, .diff = 57.25 };
+      Chart few = { .ev = &ev, .points = pts, .aspects = &asp, .pt_count = 2,
+                    .sys_count = 2, .asp_count = 1, .sys_cusps = cusps, .sys_codes = "P?" };
+      ChartConfig fcf = { .systems = "PK", .sys_count = 2 };
+      char* want =
+         "{\"name\":\"A \\\"B\\\"\",\"jdn\":2451545,\"lat\":-23.5,\"lon\":-46.5,"
+         "\"points\":[{\"code\":0,\"name\":\"Sun\",\"lon\":280.5,\"lat\":0.25,\"dist\":1,\"speed\":1},"
+         "{\"code\":1,\"name\":\"Moon\",\"lon\":223.25,\"lat\":-5,\"dist\":0.0025,\"speed\":13}],"
+         "\"houses\":{\"P\":[30,60,90,120,150,180,210,240,270,300,330,360],\"K\":null},"
+         "\"aspects\":[{\"point1\":0,\"point2\":1,\"kind\":3,\"diff\":57.25,\"score\":0.5}]}\n";
+      BOUND(
+         Sink bs = sink_of_buffer();
+         put_json( &bs, &few, &fcf );
+         ENSURE( 0 == strcmp( bs.buf, want ) );
+         free( bs.buf );
+         );
+      );
+//---- SINKS
+   TRIAL( "every sink gets the same text as make_*()",
+      char* want = make_point_table( &tc, "|$Y| $N | $U |$S |$d |$C|" );
+      char* got;
+      size_t len;
+      FILE* f = open_memstream( &got, &len );
+      Sink fs = sink_of_file( f );
+      put_point_table( &fs, &tc, "|$Y| $N | $U |$S |$d |$C|" );
+      fclose( f );
+      ENSURE( len == strlen( want ) );
+      ENSURE( 0 == strcmp( got, want ) );
+      Sink bs = sink_of_buffer();
+      Sink cs = sink_of_callback( collect_text, &bs );
+      put_point_table( &cs, &tc, "|$Y| $N | $U |$S |$d |$C|" );
+      ENSURE( bs.len == strlen( want ) );
+      ENSURE( 0 == strcmp( bs.buf, want ) );
+      free( bs.buf );
+      free( got );
+      free( want );
+      );
+   TRIAL( "sink_printf() grows the buffer for long text",
+      Sink bs = sink_of_buffer();
+      char longer[3 * SINK_FIRST_SIZE];
+      memset( longer, 'x', sizeof( longer ) - 1 );
+      longer[sizeof( longer ) - 1] = '\0';
+      sink_printf( &bs, "<%s>", longer );
+      sink_printf( &bs, "%d", 42 );
+      ENSURE( bs.len == sizeof( longer ) + 3 );
+      ENSURE( bs.buf[0] == '<' );
+      ENSURE( 0 == strcmp( bs.buf + bs.len - 3, ">42" ) );
+      Sink cbs = sink_of_buffer();
+      Sink cs = sink_of_callback( collect_text, &cbs );
+      sink_printf( &cs, "<%s>", longer );
+      ENSURE( cbs.len == sizeof( longer ) + 1 );
+      ENSURE( 0 == strncmp( cbs.buf, bs.buf, cbs.len ) );
+      free( cbs.buf );
+      free( bs.buf );
+      );
 END_TESTS
 #endif //TEST
 
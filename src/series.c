@@ -0,0 +1,415 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file series.c
+ *    keeps point positions as Chebyshev polynomials in a file.
+ *
+ * Sweeping over time (transits, returns, electional scans) asks the
+ * ephemeris for the same points thousands of times. Instead, the range
+ * of dates is cut into segments, and over each one lon, lat, dist and
+ * speed are fit by a Chebyshev polynomial, which is much cheaper to
+ * evaluate than a Swiss Ephemeris call.
+ *
+ * The coefficients go to a binary file, mapped into memory when loaded,
+ * so all processes on a host share one copy. Files are in the byte
+ * order of the machine that made them. The layout is:
+ *   - a SeriesHead;
+ *   - one SeriesEntry per point, with its segments and its error;
+ *   - the coefficients, per point, per segment, per value.
+ *
+ * Each point gets its own segment length, halved until the fit of lon
+ * and lat is within the tolerance asked for, and the largest error
+ * found is kept in the file, so that a ChartConfig only uses a series
+ * when it is accurate enough (see set_chart_series()). The error is
+ * sampled SERIES_CHECKS times per node, a grid so dense that between
+ * its points the error of a fit grows by under 10%, and what is kept
+ * is SERIES_MARGIN times the largest error sampled, plus rounding.
+ **/
+
+#include "arfc.h"
+
+#define SERIES_MAGIC "ARFSER1"
+#define SERIES_FIRST_SPAN 32.0
+#define SERIES_LAST_SPAN (1.0/16.0)
+#define SERIES_VALUES 4 // lon, lat, dist, speed
+#define SERIES_MAX_DEGREE 64
+#define SERIES_CHECKS 4 // samples per node when checking a fit
+#define SERIES_MARGIN 1.25 // over the largest error sampled
+#define SERIES_ROUNDING 1e-12 // added for rounding in chebyshev()
+
+/** struct SeriesHead starts a series file */
+struct SeriesHead
+   {
+   char magic[8];
+   double probe; // 1.0, to catch files of another byte order
+   gint32 pt_count;
+   gint32 degree;
+   double from;
+   double to;
+   };
+
+/** struct SeriesEntry describes the series of one point */
+struct SeriesEntry
+   {
+   gint32 code;
+   gint32 seg_count;
+   double span; // days per segment
+   double err[SERIES_VALUES]; // largest error found, per value
+   gint64 offset; // of the first coefficient, in doubles
+   };
+
+//---- EVALUATION ----------------------------------------------------//
+/** chebyshev() sums @p n coefficients at @p x in -1..1 (Clenshaw). */
+intern
+double
+chebyshev( const double* c, int n, double x )
+   {
+   double b1 = 0.0, b2 = 0.0, t;
+   for ( int j = n-1; j > 0; j-- )
+      {
+      t = 2.0 * x * b1 - b2 + c[j];
+      b2 = b1;
+      b1 = t;
+      }
+   return x * b1 - b2 + c[0];
+   }
+
+/** chebyshev_slope() is the derivative over x of chebyshev(). */
+intern
+double
+chebyshev_slope( const double* c, int n, double x )
+   {
+   if ( n < 2 ) { return 0.0; }
+   double d[n];
+   d[n-1] = 0.0;
+   d[n-2] = 2.0 * (n-1) * c[n-1];
+   for ( int j = n-3; j >= 0; j-- ) { d[j] = d[j+2] + 2.0 * (j+1) * c[j+1]; }
+   d[0] /= 2.0;
+   return chebyshev( d, n-1, x );
+   }
+
+/** eval_series() calculates a point from a Series, like calc_point().
+ * @param s Pointer to a Series.
+ * @param code Swiss Ephemeris code of the point.
+ * @param jdn Moment in time, in JDN format.
+ * @param accuracy Largest error accepted in lon and lat, in degrees.
+ * @param ret Array of at least 6 doubles: lon, lat, dist, and speeds.
+ *
+ * @return 0, or -1 if the series does not have the point at that time
+ *         with that accuracy, and nothing is written to @p ret.
+ */
+extern
+int
+eval_series( Series* s, int code, double jdn, double accuracy, double* ret )
+   {
+   const struct SeriesHead* h = s->head;
+   if ( !( jdn >= h->from && jdn <= h->to ) ) { return -1; }
+   const struct SeriesEntry* e = NULL;
+   for ( int i = 0; i < h->pt_count; i++ )
+      {
+      if ( s->entries[i].code == code ) { e = s->entries + i; break; }
+      }
+   if ( !e || e->err[0] > accuracy || e->err[1] > accuracy ) { return -1; }
+   int seg = (int) ( ( jdn - h->from ) / e->span );
+   if ( seg >= e->seg_count ) { seg = e->seg_count - 1; }
+   double x = 2.0 * ( jdn - h->from - seg * e->span ) / e->span - 1.0;
+   int n = h->degree + 1;
+   const double* c = s->coefs + e->offset + seg * SERIES_VALUES * n;
+   ret[0] = swe_degnorm( chebyshev( c, n, x ) );
+   ret[1] = chebyshev( c + n, n, x );
+   ret[2] = chebyshev( c + 2*n, n, x );
+   ret[3] = chebyshev( c + 3*n, n, x );
+   ret[4] = chebyshev_slope( c + n, n, x ) * 2.0 / e->span;
+   ret[5] = chebyshev_slope( c + 2*n, n, x ) * 2.0 / e->span;
+   return 0;
+   }
+
+//---- FITTING -------------------------------------------------------//
+/** fit_segment() fits one segment of one point.
+ * @param c Room for SERIES_VALUES * @p n coefficients.
+ * @param err Largest errors found so far, updated.
+ *
+ * @return negative on an ephemeris error.
+ */
+intern
+int
+fit_segment( int code, double t0, double span, int n, double* c, double* err )
+   {
+   char serr[AS_MAXCH];
+   double ret[6];
+   double f[SERIES_VALUES][n];
+   // nodes from the start of the segment on, so lon can be unwrapped
+   for ( int k = n-1; k >= 0; k-- )
+      {
+      double x = cos( M_PI * ( k + 0.5 ) / n );
+      if ( swe_calc_ut( t0 + ( x + 1.0 ) * span / 2.0, code, SEFLG_SPEED, ret, serr ) < 0 )
+         { return -1; }
+      for ( int v = 0; v < SERIES_VALUES; v++ ) { f[v][k] = ret[v]; }
+      if ( k < n-1 ) { f[0][k] = f[0][k+1] + swe_difdeg2n( ret[0], f[0][k+1] ); }
+      }
+   for ( int v = 0; v < SERIES_VALUES; v++ )
+      {
+      for ( int j = 0; j < n; j++ )
+         {
+         double sum = 0.0;
+         for ( int k = 0; k < n; k++ ) { sum += f[v][k] * cos( M_PI * j * ( k + 0.5 ) / n ); }
+         c[v*n + j] = sum * ( j ? 2.0 : 1.0 ) / n;
+         }
+      }
+   // check on a grid finer than the nodes, both ends included
+   int m = SERIES_CHECKS * n;
+   for ( int k = 0; k <= m; k++ )
+      {
+      double x = cos( M_PI * k / m );
+      if ( swe_calc_ut( t0 + ( x + 1.0 ) * span / 2.0, code, SEFLG_SPEED, ret, serr ) < 0 )
+         { return -1; }
+      double d = fabs( swe_difdeg2n( chebyshev( c, n, x ), ret[0] ) );
+      err[0] = MAX( err[0], SERIES_MARGIN * d + SERIES_ROUNDING );
+      for ( int v = 1; v < SERIES_VALUES; v++ )
+         {
+         d = fabs( chebyshev( c + v*n, n, x ) - ret[v] );
+         err[v] = MAX( err[v], SERIES_MARGIN * d + SERIES_ROUNDING );
+         }
+      }
+   return 0;
+   }
+
+/** make_series_file() fits Chebyshev series for points and writes them
+ * to a file. The ephemeris must be initialized.
+ * @param path Name of the file to write.
+ * @param ptlist Array of point codes, terminated by SE_END.
+ * @param from, to Range of dates, in JDN format.
+ * @param degree Degree of the polynomials, like 12, up to SERIES_MAX_DEGREE.
+ * @param tolerance Error in lon and lat to aim for, in degrees. Points
+ *        that cannot reach it are written anyway, with their error.
+ *
+ * @return number of points written, or -1 on error.
+ */
+extern
+int
+make_series_file( char* path, int* ptlist, double from, double to,
+                  int degree, double tolerance )
+   {
+   int count = 0;
+   while ( SE_END != ptlist[count] ) { count++; }
+   if ( !( to > from ) || degree < 1 || degree > SERIES_MAX_DEGREE || count == 0 )
+      { return -1; }
+   int n = degree + 1;
+   struct SeriesHead head = { SERIES_MAGIC, 1.0, count, degree, from, to };
+   struct SeriesEntry entries[count];
+   double* coefs[count];
+   gint64 offset = 0;
+   int ok = 1;
+   for ( int i = 0; i < count; i++ )
+      {
+      coefs[i] = NULL;
+      if ( !ok ) { continue; }
+      double span = SERIES_FIRST_SPAN;
+      for ( ;; )
+         {
+         struct SeriesEntry* e = entries + i;
+         *e = ( struct SeriesEntry ) { .code = ptlist[i], .span = span };
+         e->seg_count = (int) ceil( ( to - from ) / span );
+         e->offset = offset;
+         if ( coefs[i] ) { free( coefs[i] ); }
+         coefs[i] = malloc( sizeof(double) * SERIES_VALUES * n * e->seg_count );
+         for ( int g = 0; ok && g < e->seg_count; g++ )
+            {
+            double* c = coefs[i] + g * SERIES_VALUES * n;
+            if ( fit_segment( ptlist[i], from + g * span, span, n, c, e->err ) < 0 )
+               {
+               complain( "no ephemeris for point %i\n", ptlist[i] );
+               ok = 0;
+               }
+            }
+         if ( !ok || span / 2.0 < SERIES_LAST_SPAN ) { break; }
+         if ( e->err[0] <= tolerance && e->err[1] <= tolerance ) { break; }
+         span /= 2.0;
+         }
+      offset += SERIES_VALUES * n * entries[i].seg_count;
+      }
+   FILE* out = ok ? fopen( path, "wb" ) : NULL;
+   if ( out )
+      {
+      ok = 1 == fwrite( &head, sizeof( head ), 1, out )
+           && (size_t) count == fwrite( entries, sizeof( *entries ), count, out );
+      for ( int i = 0; ok && i < count; i++ )
+         {
+         size_t len = SERIES_VALUES * n * entries[i].seg_count;
+         ok = len == fwrite( coefs[i], sizeof(double), len, out );
+         }
+      ok = ( 0 == fclose( out ) ) && ok;
+      }
+   else if ( ok )
+      {
+      complain( "cannot write series to %s\n", path );
+      ok = 0;
+      }
+   for ( int i = 0; i < count; i++ )
+      {
+      if ( coefs[i] ) { free( coefs[i] ); }
+      }
+   return ok ? count : -1;
+   }
+
+//---- FILES ---------------------------------------------------------//
+/** load_series() maps a series file into memory.
+ * @param path Name of a file from make_series_file().
+ *
+ * @return pointer to a Series, that must be dumped, or NULL if the file
+ *         cannot be read or is not a series of this machine.
+ *
+ * Counts in the file are checked against its length before they are
+ * multiplied, so a broken header cannot make the sizes wrap around.
+ */
+extern
+Series*
+load_series( char* path )
+   {
+   GError* gerr = NULL;
+   GMappedFile* map = g_mapped_file_new( path, FALSE, &gerr );
+   if ( !map )
+      {
+      complain( "cannot map %s: %s\n", path, gerr->message );
+      g_error_free( gerr );
+      return NULL;
+      }
+   const char* data = g_mapped_file_get_contents( map );
+   size_t len = g_mapped_file_get_length( map );
+   const struct SeriesHead* h = (const struct SeriesHead*) data;
+   const struct SeriesEntry* es = (const struct SeriesEntry*) ( h + 1 );
+   int ok = len >= sizeof( *h )
+            && 0 == memcmp( h->magic, SERIES_MAGIC, 8 ) && h->probe == 1.0
+            && h->pt_count > 0 && h->degree >= 1 && h->degree <= SERIES_MAX_DEGREE
+            && (size_t) h->pt_count <= ( len - sizeof( *h ) ) / sizeof( *es );
+   // bytes left for coefficients, and doubles per segment
+   size_t left = ok ? len - sizeof( *h ) - sizeof( *es ) * h->pt_count : 0;
+   size_t seg_len = SERIES_VALUES * ( ok ? h->degree + 1 : 1 );
+   gint64 offset = 0;
+   for ( int i = 0; ok && i < h->pt_count; i++ )
+      {
+      ok = es[i].seg_count > 0 && es[i].span > 0.0 && es[i].offset == offset
+           && (size_t) es[i].seg_count <= left / ( sizeof(double) * seg_len );
+      if ( !ok ) { break; }
+      left -= sizeof(double) * seg_len * es[i].seg_count;
+      offset += (gint64) seg_len * es[i].seg_count;
+      }
+   if ( !ok || left != 0 )
+      {
+      complain( "%s is not a series file\n", path );
+      g_mapped_file_unref( map );
+      return NULL;
+      }
+   Series* s;
+   s = malloc( sizeof( Series ) );
+   s->map = map;
+   s->head = h;
+   s->entries = es;
+   s->coefs = (const double*) ( es + h->pt_count );
+   return s;
+   }
+
+/** dump_series() unmaps a Series.
+ * @param s Pointer to a Series, no ChartConfig may still be using it.
+ */
+extern
+void
+dump_series( Series* s )
+   {
+   g_mapped_file_unref( s->map );
+   free( s );
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   swe_set_ephe_path( NULL );
+   int pts[] = { SE_SUN, SE_MOON, SE_MERCURY, SE_MEAN_NODE, SE_END };
+   char* path = g_build_filename( g_get_tmp_dir(), "arf-test.series", NULL );
+   double from = 2451545.0;
+   double to = from + 400.0;
+   //
+   TRIAL( "chebyshev() of cos(k acos x) is T_k",
+      double c[4] = {};
+      c[3] = 1.0;
+      for ( double x = -1.0; x <= 1.0; x += 0.125 )
+         {
+         AVOID( fabs( chebyshev( c, 4, x ) - ( 4*x*x*x - 3*x ) ) > 1e-12 );
+         AVOID( fabs( chebyshev_slope( c, 4, x ) - ( 12*x*x - 3 ) ) > 1e-12 );
+         }
+      );
+   TRIAL( "no leaks on make_series_file()",
+      BOUND(
+         ENSURE( 4 == make_series_file( path, pts, from, to, 12, 1e-7 ) );
+         );
+      );
+   TRIAL( "eval_series() is within its error of swe_calc_ut()",
+      Series* s = load_series( path );
+      ENSURE( s != NULL );
+      char serr[AS_MAXCH];
+      double ret[6];
+      double ref[6];
+      for ( int i = 0; pts[i] != SE_END; i++ )
+         {
+         const double* err = s->entries[i].err;
+         AVOID( err[0] > 1e-7 || err[1] > 1e-7 );
+         for ( int k = 0; k < 500; k++ )
+            {
+            double jdn = g_test_rand_double_range( from, to );
+            swe_calc_ut( jdn, pts[i], SEFLG_SPEED, ref, serr );
+            AVOID( 0 != eval_series( s, pts[i], jdn, 1.0, ret ) );
+            AVOID( fabs( swe_difdeg2n( ret[0], ref[0] ) ) > err[0] );
+            AVOID( fabs( ret[1] - ref[1] ) > err[1] );
+            AVOID( fabs( ret[2] - ref[2] ) > err[2] );
+            AVOID( fabs( ret[3] - ref[3] ) > err[3] );
+            AVOID( fabs( ret[4] - ref[4] ) > 1e-4 );
+            }
+         }
+      // not in the file, out of range, or not accurate enough
+      ENSURE( -1 == eval_series( s, SE_PLUTO, from + 1.0, 1.0, ret ) );
+      ENSURE( -1 == eval_series( s, SE_SUN, to + 1.0, 1.0, ret ) );
+      ENSURE( -1 == eval_series( s, SE_SUN, from + 1.0, 0.0, ret ) );
+      ENSURE( 0 == eval_series( s, SE_SUN, to, 1.0, ret ) );
+      dump_series( s );
+      );
+   TRIAL( "load_series() refuses counts that do not fit the file",
+      char* good;
+      gsize len;
+      ENSURE( g_file_get_contents( path, &good, &len, NULL ) );
+      struct SeriesHead* h = (struct SeriesHead*) good;
+      struct SeriesEntry* es = (struct SeriesEntry*) ( h + 1 );
+      char* bad = g_strdup_printf( "%s.bad", path );
+      gint32 counts[] = { G_MAXINT32, -1, 0 };
+      for ( int i = 0; i < 3; i++ )
+         {
+         gint32 keep = h->pt_count;
+         h->pt_count = counts[i];
+         g_file_set_contents( bad, good, len, NULL );
+         AVOID( NULL != load_series( bad ) );
+         h->pt_count = keep;
+         keep = es[1].seg_count;
+         es[1].seg_count = counts[i];
+         g_file_set_contents( bad, good, len, NULL );
+         AVOID( NULL != load_series( bad ) );
+         es[1].seg_count = keep;
+         }
+      h->degree = G_MAXINT32;
+      g_file_set_contents( bad, good, len, NULL );
+      ENSURE( NULL == load_series( bad ) );
+      remove( bad );
+      g_free( bad );
+      g_free( good );
+      );
+   TRIAL( "load_series() refuses other files",
+      g_file_set_contents( path, "not a series at all, really", -1, NULL );
+      ENSURE( NULL == load_series( path ) );
+      );
+   remove( path );
+   g_free( path );
+   swe_close();
+END_TESTS
+#endif //TEST
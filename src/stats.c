@@ -0,0 +1,562 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file stats.c
+ *    counts where the points of many charts are, and tests the counts.
+ *
+ * A ChartStats is a set of counters: charts by degree of each point,
+ * by sign of each point, by house of each point in each house system,
+ * and by aspect kind of each pair of points. Counters only add, so two
+ * ChartStats of the same config merge by adding them up: each thread
+ * of fill_chart_stats() counts on its own and the counts are merged at
+ * the end, and stats of shards of a dataset, counted apart and saved
+ * with save_chart_stats(), merge with merge_chart_stats() the same way.
+ *
+ * test_chart_stats() does a chi-square test of any of those counts
+ * against a baseline, which is usually the stats of a control group.
+ **/
+
+#include "arfc.h"
+
+#define STATS_MAGIC "ARFSTATS1"
+#define STATS_BATCH 256 // charts per ChartBatch in fill_chart_stats()
+#define stats_pairs(cf) ( (cf)->pt_count * ( (cf)->pt_count - 1 ) / 2 )
+// index of the pair of points i < k, in the order of fill_aspects()
+#define stats_pair(cf,i,k) ( (i) * (cf)->pt_count - (i) * ( (i) + 1 ) / 2 + (k) - (i) - 1 )
+
+/** make_chart_stats() makes stats with all counts at zero.
+ * @param cf Pointer to the ChartConfig of the charts to count, must
+ *        outlive the stats.
+ *
+ * @return pointer to a ChartStats, that must be dumped.
+ */
+extern
+ChartStats*
+make_chart_stats( ChartConfig* cf )
+   {
+   ChartStats* st;
+   st = malloc( sizeof( ChartStats ) );
+   st->cf = cf;
+   st->count = 0;
+   st->size = cf->pt_count * ( 360 + 12 + 12 * cf->sys_count )
+              + stats_pairs( cf ) * ASPECT_KINDS;
+   // one block, so merging is a single loop
+   st->lon = calloc( st->size, sizeof( long ) );
+   enforce( "allocate chart stats", st->lon );
+   st->signs = st->lon + 360 * cf->pt_count;
+   st->houses = st->signs + 12 * cf->pt_count;
+   st->aspects = st->houses + 12 * cf->sys_count * cf->pt_count;
+   return st;
+   }
+
+/** dump_chart_stats() deallocates a ChartStats.
+ * @param st Pointer to a ChartStats.
+ */
+extern
+void
+dump_chart_stats( ChartStats* st )
+   {
+   free( st->lon ); // also frees all other counts
+   free( st );
+   }
+
+/** count_point() counts a point at a longitude. */
+intern
+void
+count_point( ChartStats* st, int i, double lon, double* cusps )
+   {
+   ChartConfig* cf = st->cf;
+   if ( isnan( lon ) ) { return; }
+   lon = fmod( lon + 360.0, 360.0 );
+   int deg = MIN( (int) lon, 359 );
+   st->lon[360 * i + deg]++;
+   st->signs[12 * i + deg / 30]++;
+   for ( int s = 0; s < cf->sys_count; s++ )
+      {
+      int h = house_of( cusps + 12 * s, lon );
+      if ( h ) { st->houses[12 * ( cf->sys_count * i + s ) + h-1]++; }
+      }
+   }
+
+/** add_chart_to_stats() counts a chart.
+ * @param st Pointer to a ChartStats.
+ * @param c Pointer to a Chart, made with the config of the stats.
+ */
+extern
+void
+add_chart_to_stats( ChartStats* st, Chart* c )
+   {
+   ChartConfig* cf = st->cf;
+   double cusps[12 * cf->sys_count];
+   for ( int s = 0; s < cf->sys_count; s++ )
+      {
+      for ( int h = 1; h <= 12; h++ )
+         {
+         cusps[12*s + h-1] = c->syscode( s ) == '?' ? NAN : c->housealt( h, s );
+         }
+      }
+   for_point_i( c )
+      {
+      // points the ephemeris failed on are not counted
+      if ( !strcmp( c->points[i].symbol, "?" ) ) { continue; }
+      count_point( st, i, c->points[i].lon, cusps );
+      }
+   // pairs with no aspect are counted as kind 0
+   for ( int p = 0; p < stats_pairs( cf ); p++ ) { st->aspects[ASPECT_KINDS * p]++; }
+   for ( int a = 0; a < c->asp_count; a++ )
+      {
+      Aspect* as = c->aspects + a;
+      long* pair = st->aspects + ASPECT_KINDS * stats_pair( cf, as->point1, as->point2 );
+      pair[0]--;
+      pair[as->kind]++;
+      }
+   st->count++;
+   }
+
+/** add_batch_to_stats() counts the charts of a ChartBatch, such as a
+ * segment of an Archive. Aspects are found with to_aspects(), a column
+ * against another, so they are the same as in the charts.
+ * @param st Pointer to a ChartStats.
+ * @param b Pointer to a ChartBatch, made with the config of the stats.
+ */
+extern
+void
+add_batch_to_stats( ChartStats* st, ChartBatch* b )
+   {
+   ChartConfig* cf = st->cf;
+   double cusps[12 * cf->sys_count];
+   int kinds[MAX( b->count, 1 )];
+   float scores[MAX( b->count, 1 )];
+   for ( int k = 0; k < b->count; k++ )
+      {
+      for ( int s = 0; s < cf->sys_count; s++ )
+         {
+         for ( int h = 1; h <= 12; h++ ) { cusps[12*s + h-1] = batch_house( b, s, h )[k]; }
+         }
+      for ( int i = 0; i < cf->pt_count; i++ )
+         {
+         count_point( st, i, batch_col( b, i, 0 )[k], cusps );
+         }
+      }
+   for ( int i = 0; i < cf->pt_count; i++ )
+      {
+      for ( int j = i+1; j < cf->pt_count; j++ )
+         {
+         long* pair = st->aspects + ASPECT_KINDS * stats_pair( cf, i, j );
+         to_aspects( batch_col( b, i, 0 ), batch_col( b, j, 0 ), b->count, kinds, scores );
+         for ( int k = 0; k < b->count; k++ ) { pair[kinds[k]]++; }
+         }
+      }
+   st->count += b->count;
+   }
+
+/** merge_chart_stats() adds the counts of @p from into @p into.
+ * @return 0, or -1 if they have different configs.
+ */
+extern
+int
+merge_chart_stats( ChartStats* into, ChartStats* from )
+   {
+   if ( into->size != from->size || into->cf->pt_count != from->cf->pt_count
+        || strcmp( into->cf->systems, from->cf->systems ) )
+      {
+      complain( "chart stats: cannot merge stats of other points or houses\n" );
+      return -1;
+      }
+   for ( int i = 0; i < into->cf->pt_count; i++ )
+      {
+      if ( into->cf->pts[i] != from->cf->pts[i] )
+         {
+         complain( "chart stats: cannot merge stats of other points or houses\n" );
+         return -1;
+         }
+      }
+   for ( size_t i = 0; i < into->size; i++ ) { into->lon[i] += from->lon[i]; }
+   into->count += from->count;
+   return 0;
+   }
+
+//---- MANY THREADS --------------------------------------------------//
+/** struct StatsWork is the share of the events of a thread */
+typedef struct StatsWork
+   {
+   ChartStats* st;
+   Event* evs;
+   int n;
+   }
+StatsWork;
+
+/** count_events() makes the charts of events, a batch at a time, and
+ * counts them.
+ */
+intern
+void
+count_events( ChartStats* st, Event* evs, int n )
+   {
+   ChartBatch* b = make_chart_batch( st->cf, STATS_BATCH );
+   for ( int k = 0; k < n; k += STATS_BATCH )
+      {
+      fill_chart_batch( b, evs + k, MIN( STATS_BATCH, n - k ) );
+      add_batch_to_stats( st, b );
+      }
+   dump_chart_batch( b );
+   }
+
+intern
+gpointer
+stats_worker( gpointer data )
+   {
+   StatsWork* w = data;
+   init_ephemeris_thread();
+   count_events( w->st, w->evs, w->n );
+   end_ephemeris_thread();
+   return NULL;
+   }
+
+/** fill_chart_stats() makes the charts of many events, on many threads,
+ * and counts them. Each thread counts into its own ChartStats, merged
+ * into @p st at the end, so threads never wait for each other.
+ * @param st Pointer to a ChartStats.
+ * @param evs Array of Events.
+ * @param n Number of events.
+ * @param threads Number of threads, counting the calling one.
+ */
+extern
+void
+fill_chart_stats( ChartStats* st, Event* evs, int n, int threads )
+   {
+   threads = MAX( 1, MIN( threads, n / STATS_BATCH + 1 ) );
+   StatsWork work[threads];
+   GThread* th[threads];
+   for ( int t = 1; t < threads; t++ )
+      {
+      int from = (long) n * t / threads;
+      work[t].evs = evs + from;
+      work[t].n = (long) n * ( t+1 ) / threads - from;
+      work[t].st = make_chart_stats( st->cf );
+      th[t] = g_thread_new( "stats_worker", stats_worker, work + t );
+      }
+   // the first share is counted here, where the ephemeris is set up
+   count_events( st, evs, n / threads );
+   for ( int t = 1; t < threads; t++ )
+      {
+      g_thread_join( th[t] );
+      merge_chart_stats( st, work[t].st );
+      dump_chart_stats( work[t].st );
+      }
+   }
+
+//---- FILES ---------------------------------------------------------//
+/** save_chart_stats() writes stats to a text file, so that shards of a
+ * dataset can be counted apart and merged later.
+ * @return 0, or -1 on error.
+ */
+extern
+int
+save_chart_stats( ChartStats* st, char* path )
+   {
+   FILE* f = fopen( path, "w" );
+   if ( !f )
+      {
+      complain( "cannot write %s\n", path );
+      return -1;
+      }
+   fprintf( f, "%s %s %d %ld\n", STATS_MAGIC, st->cf->systems, st->cf->pt_count, st->count );
+   for ( int i = 0; i < st->cf->pt_count; i++ ) { fprintf( f, "%d\n", st->cf->pts[i] ); }
+   for ( size_t i = 0; i < st->size; i++ ) { fprintf( f, "%ld\n", st->lon[i] ); }
+   int ret = ferror( f ) ? -1 : 0;
+   if ( fclose( f ) ) { ret = -1; }
+   if ( ret ) { complain( "cannot write %s\n", path ); }
+   return ret;
+   }
+
+/** load_chart_stats() reads stats written by save_chart_stats().
+ * @param path Name of the file.
+ * @param cf Pointer to the ChartConfig the stats were counted with.
+ *
+ * @return pointer to a ChartStats, that must be dumped, or NULL if the
+ *         file cannot be read or is of another config.
+ */
+extern
+ChartStats*
+load_chart_stats( char* path, ChartConfig* cf )
+   {
+   FILE* f = fopen( path, "r" );
+   if ( !f )
+      {
+      complain( "cannot open %s\n", path );
+      return NULL;
+      }
+   char magic[16];
+   char systems[64];
+   int pt_count;
+   long count;
+   int ok = 4 == fscanf( f, "%15s %63s %d %ld", magic, systems, &pt_count, &count )
+            && !strcmp( magic, STATS_MAGIC );
+   ok = ok && pt_count == cf->pt_count && !strcmp( systems, cf->systems );
+   for ( int i = 0; ok && i < pt_count; i++ )
+      {
+      int code;
+      ok = 1 == fscanf( f, "%d", &code ) && code == cf->pts[i];
+      }
+   ChartStats* st = NULL;
+   if ( ok )
+      {
+      st = make_chart_stats( cf );
+      st->count = count;
+      for ( size_t i = 0; ok && i < st->size; i++ ) { ok = 1 == fscanf( f, "%ld", st->lon + i ); }
+      }
+   fclose( f );
+   if ( !ok )
+      {
+      complain( "%s is not stats of these points and houses\n", path );
+      if ( st ) { dump_chart_stats( st ); }
+      return NULL;
+      }
+   return st;
+   }
+
+//---- TESTS OF COUNTS -----------------------------------------------//
+/** gamma_q() is the regularized upper incomplete gamma function Q(a,x),
+ * by its series for small x and its continued fraction for large x.
+ */
+intern
+double
+gamma_q( double a, double x )
+   {
+   if ( x <= 0.0 ) { return 1.0; }
+   double lead = exp( a * log( x ) - x - lgamma( a ) );
+   if ( x < a + 1.0 )
+      {
+      double term = 1.0 / a;
+      double sum = term;
+      for ( int n = 1; n < 1000 && fabs( term ) > fabs( sum ) * 1e-15; n++ )
+         {
+         term *= x / ( a + n );
+         sum += term;
+         }
+      return MAX( 0.0, 1.0 - sum * lead );
+      }
+   // Lentz's method
+   double tiny = 1e-300;
+   double b = x + 1.0 - a;
+   double c = 1.0 / tiny;
+   double d = 1.0 / b;
+   double h = d;
+   for ( int n = 1; n < 1000; n++ )
+      {
+      double an = -n * ( n - a );
+      b += 2.0;
+      d = an * d + b;
+      if ( fabs( d ) < tiny ) { d = tiny; }
+      c = b + an / c;
+      if ( fabs( c ) < tiny ) { c = tiny; }
+      d = 1.0 / d;
+      double del = d * c;
+      h *= del;
+      if ( fabs( del - 1.0 ) < 1e-15 ) { break; }
+      }
+   return lead * h;
+   }
+
+/** chi_square() tests counts against the counts expected of them.
+ * Bins where nothing is expected are left out.
+ * @param observed Counts.
+ * @param expected Expected counts, with the same sum as @p observed.
+ * @param bins Number of counts.
+ *
+ * @return ChiSquare with the statistic, degrees of freedom and p-value.
+ */
+extern
+ChiSquare
+chi_square( long* observed, double* expected, int bins )
+   {
+   ChiSquare ret = { .chi2 = 0.0, .dof = -1, .p = 1.0 };
+   for ( int i = 0; i < bins; i++ )
+      {
+      if ( expected[i] <= 0.0 ) { continue; }
+      double d = observed[i] - expected[i];
+      ret.chi2 += d * d / expected[i];
+      ret.dof++;
+      }
+   if ( ret.dof > 0 ) { ret.p = gamma_q( 0.5 * ret.dof, 0.5 * ret.chi2 ); }
+   else { ret.dof = 0; }
+   return ret;
+   }
+
+/** stats_bins() finds a set of counts of a ChartStats.
+ * @param st Pointer to a ChartStats.
+ * @param what STATS_LON, STATS_SIGNS, STATS_HOUSES or STATS_ASPECTS.
+ * @param i Index of the point, or of the first point of the pair.
+ * @param j Index of the house system, or of the second point.
+ * @param bins Gets the number of counts.
+ *
+ * @return pointer to the counts, or NULL if there are none such.
+ */
+extern
+long*
+stats_bins( ChartStats* st, int what, int i, int j, int* bins )
+   {
+   ChartConfig* cf = st->cf;
+   if ( i < 0 || i >= cf->pt_count ) { return NULL; }
+   switch ( what )
+      {
+      case STATS_LON:
+         *bins = 360;
+         return st->lon + 360 * i;
+      case STATS_SIGNS:
+         *bins = 12;
+         return st->signs + 12 * i;
+      case STATS_HOUSES:
+         if ( j < 0 || j >= cf->sys_count ) { return NULL; }
+         *bins = 12;
+         return st->houses + 12 * ( cf->sys_count * i + j );
+      case STATS_ASPECTS:
+         if ( j <= i || j >= cf->pt_count ) { return NULL; }
+         *bins = ASPECT_KINDS;
+         return st->aspects + ASPECT_KINDS * stats_pair( cf, i, j );
+      }
+   return NULL;
+   }
+
+/** test_chart_stats() does a chi-square test of a set of counts of a
+ * ChartStats against the same counts of a baseline, scaled to the same
+ * sum, or against counts all the same if there is no baseline (which
+ * only makes sense for degrees and signs).
+ * @param st Pointer to a ChartStats.
+ * @param base Pointer to the ChartStats of the baseline, or NULL.
+ * @param what, i, j Which counts, as in stats_bins().
+ *
+ * @return ChiSquare with the statistic, degrees of freedom and p-value,
+ *         with .dof 0 if there is nothing to test.
+ */
+extern
+ChiSquare
+test_chart_stats( ChartStats* st, ChartStats* base, int what, int i, int j )
+   {
+   ChiSquare none = { .chi2 = 0.0, .dof = 0, .p = 1.0 };
+   int bins;
+   int base_bins = 0;
+   long* obs = stats_bins( st, what, i, j, &bins );
+   long* ref = base ? stats_bins( base, what, i, j, &base_bins ) : NULL;
+   if ( !obs || ( base && ( !ref || base_bins != bins ) ) ) { return none; }
+   double expected[bins];
+   double sum = 0.0;
+   double ref_sum = 0.0;
+   for ( int b = 0; b < bins; b++ )
+      {
+      sum += obs[b];
+      ref_sum += ref ? ref[b] : 1.0;
+      }
+   if ( sum == 0.0 || ref_sum == 0.0 ) { return none; }
+   for ( int b = 0; b < bins; b++ ) { expected[b] = ( ref ? ref[b] : 1.0 ) * sum / ref_sum; }
+   return chi_square( obs, expected, bins );
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+#define EVCOUNT 1000
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( "PKR", NULL );
+   ChartConfig* cf = get_chart_config();
+   Event evs[EVCOUNT];
+   for ( int i = 0; i < EVCOUNT; i++ )
+      {
+      evs[i].jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      evs[i].lat = g_test_rand_double_range( -60.0, 60.0 );
+      evs[i].lon = g_test_rand_double_range( -180.0, 180.0 );
+      evs[i].name = "stats";
+      }
+   //
+   TRIAL( "chi_square() p-values are right",
+      long obs[2] = { 0 };
+      double want[2] = { 0 };
+      ENSURE( NEAR( chi_square( obs, want, 2 ).p, 1.0 ) );
+      // chi2 of 3.841 with 1 dof, and 18.307 with 10, are p = 0.05
+      obs[0] = 50;
+      obs[1] = 150;
+      want[0] = want[1] = 100.0;
+      ChiSquare x = chi_square( obs, want, 2 );
+      ENSURE( x.dof == 1 );
+      ENSURE( NEAR( x.chi2, 50.0 ) );
+      AVOID( fabs( gamma_q( 0.5, 0.5 * 3.841459 ) - 0.05 ) > 1e-6 );
+      AVOID( fabs( gamma_q( 5.0, 0.5 * 18.307038 ) - 0.05 ) > 1e-6 );
+      AVOID( fabs( gamma_q( 50.0, 0.5 * 124.342113 ) - 0.05 ) > 1e-6 );
+      AVOID( fabs( gamma_q( 1.0, 3.0 ) - exp( -3.0 ) ) > 1e-12 );
+      );
+   TRIAL( "stats of batches equal stats of charts",
+      BOUND(
+         ChartStats* by_chart = make_chart_stats( cf );
+         ChartStats* by_batch = make_chart_stats( cf );
+         for ( int i = 0; i < 200; i++ )
+            {
+            Chart* c = make_chart_with( cf, "stats", evs[i].jdn, evs[i].lat, evs[i].lon );
+            add_chart_to_stats( by_chart, c );
+            dump_chart( c );
+            }
+         fill_chart_stats( by_batch, evs, 200, 1 );
+         ENSURE( by_chart->count == 200 );
+         ENSURE( by_batch->count == 200 );
+         AVOID( memcmp( by_chart->lon, by_batch->lon, sizeof( long ) * by_chart->size ) );
+         long signs = 0;
+         for ( int s = 0; s < 12; s++ ) { signs += by_chart->signs[12 + s]; }
+         ENSURE( signs == 200 );
+         dump_chart_stats( by_chart );
+         dump_chart_stats( by_batch );
+         );
+      );
+   TRIAL( "threads and shards merge to the same stats",
+      ChartStats* one = make_chart_stats( cf );
+      ChartStats* many = make_chart_stats( cf );
+      ChartStats* shard = make_chart_stats( cf );
+      char* path = g_build_filename( g_get_tmp_dir(), "arf-test.stats", NULL );
+      fill_chart_stats( one, evs, EVCOUNT, 1 );
+      fill_chart_stats( many, evs, 600, 3 );
+      fill_chart_stats( shard, evs + 600, EVCOUNT - 600, 2 );
+      ENSURE( 0 == save_chart_stats( shard, path ) );
+      dump_chart_stats( shard );
+      shard = load_chart_stats( path, cf );
+      ENSURE( shard );
+      if ( shard )
+         {
+         ENSURE( 0 == merge_chart_stats( many, shard ) );
+         dump_chart_stats( shard );
+         }
+      ENSURE( many->count == EVCOUNT );
+      AVOID( memcmp( one->lon, many->lon, sizeof( long ) * one->size ) );
+      ChartConfig* other = make_chart_config( "E", NULL );
+      ENSURE( NULL == load_chart_stats( path, other ) );
+      dump_chart_config( other );
+      remove( path );
+      g_free( path );
+      dump_chart_stats( one );
+      dump_chart_stats( many );
+      );
+   TRIAL( "test_chart_stats() finds what is there",
+      ChartStats* st = make_chart_stats( cf );
+      fill_chart_stats( st, evs, EVCOUNT, 2 );
+      // at random times the Sun is as likely in any sign
+      ChiSquare sun = test_chart_stats( st, NULL, STATS_SIGNS, 0, 0 );
+      ChiSquare mercury = test_chart_stats( st, NULL, STATS_LON, 2, 0 );
+      ChiSquare self = test_chart_stats( st, st, STATS_ASPECTS, 0, 2 );
+      ENSURE( sun.dof == 11 );
+      AVOID( sun.p < 0.0001 );
+      ENSURE( mercury.dof == 359 );
+      AVOID( self.chi2 != 0.0 );
+      AVOID( self.p != 1.0 );
+      ChiSquare none = test_chart_stats( st, NULL, STATS_HOUSES, 0, cf->sys_count );
+      ENSURE( none.dof == 0 );
+      int bins;
+      long* pair = stats_bins( st, STATS_ASPECTS, 0, 1, &bins );
+      long sum = 0;
+      for ( int b = 0; b < bins; b++ ) { sum += pair[b]; }
+      ENSURE( sum == EVCOUNT );
+      dump_chart_stats( st );
+      );
+   end_swiss_ephemeris();
+END_TESTS
+#endif //TEST
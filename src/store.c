@@ -0,0 +1,667 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file store.c
+ *    keeps charts in a sqlite database.
+ *
+ * A ChartStore is a database file with the numbers of many charts, so
+ * they can be kept, queried and made again without the ephemeris. The
+ * tables are:
+ *   - config: the points and house systems of every chart in the store;
+ *   - charts: the event of each chart, and the letters of its systems;
+ *   - points: lon, lat, dist and speed of each point of each chart;
+ *   - cusps: each cusp of each house system of each chart, and, as the
+ *     system '*', the .def of each house Point.
+ *
+ * Points are indexed by (code, lon) and cusps by (sys, house, lon), so
+ * finding the charts with something in a stretch of the zodiac does
+ * not read the whole store (see find_stored_charts()). For queries of
+ * signs, degrees and houses, index_chart_store() makes a ChartIndex
+ * from the tables, without making the charts.
+ *
+ * Charts are written through prepared statements, inside transactions
+ * of STORE_TRANSACTION charts, as writing one chart per transaction is
+ * a thousand times slower. Each chart is also a savepoint, so one that
+ * fails halfway leaves nothing of it behind.
+ **/
+
+#include "arfc.h"
+#include <sqlite3.h>
+
+#define STORE_TRANSACTION 10000
+
+static const char store_schema[] =
+   "PRAGMA journal_mode = WAL;"
+   "PRAGMA synchronous = NORMAL;"
+   "CREATE TABLE IF NOT EXISTS config ( points TEXT, systems TEXT );"
+   "CREATE TABLE IF NOT EXISTS charts ( id INTEGER PRIMARY KEY,"
+   "   name TEXT, jdn REAL, lat REAL, lon REAL, codes TEXT );"
+   "CREATE TABLE IF NOT EXISTS points ( chart INTEGER, code INTEGER,"
+   "   lon REAL, lat REAL, dist REAL, speed REAL,"
+   "   PRIMARY KEY ( chart, code ) ) WITHOUT ROWID;"
+   "CREATE TABLE IF NOT EXISTS cusps ( chart INTEGER, sys TEXT,"
+   "   house INTEGER, lon REAL,"
+   "   PRIMARY KEY ( chart, sys, house ) ) WITHOUT ROWID;"
+   "CREATE INDEX IF NOT EXISTS points_by_lon ON points ( code, lon );"
+   "CREATE INDEX IF NOT EXISTS cusps_by_lon ON cusps ( sys, house, lon );"
+   "CREATE INDEX IF NOT EXISTS charts_by_jdn ON charts ( jdn );"
+   "CREATE INDEX IF NOT EXISTS charts_by_name ON charts ( name );";
+
+// prepared statements, in the order of ChartStore.stmts[]
+enum
+   {
+   ADD_CHART, ADD_POINT, ADD_CUSP,
+   GET_CHART, GET_POINTS, GET_CUSPS,
+   NEXT_CHART, NAMED_CHART, POINTS_AT,
+   STORE_STMTS
+   };
+_Static_assert( STORE_STMTS == G_N_ELEMENTS( ( (ChartStore*) 0 )->stmts ),
+                "ChartStore.stmts has room for each statement" );
+
+static const char* const store_sql[STORE_STMTS] =
+   {
+   "INSERT INTO charts ( name, jdn, lat, lon, codes ) VALUES ( ?, ?, ?, ?, ? );",
+   "INSERT INTO points VALUES ( ?, ?, ?, ?, ?, ? );",
+   "INSERT INTO cusps VALUES ( ?, ?, ?, ? );",
+   "SELECT name, jdn, lat, lon, codes FROM charts WHERE id = ?;",
+   "SELECT code, lon, lat, dist, speed FROM points WHERE chart = ?;",
+   "SELECT sys, house, lon FROM cusps WHERE chart = ?;",
+   "SELECT id FROM charts WHERE id > ? ORDER BY id LIMIT 1;",
+   "SELECT id FROM charts WHERE name = ? ORDER BY id DESC LIMIT 1;",
+   "SELECT chart FROM points WHERE code = ? AND lon >= ? AND lon < ? ORDER BY chart;",
+   };
+
+/** store_failed() complains about the last error of a store. */
+intern
+void
+store_failed( ChartStore* st, char* what )
+   {
+   complain( "chart store: %s: %s\n", what, sqlite3_errmsg( st->db ) );
+   }
+
+/** store_config() reads the config of a store, or writes @p cf to it
+ * if it has none yet.
+ * @return pointer to a ChartConfig, that must be dumped, or NULL.
+ */
+intern
+ChartConfig*
+store_config( ChartStore* st, ChartConfig* cf )
+   {
+   sqlite3_stmt* q;
+   ChartConfig* ret = NULL;
+   if ( SQLITE_OK != sqlite3_prepare_v2( st->db, "SELECT points, systems FROM config;", -1, &q, NULL ) )
+      {
+      return NULL;
+      }
+   int found = SQLITE_ROW == sqlite3_step( q );
+   const char* points = found ? (const char*) sqlite3_column_text( q, 0 ) : NULL;
+   const char* systems = found ? (const char*) sqlite3_column_text( q, 1 ) : NULL;
+   if ( found && ( !points || !systems || !house_systems_known( systems ) ) )
+      {
+      // a config row without its points or systems is no config, and
+      // make_chart_config() would exit on a house system it lacks
+      complain( "chart store: the config is broken\n" );
+      sqlite3_finalize( q );
+      return NULL;
+      }
+   if ( found )
+      {
+      // points are kept as "0,1,2"
+      int codes[strlen( points ) / 2 + 2];
+      int n = 0;
+      for ( const char* p = points; *p; )
+         {
+         char* end;
+         codes[n++] = strtol( p, &end, 10 );
+         p = *end ? end + 1 : end;
+         }
+      codes[n] = SE_END;
+      ret = make_chart_config( (char*) systems, codes );
+      }
+   sqlite3_finalize( q );
+   if ( ret || !cf ) { return ret; }
+   char list[16 * cf->pt_count + 1];
+   char* p = list;
+   *p = '\0';
+   for ( int i = 0; i < cf->pt_count; i++ )
+      {
+      p += sprintf( p, i ? ",%d" : "%d", cf->pts[i] );
+      }
+   if ( SQLITE_OK != sqlite3_prepare_v2( st->db, "INSERT INTO config VALUES ( ?, ? );", -1, &q, NULL ) )
+      {
+      return NULL;
+      }
+   sqlite3_bind_text( q, 1, list, -1, SQLITE_TRANSIENT );
+   sqlite3_bind_text( q, 2, cf->systems, -1, SQLITE_TRANSIENT );
+   if ( SQLITE_DONE == sqlite3_step( q ) )
+      {
+      ret = make_chart_config( cf->systems, cf->pts );
+      }
+   sqlite3_finalize( q );
+   return ret;
+   }
+
+/** open_chart_store() opens a store, making it if needed.
+ * @param path Name of the database file.
+ * @param cf Pointer to the ChartConfig of the charts to store in a new
+ *        store, or NULL to only open one that exists. A store that
+ *        exists keeps its own config, see ChartStore.cf.
+ *
+ * @return pointer to a ChartStore, that must be dumped, or NULL.
+ */
+extern
+ChartStore*
+open_chart_store( char* path, ChartConfig* cf )
+   {
+   ChartStore* st;
+   st = calloc( 1, sizeof( ChartStore ) );
+   int flags = SQLITE_OPEN_READWRITE | ( cf ? SQLITE_OPEN_CREATE : 0 );
+   if ( SQLITE_OK != sqlite3_open_v2( path, (sqlite3**) &st->db, flags, NULL ) )
+      {
+      store_failed( st, path );
+      sqlite3_close( st->db );
+      free( st );
+      return NULL;
+      }
+   int ok = SQLITE_OK == sqlite3_exec( st->db, store_schema, NULL, NULL, NULL );
+   if ( ok ) { st->cf = store_config( st, cf ); }
+   for ( int k = 0; ok && st->cf && k < STORE_STMTS; k++ )
+      {
+      ok = SQLITE_OK == sqlite3_prepare_v3( st->db, store_sql[k], -1,
+                           SQLITE_PREPARE_PERSISTENT, (sqlite3_stmt**) st->stmts + k, NULL );
+      }
+   if ( !ok || !st->cf )
+      {
+      store_failed( st, path );
+      dump_chart_store( st );
+      return NULL;
+      }
+   return st;
+   }
+
+/** flush_chart_store() commits the charts stored so far. */
+extern
+void
+flush_chart_store( ChartStore* st )
+   {
+   if ( !st->open ) { return; }
+   if ( SQLITE_OK != sqlite3_exec( st->db, "COMMIT;", NULL, NULL, NULL ) )
+      {
+      store_failed( st, "commit" );
+      }
+   st->pending = 0;
+   st->open = FALSE;
+   }
+
+/** dump_chart_store() commits what is pending and closes a store.
+ * @param st Pointer to a ChartStore.
+ */
+extern
+void
+dump_chart_store( ChartStore* st )
+   {
+   flush_chart_store( st );
+   for ( int k = 0; k < STORE_STMTS; k++ )
+      {
+      sqlite3_finalize( st->stmts[k] ); // no-op on NULL
+      }
+   sqlite3_close( st->db );
+   if ( st->cf ) { dump_chart_config( st->cf ); }
+   free( st );
+   }
+
+/** done() steps a statement that gives no rows, and resets it. */
+intern
+int
+done( sqlite3_stmt* q )
+   {
+   int rc = sqlite3_step( q );
+   sqlite3_reset( q );
+   return rc == SQLITE_DONE;
+   }
+
+/** store_chart() adds a chart to a store. It is committed with the
+ * next STORE_TRANSACTION charts, or by flush_chart_store().
+ * @param st Pointer to a ChartStore.
+ * @param c Pointer to a Chart, made with the points and house systems
+ *        of the store.
+ *
+ * @return the id of the chart in the store, or -1 on error.
+ */
+extern
+long
+store_chart( ChartStore* st, Chart* c )
+   {
+   ChartConfig* cf = st->cf;
+   int fits = c->pt_count == cf->pt_count && c->sys_count == cf->sys_count;
+   for ( int i = 0; fits && i < c->pt_count; i++ ) { fits = c->points[i].code == cf->pts[i]; }
+   if ( !fits )
+      {
+      complain( "chart store: %s has other points or houses\n", c->ev->name );
+      return -1;
+      }
+   if ( !st->open )
+      {
+      if ( SQLITE_OK != sqlite3_exec( st->db, "BEGIN;", NULL, NULL, NULL ) )
+         {
+         store_failed( st, "begin" );
+         return -1;
+         }
+      st->open = TRUE;
+      }
+   if ( SQLITE_OK != sqlite3_exec( st->db, "SAVEPOINT chart;", NULL, NULL, NULL ) )
+      {
+      store_failed( st, "savepoint" );
+      return -1;
+      }
+   sqlite3_stmt** q = (sqlite3_stmt**) st->stmts;
+   sqlite3_bind_text( q[ADD_CHART], 1, c->ev->name, -1, SQLITE_STATIC );
+   sqlite3_bind_double( q[ADD_CHART], 2, c->ev->jdn );
+   sqlite3_bind_double( q[ADD_CHART], 3, c->ev->lat );
+   sqlite3_bind_double( q[ADD_CHART], 4, c->ev->lon );
+   sqlite3_bind_text( q[ADD_CHART], 5, c->sys_codes, c->sys_count, SQLITE_STATIC );
+   int ok = done( q[ADD_CHART] );
+   long id = sqlite3_last_insert_rowid( st->db );
+   for ( int i = 0; ok && i < c->pt_count; i++ )
+      {
+      Point* p = c->points + i;
+      sqlite3_bind_int64( q[ADD_POINT], 1, id );
+      sqlite3_bind_int( q[ADD_POINT], 2, p->code );
+      for ( int f = 0; f < 4; f++ )
+         {
+         // points the ephemeris failed on are kept as NULL
+         if ( strcmp( p->symbol, "?" ) ) { sqlite3_bind_double( q[ADD_POINT], 3+f, p->data[f] ); }
+         else { sqlite3_bind_null( q[ADD_POINT], 3+f ); }
+         }
+      ok = done( q[ADD_POINT] );
+      }
+   for ( int s = -1; ok && s < c->sys_count; s++ )
+      {
+      char sys[2] = { s < 0 ? '*' : cf->systems[s], '\0' };
+      for ( int h = 1; ok && h <= 12; h++ )
+         {
+         sqlite3_bind_int64( q[ADD_CUSP], 1, id );
+         sqlite3_bind_text( q[ADD_CUSP], 2, sys, 1, SQLITE_TRANSIENT );
+         sqlite3_bind_int( q[ADD_CUSP], 3, h );
+         sqlite3_bind_double( q[ADD_CUSP], 4, s < 0 ? c->house( h ).def : c->housealt( h, s ) );
+         ok = done( q[ADD_CUSP] );
+         }
+      }
+   if ( !ok )
+      {
+      store_failed( st, "store chart" );
+      // the rows of this chart so far go, the other pending charts stay
+      sqlite3_exec( st->db, "ROLLBACK TO chart; RELEASE chart;", NULL, NULL, NULL );
+      return -1;
+      }
+   sqlite3_exec( st->db, "RELEASE chart;", NULL, NULL, NULL );
+   if ( ++st->pending == STORE_TRANSACTION ) { flush_chart_store( st ); }
+   return id;
+   }
+
+/** load_chart() makes a chart again from a store, without the
+ * ephemeris.
+ * @param st Pointer to a ChartStore.
+ * @param id Id of the chart, as from store_chart().
+ *
+ * @return a pointer to a Chart structure, or NULL if there is none.
+ */
+extern
+Chart*
+load_chart( ChartStore* st, long id )
+   {
+   ChartConfig* cf = st->cf;
+   sqlite3_stmt** q = (sqlite3_stmt**) st->stmts;
+   double pts[4 * cf->pt_count];
+   double cusps[12 * cf->sys_count + 1];
+   double defs[12];
+   char codes[cf->sys_count + 1];
+   char name[NAME_SIZE];
+   Event ev = { .name = name };
+   sqlite3_bind_int64( q[GET_CHART], 1, id );
+   int found = SQLITE_ROW == sqlite3_step( q[GET_CHART] );
+   if ( found )
+      {
+      const char* stored = (const char*) sqlite3_column_text( q[GET_CHART], 0 );
+      g_strlcpy( name, stored ? stored : "", NAME_SIZE );
+      ev.jdn = sqlite3_column_double( q[GET_CHART], 1 );
+      ev.lat = sqlite3_column_double( q[GET_CHART], 2 );
+      ev.lon = sqlite3_column_double( q[GET_CHART], 3 );
+      memset( codes, '?', cf->sys_count );
+      const void* text = sqlite3_column_text( q[GET_CHART], 4 );
+      if ( text ) { memcpy( codes, text, MIN( cf->sys_count, sqlite3_column_bytes( q[GET_CHART], 4 ) ) ); }
+      codes[cf->sys_count] = '\0';
+      }
+   sqlite3_reset( q[GET_CHART] );
+   if ( !found ) { return NULL; }
+   for ( int i = 0; i < 4 * cf->pt_count; i++ ) { pts[i] = NAN; }
+   sqlite3_bind_int64( q[GET_POINTS], 1, id );
+   while ( SQLITE_ROW == sqlite3_step( q[GET_POINTS] ) )
+      {
+      int code = sqlite3_column_int( q[GET_POINTS], 0 );
+      for ( int i = 0; i < cf->pt_count; i++ )
+         {
+         if ( cf->pts[i] != code ) { continue; }
+         for ( int f = 0; f < 4; f++ )
+            {
+            pts[4*i + f] = SQLITE_NULL == sqlite3_column_type( q[GET_POINTS], 1+f )
+                           ? NAN : sqlite3_column_double( q[GET_POINTS], 1+f );
+            }
+         }
+      }
+   sqlite3_reset( q[GET_POINTS] );
+   for ( int i = 0; i < 12; i++ ) { defs[i] = 0.0; }
+   for ( int i = 0; i < 12 * cf->sys_count; i++ ) { cusps[i] = NAN; }
+   sqlite3_bind_int64( q[GET_CUSPS], 1, id );
+   while ( SQLITE_ROW == sqlite3_step( q[GET_CUSPS] ) )
+      {
+      const char* text = (const char*) sqlite3_column_text( q[GET_CUSPS], 0 );
+      char sys = text ? text[0] : '\0';
+      int h = sqlite3_column_int( q[GET_CUSPS], 1 );
+      // cusps of failed systems are NAN, which sqlite keeps as NULL
+      double lon = SQLITE_NULL == sqlite3_column_type( q[GET_CUSPS], 2 )
+                   ? NAN : sqlite3_column_double( q[GET_CUSPS], 2 );
+      if ( !sys || h < 1 || h > 12 ) { continue; }
+      if ( sys == '*' ) { defs[h-1] = lon; continue; }
+      char* at = strchr( cf->systems, sys );
+      if ( at ) { cusps[12 * ( at - cf->systems ) + h-1] = lon; }
+      }
+   sqlite3_reset( q[GET_CUSPS] );
+   return make_chart_of_numbers( cf, &ev, pts, cusps, codes, defs );
+   }
+
+/** next_stored_chart() is the id of the chart after @p id in a store,
+ * so next_stored_chart( st, 0 ) is the first one.
+ *
+ * @return an id, or 0 if there are no more charts.
+ */
+extern
+long
+next_stored_chart( ChartStore* st, long id )
+   {
+   sqlite3_stmt* q = st->stmts[NEXT_CHART];
+   sqlite3_bind_int64( q, 1, id );
+   long ret = SQLITE_ROW == sqlite3_step( q ) ? sqlite3_column_int64( q, 0 ) : 0;
+   sqlite3_reset( q );
+   return ret;
+   }
+
+/** find_chart_named() is the id of the last chart stored with a name.
+ *
+ * @return an id, or 0 if there is no such chart.
+ */
+extern
+long
+find_chart_named( ChartStore* st, char* name )
+   {
+   sqlite3_stmt* q = st->stmts[NAMED_CHART];
+   sqlite3_bind_text( q, 1, name, -1, SQLITE_STATIC );
+   long ret = SQLITE_ROW == sqlite3_step( q ) ? sqlite3_column_int64( q, 0 ) : 0;
+   sqlite3_reset( q );
+   return ret;
+   }
+
+/** find_stored_charts() finds the charts with a point in a stretch of
+ * the zodiac, using the index of points by longitude.
+ * @param st Pointer to a ChartStore.
+ * @param code Swiss Ephemeris code of the point.
+ * @param from, to The stretch, from included, going forward; if @p to
+ *        is less than @p from, it goes over 0 Aries.
+ * @param ids Gets the ids of the charts found, in order.
+ * @param max Room in @p ids.
+ *
+ * @return number of charts found, which can be more than @p max.
+ */
+extern
+int
+find_stored_charts( ChartStore* st, int code, double from, double to,
+                    long* ids, int max )
+   {
+   sqlite3_stmt* q = st->stmts[POINTS_AT];
+   int count = 0;
+   double arcs[2][2] = { { from, to }, { 0.0, to } };
+   int parts = 1;
+   if ( to < from )
+      {
+      arcs[0][1] = 360.0;
+      parts = 2;
+      }
+   for ( int a = 0; a < parts; a++ )
+      {
+      sqlite3_bind_int( q, 1, code );
+      sqlite3_bind_double( q, 2, arcs[a][0] );
+      sqlite3_bind_double( q, 3, arcs[a][1] );
+      while ( SQLITE_ROW == sqlite3_step( q ) )
+         {
+         if ( count < max ) { ids[count] = sqlite3_column_int64( q, 0 ); }
+         count++;
+         }
+      sqlite3_reset( q );
+      }
+   return count;
+   }
+
+/** index_chart_store() indexes every chart of a store straight from its
+ * points and cusps tables, in one scan of each, without making any
+ * chart again.
+ * @param st Pointer to a ChartStore.
+ *
+ * @return pointer to a ChartIndex, with the ids of the store, that must
+ *         be dumped, or NULL on error.
+ */
+extern
+ChartIndex*
+index_chart_store( ChartStore* st )
+   {
+   static const char* const sql[3] =
+      {
+      "SELECT id, codes FROM charts ORDER BY id;",
+      "SELECT chart, code, lon FROM points ORDER BY chart;",
+      "SELECT chart, sys, house, lon FROM cusps WHERE sys <> '*' ORDER BY chart;",
+      };
+   ChartConfig* cf = st->cf;
+   sqlite3_stmt* q[3] = { NULL };
+   int ok = 1;
+   for ( int k = 0; ok && k < 3; k++ )
+      {
+      ok = SQLITE_OK == sqlite3_prepare_v2( st->db, sql[k], -1, q + k, NULL );
+      }
+   ChartIndex* ix = ok ? make_chart_index( cf ) : NULL;
+   double lons[cf->pt_count + 1];
+   double cusps[12 * cf->sys_count + 1];
+   char codes[cf->sys_count + 1];
+   int pts_left = ok && SQLITE_ROW == sqlite3_step( q[1] );
+   int cusps_left = ok && SQLITE_ROW == sqlite3_step( q[2] );
+   int rc = SQLITE_DONE;
+   while ( ok && SQLITE_ROW == ( rc = sqlite3_step( q[0] ) ) )
+      {
+      long id = sqlite3_column_int64( q[0], 0 );
+      memset( codes, '?', cf->sys_count );
+      const void* text = sqlite3_column_text( q[0], 1 );
+      if ( text ) { memcpy( codes, text, MIN( cf->sys_count, sqlite3_column_bytes( q[0], 1 ) ) ); }
+      codes[cf->sys_count] = '\0';
+      for ( int i = 0; i < cf->pt_count; i++ ) { lons[i] = NAN; }
+      for ( int i = 0; i < 12 * cf->sys_count; i++ ) { cusps[i] = NAN; }
+      // the rows of each table come by chart, as the charts do
+      for ( ; pts_left && sqlite3_column_int64( q[1], 0 ) <= id;
+            pts_left = SQLITE_ROW == sqlite3_step( q[1] ) )
+         {
+         if ( sqlite3_column_int64( q[1], 0 ) < id ) { continue; }
+         if ( SQLITE_NULL == sqlite3_column_type( q[1], 2 ) ) { continue; }
+         int code = sqlite3_column_int( q[1], 1 );
+         for ( int i = 0; i < cf->pt_count; i++ )
+            {
+            if ( cf->pts[i] == code ) { lons[i] = sqlite3_column_double( q[1], 2 ); }
+            }
+         }
+      for ( ; cusps_left && sqlite3_column_int64( q[2], 0 ) <= id;
+            cusps_left = SQLITE_ROW == sqlite3_step( q[2] ) )
+         {
+         if ( sqlite3_column_int64( q[2], 0 ) < id ) { continue; }
+         const char* sys = (const char*) sqlite3_column_text( q[2], 1 );
+         char* at = sys && sys[0] ? strchr( cf->systems, sys[0] ) : NULL;
+         int h = sqlite3_column_int( q[2], 2 );
+         if ( !at || h < 1 || h > 12 || SQLITE_NULL == sqlite3_column_type( q[2], 3 ) ) { continue; }
+         cusps[12 * ( at - cf->systems ) + h-1] = sqlite3_column_double( q[2], 3 );
+         }
+      index_numbers( ix, id, lons, cusps, codes );
+      }
+   if ( !ok || rc != SQLITE_DONE )
+      {
+      store_failed( st, "index" );
+      if ( ix ) { dump_chart_index( ix ); }
+      ix = NULL;
+      }
+   for ( int k = 0; k < 3; k++ ) { sqlite3_finalize( q[k] ); }
+   return ix;
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+#define EVCOUNT 60
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( "PKR", NULL );
+   ChartConfig* cf = get_chart_config();
+   char* path = g_build_filename( g_get_tmp_dir(), "arf-test.db", NULL );
+   Chart* cs[EVCOUNT];
+   long ids[EVCOUNT];
+   for ( int i = 0; i < EVCOUNT; i++ )
+      {
+      double jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+      double lat = g_test_rand_double_range( -60.0, 60.0 );
+      double lon = g_test_rand_double_range( -180.0, 180.0 );
+      cs[i] = make_chart( i % 2 ? "odd" : "even", jdn, lat, lon );
+      }
+   remove( path );
+   //
+   TRIAL( "no leaks on open_chart_store()",
+      BOUND(
+         ChartStore* st = open_chart_store( path, cf );
+         PROBE( st );
+         ENSURE( st->cf->pt_count == cf->pt_count );
+         dump_chart_store( st );
+         );
+      );
+   TRIAL( "store_chart() gives new ids",
+      ChartStore* st = open_chart_store( path, cf );
+      for ( int i = 0; i < EVCOUNT; i++ )
+         {
+         ids[i] = store_chart( st, cs[i] );
+         AVOID( ids[i] <= 0 );
+         AVOID( i && ids[i] <= ids[i-1] );
+         }
+      dump_chart_store( st );
+      );
+   TRIAL( "load_chart() gives back the same charts",
+      ChartStore* st = open_chart_store( path, NULL );
+      PROBE( st );
+      for ( int i = 0; i < EVCOUNT; i++ )
+         {
+         Chart* c = load_chart( st, ids[i] );
+         ENSURE( c );
+         if ( !c ) { break; }
+         AVOID( strcmp( c->ev->name, cs[i]->ev->name ) );
+         AVOID( c->ev->jdn != cs[i]->ev->jdn );
+         AVOID( memcmp( c->cusps, cs[i]->cusps,
+                        sizeof( Point ) * ( c->pt_count + c->cp_count ) ) );
+         AVOID( memcmp( c->sys_cusps, cs[i]->sys_cusps, sizeof( double ) * 12 * c->sys_count ) );
+         AVOID( c->asp_count != cs[i]->asp_count );
+         dump_chart( c );
+         }
+      ENSURE( NULL == load_chart( st, ids[EVCOUNT-1] + 1 ) );
+      ENSURE( next_stored_chart( st, 0 ) == ids[0] );
+      ENSURE( next_stored_chart( st, ids[EVCOUNT-1] ) == 0 );
+      ENSURE( find_chart_named( st, "odd" ) == ids[EVCOUNT-1] );
+      dump_chart_store( st );
+      );
+   TRIAL( "find_stored_charts() equals a scan",
+      ChartStore* st = open_chart_store( path, NULL );
+      long found[EVCOUNT];
+      for ( int t = 0; t < 50; t++ )
+         {
+         double from = g_test_rand_double_range( 0.0, 360.0 );
+         double to = g_test_rand_double_range( 0.0, 360.0 );
+         int n = find_stored_charts( st, SE_MOON, from, to, found, EVCOUNT );
+         int want = 0;
+         for ( int i = 0; i < EVCOUNT; i++ )
+            {
+            double lon = cs[i]->points[1].lon;
+            int in = from <= to ? ( lon >= from && lon < to ) : ( lon >= from || lon < to );
+            if ( !in ) { continue; }
+            want++;
+            int hit = 0;
+            for ( int k = 0; k < n; k++ ) { hit |= found[k] == ids[i]; }
+            AVOID( !hit );
+            }
+         AVOID( n != want );
+         }
+      dump_chart_store( st );
+      );
+   TRIAL( "index_chart_store() finds what an index of the charts does",
+      ChartStore* st = open_chart_store( path, NULL );
+      ChartIndex* stored = index_chart_store( st );
+      ChartIndex* made = make_chart_index( st->cf );
+      for ( int i = 0; i < EVCOUNT; i++ ) { index_chart( made, cs[i], ids[i] ); }
+      ENSURE( stored && stored->count == EVCOUNT );
+      long found[EVCOUNT];
+      long want[EVCOUNT];
+      char* queries[] = { "Sun fire", "Moon 0-180", "Mars angular K", "Venus house 1 P, Sun earth" };
+      for ( int t = 0; stored && t < G_N_ELEMENTS( queries ); t++ )
+         {
+         long n = query_chart_index( stored, queries[t], found, EVCOUNT );
+         ENSURE( n == query_chart_index( made, queries[t], want, EVCOUNT ) );
+         AVOID( memcmp( found, want, sizeof( long ) * MIN( n, EVCOUNT ) ) );
+         }
+      if ( stored ) { dump_chart_index( stored ); }
+      dump_chart_index( made );
+      dump_chart_store( st );
+      );
+   TRIAL( "a chart that fails halfway leaves nothing behind",
+      ChartStore* st = open_chart_store( path, NULL );
+      sqlite3_exec( st->db, "CREATE TEMP TRIGGER no_jupiter BEFORE INSERT ON points"
+                    " WHEN NEW.code = 5 BEGIN SELECT RAISE( ABORT, 'no' ); END;",
+                    NULL, NULL, NULL );
+      ENSURE( -1 == store_chart( st, cs[0] ) );
+      sqlite3_exec( st->db, "DROP TRIGGER no_jupiter;", NULL, NULL, NULL );
+      long id = store_chart( st, cs[1] );
+      AVOID( id <= 0 );
+      dump_chart_store( st );
+      st = open_chart_store( path, NULL );
+      ENSURE( next_stored_chart( st, ids[EVCOUNT-1] ) == id );
+      ENSURE( next_stored_chart( st, id ) == 0 );
+      Chart* c = load_chart( st, id );
+      ENSURE( c && 0 == strcmp( c->ev->name, cs[1]->ev->name ) );
+      if ( c ) { dump_chart( c ); }
+      dump_chart_store( st );
+      );
+   TRIAL( "rows with NULLs load, without crashing",
+      ChartStore* st = open_chart_store( path, NULL );
+      char sql[100];
+      sprintf( sql, "UPDATE charts SET name = NULL, codes = NULL WHERE id = %ld;", ids[0] );
+      ENSURE( SQLITE_OK == sqlite3_exec( st->db, sql, NULL, NULL, NULL ) );
+      sprintf( sql, "UPDATE cusps SET sys = NULL, lon = NULL WHERE chart = %ld;", ids[0] );
+      ENSURE( SQLITE_OK == sqlite3_exec( st->db, sql, NULL, NULL, NULL ) );
+      Chart* c = load_chart( st, ids[0] );
+      ENSURE( c && c->ev->name[0] == '\0' );
+      if ( c ) { AVOID( !isnan( c->housealt( 1, 0 ) ) ); dump_chart( c ); }
+      dump_chart_store( st );
+      );
+   TRIAL( "charts of another config are not stored",
+      ChartStore* st = open_chart_store( path, NULL );
+      ChartConfig* other = make_chart_config( "E", NULL );
+      Chart* c = make_chart_with( other, "other", 2451545.0, 0.0, 0.0 );
+      ENSURE( -1 == store_chart( st, c ) );
+      dump_chart( c );
+      dump_chart_config( other );
+      dump_chart_store( st );
+      );
+   for ( int i = 0; i < EVCOUNT; i++ ) { dump_chart( cs[i] ); }
+   remove( path );
+   g_free( path );
+   end_swiss_ephemeris();
+END_TESTS
+#endif //TEST
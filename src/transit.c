@@ -0,0 +1,483 @@
+/* ARF astrology research framework
+ *     # a kind of wrapper for the Swiss Ephemeris
+ * (by) Marcio Baraco <marciorps@gmail.com>
+ */
+/** @file transit.c
+ *    finds transits of moving points over a natal chart.
+ *
+ * A transit is the moment a moving point makes an exact aspect to a
+ * point or house cusp of a natal chart. Every aspect of every natal
+ * target is a longitude the moving point may cross, so each moving
+ * point is scanned only once over the whole span of time, against all
+ * those longitudes together (see find_crossings() in astro.c).
+ **/
+
+#include "arfc.h"
+
+/** struct TransitList collects the transits of one search */
+typedef struct TransitList
+   {
+   Transit* list;
+   int count;
+   int size;
+   // what each target longitude stands for
+   int* target;
+   int* def; // index in aspect_defs[]
+   int point;
+   }
+TransitList;
+
+intern
+void
+add_transit( double jdn, int k, void* data )
+   {
+   TransitList* tl = data;
+   if ( tl->count == tl->size )
+      {
+      tl->size *= 2;
+      tl->list = realloc( tl->list, sizeof( Transit ) * tl->size );
+      enforce( "grow transit list", tl->list );
+      }
+   const AspectDef* a = aspect_defs + tl->def[k];
+   Transit* t = tl->list + tl->count++;
+   t->jdn = jdn;
+   t->point = tl->point;
+   t->target = tl->target[k];
+   t->kind = a->kind;
+   t->angle = a->angle;
+   g_strlcpy( t->symbol, a->symbol, SYMB_SIZE );
+   }
+
+intern
+int
+cmp_transits( const void* a, const void* b )
+   {
+   const Transit* x = a;
+   const Transit* y = b;
+   return ( x->jdn > y->jdn ) - ( x->jdn < y->jdn );
+   }
+
+/** find_transits() finds every exact aspect that moving points make to
+ * the points and house cusps of a natal chart, within a span of time.
+ * @param natal Pointer to a Chart.
+ * @param from, to Span of time, in JDN format.
+ * @param ptlist Array of codes of the moving points, terminated by
+ *        SE_END, or NULL for the same points as the chart.
+ * @param count If not NULL, gets the number of transits found, or -1
+ *        on an ephemeris error.
+ *
+ * @return Pointer to an array of Transits in order of time, terminated
+ *         by .kind==0, that must be freed, or NULL on an ephemeris error.
+ */
+extern
+Transit*
+find_transits( Chart* natal, double from, double to, int* ptlist, int* count )
+   {
+   int ndefs = 0;
+   while ( aspect_defs[ndefs].kind ) { ndefs++; }
+   // both sides of each aspect, of each natal point and cusp
+   int room = 2 * ndefs * ( natal->pt_count + 12 );
+   double* lons = malloc( sizeof(double) * room );
+   TransitList tl = { .count = 0, .size = 64 };
+   tl.target = malloc( sizeof(int) * room );
+   tl.def = malloc( sizeof(int) * room );
+   tl.list = malloc( sizeof( Transit ) * tl.size );
+   int n = 0;
+   for ( int i = -12; i < natal->pt_count; i++ )
+      {
+      for ( int m = 0; m < ndefs; m++ )
+         {
+         double a = aspect_defs[m].angle;
+         for ( int side = 0; side < 2; side++ )
+            {
+            // conjunction and opposition are the same on both sides
+            if ( side && ( a == 0.0 || a == 180.0 ) ) { continue; }
+            lons[n] = swe_degnorm( natal->points[i].lon + ( side ? -a : a ) );
+            tl.target[n] = i;
+            tl.def[n] = m;
+            n++;
+            }
+         }
+      }
+   int stat = 0;
+   for ( int p = 0; stat >= 0 && ( ptlist ? ptlist[p] != SE_END : p < natal->pt_count ); p++ )
+      {
+      tl.point = ptlist ? ptlist[p] : natal->points[p].code;
+      stat = find_crossings( tl.point, from, to, lons, n, add_transit, &tl );
+      }
+   free( lons );
+   free( tl.target );
+   free( tl.def );
+   if ( stat < 0 )
+      {
+      free( tl.list );
+      if ( count ) { *count = -1; }
+      return NULL;
+      }
+   qsort( tl.list, tl.count, sizeof( Transit ), cmp_transits );
+   if ( count ) { *count = tl.count; }
+   Transit* ret = realloc( tl.list, sizeof( Transit ) * ( tl.count + 1 ) );
+   enforce( "shrink transit list", ret );
+   ret[tl.count] = ( Transit ) { .jdn = NAN, .kind = 0 };
+   return ret;
+   }
+
+//---- TIMELINES FOR MANY CHARTS ------------------------------------//
+//-- For a whole dataset, the moving points are stepped through once.
+//-- All natal longitudes are kept sorted, so each piece of motion finds
+//-- the targets it passes by binary search, one search per side of each
+//-- aspect. The moment of each hit comes from the cubic (Hermite) curve
+//-- through the lon and speed at both ends of the piece, without more
+//-- ephemeris calls; with steps of at most TIMELINE_STEP days this is
+//-- well under a second of time.
+#define TIMELINE_STEP 1.0
+
+/** struct NatalLon is one entry of the sorted index of natal longitudes */
+typedef struct NatalLon
+   {
+   double lon;
+   int chart;
+   int target; // as Transit.target
+   }
+NatalLon;
+
+/** struct Hit is a transit and the chart it belongs to */
+typedef struct Hit
+   {
+   int chart;
+   Transit tr;
+   }
+Hit;
+
+/** struct Timeline is the state of make_transit_timeline() */
+typedef struct Timeline
+   {
+   NatalLon* index;
+   int n;
+   int point;
+   Hit* hits;
+   int count;
+   int size;
+   }
+Timeline;
+
+intern
+int
+cmp_natal_lons( const void* a, const void* b )
+   {
+   const NatalLon* x = a;
+   const NatalLon* y = b;
+   return ( x->lon > y->lon ) - ( x->lon < y->lon );
+   }
+
+intern
+int
+cmp_hits( const void* a, const void* b )
+   {
+   const Hit* x = a;
+   const Hit* y = b;
+   if ( x->chart != y->chart ) { return x->chart - y->chart; }
+   return ( x->tr.jdn > y->tr.jdn ) - ( x->tr.jdn < y->tr.jdn );
+   }
+
+/** hermite_time() is when the cubic through two Motions is at @p lon,
+ * which must be between them (unwrapped, as a.lon + some degrees). */
+intern
+double
+hermite_time( Motion a, Motion b, double lon1, double lon )
+   {
+   double h = b.t - a.t;
+   double lo = 0.0, hi = 1.0, x = ( lon - a.lon ) / ( lon1 - a.lon );
+   double up = lon1 > a.lon ? 1.0 : -1.0;
+   for ( int i = 0; i < 50; i++ )
+      {
+      double x2 = x*x, x3 = x2*x;
+      double f = ( 2*x3 - 3*x2 + 1 ) * a.lon + ( x3 - 2*x2 + x ) * h * a.speed
+               + ( -2*x3 + 3*x2 ) * lon1 + ( x3 - x2 ) * h * b.speed - lon;
+      double df = ( 6*x2 - 6*x ) * a.lon + ( 3*x2 - 4*x + 1 ) * h * a.speed
+                + ( -6*x2 + 6*x ) * lon1 + ( 3*x2 - 2*x ) * h * b.speed;
+      if ( f * up < 0.0 ) { lo = x; } else { hi = x; }
+      double next = x - f / df;
+      if ( !( next > lo && next < hi ) ) { next = ( lo + hi ) / 2.0; }
+      if ( fabs( next - x ) * h < 1e-9 ) { x = next; break; }
+      x = next;
+      }
+   return a.t + x * h;
+   }
+
+intern
+void
+add_hit( Timeline* tl, int chart, Transit tr )
+   {
+   if ( tl->count == tl->size )
+      {
+      tl->size *= 2;
+      tl->hits = realloc( tl->hits, sizeof( Hit ) * tl->size );
+      enforce( "grow transit timeline", tl->hits );
+      }
+   tl->hits[tl->count++] = ( Hit ) { chart, tr };
+   }
+
+/** first_at_least() is the first entry of the index with lon >= @p lon */
+intern
+int
+first_at_least( NatalLon* index, int n, double lon )
+   {
+   int a = 0, b = n;
+   while ( a < b )
+      {
+      int mid = ( a + b ) / 2;
+      if ( index[mid].lon < lon ) { a = mid + 1; } else { b = mid; }
+      }
+   return a;
+   }
+
+intern
+void
+hits_of_piece( Motion a, Motion b, void* data )
+   {
+   Timeline* tl = data;
+   double lon1 = a.lon + swe_difdeg2n( b.lon, a.lon ); // unwrapped
+   double width = fabs( lon1 - a.lon );
+   double low = MIN( a.lon, lon1 );
+   if ( width == 0.0 || tl->n == 0 ) { return; }
+   for ( int m = 0; aspect_defs[m].kind; m++ )
+      {
+      double ang = aspect_defs[m].angle;
+      for ( int side = 0; side < 2; side++ )
+         {
+         if ( side && ( ang == 0.0 || ang == 180.0 ) ) { continue; }
+         // natal longitudes that this piece makes the aspect to
+         double shift = side ? -ang : ang;
+         double from = swe_degnorm( low - shift );
+         int k = first_at_least( tl->index, tl->n, from );
+         for ( int seen = 0; seen < tl->n; seen++, k++ )
+            {
+            double turn = k >= tl->n ? 360.0 : 0.0;
+            NatalLon* e = tl->index + k % tl->n;
+            double off = e->lon + turn - from;
+            if ( off >= width ) { break; }
+            double t = hermite_time( a, b, lon1, low + off );
+            Transit tr = { t, tl->point, e->target, aspect_defs[m].kind, ang };
+            g_strlcpy( tr.symbol, aspect_defs[m].symbol, SYMB_SIZE );
+            add_hit( tl, e->chart, tr );
+            }
+         }
+      }
+   }
+
+/** make_transit_timeline() finds the transits over every chart of a
+ * batch at once, stepping through the moving points only once.
+ * @param b Pointer to a ChartBatch with the natal charts.
+ * @param from, to Span of time, in JDN format.
+ * @param ptlist Array of codes of the moving points, terminated by
+ *        SE_END, or NULL for the points of the batch.
+ *
+ * @return Pointer to a TransitTimeline, with the transits of each
+ *         chart in order of time, that must be dumped.
+ */
+extern
+TransitTimeline*
+make_transit_timeline( ChartBatch* b, double from, double to, int* ptlist )
+   {
+   ChartConfig* cf = b->cf;
+   int per_chart = cf->pt_count + ( cf->sys_count ? 12 : 0 );
+   Timeline tl = { .n = 0, .count = 0, .size = 1024 };
+   tl.index = malloc( sizeof( NatalLon ) * MAX( 1, per_chart * b->count ) );
+   tl.hits = malloc( sizeof( Hit ) * tl.size );
+   for ( int k = 0; k < b->count; k++ )
+      {
+      for ( int i = 0; i < cf->pt_count; i++ )
+         {
+         double lon = batch_col( b, i, 0 )[k];
+         if ( !isnan( lon ) ) { tl.index[tl.n++] = ( NatalLon ) { lon, k, i }; }
+         }
+      for ( int h = 1; cf->sys_count && h <= 12; h++ )
+         {
+         double lon = batch_house( b, 0, h )[k];
+         if ( !isnan( lon ) ) { tl.index[tl.n++] = ( NatalLon ) { lon, k, -h }; }
+         }
+      }
+   qsort( tl.index, tl.n, sizeof( NatalLon ), cmp_natal_lons );
+   for ( int p = 0; ; p++ )
+      {
+      tl.point = ptlist ? ptlist[p] : cf->pts[p];
+      if ( tl.point == SE_END ) { break; }
+      scan_motion( tl.point, from, to, TIMELINE_STEP, hits_of_piece, &tl );
+      }
+   free( tl.index );
+   qsort( tl.hits, tl.count, sizeof( Hit ), cmp_hits );
+   // one block: the table of charts, then each chart's transits and end
+   TransitTimeline* ret;
+   ret = malloc( sizeof( TransitTimeline ) + sizeof( Transit* ) * b->count
+                 + sizeof( int ) * b->count
+                 + sizeof( Transit ) * ( tl.count + b->count ) );
+   ret->chart_count = b->count;
+   ret->charts = (Transit**) ( ret + 1 );
+   ret->counts = (int*) ( ret->charts + b->count );
+   Transit* tr = (Transit*) ( ret->counts + b->count );
+   for ( int k = 0, h = 0; k < b->count; k++ )
+      {
+      ret->charts[k] = tr;
+      ret->counts[k] = 0;
+      for ( ; h < tl.count && tl.hits[h].chart == k; h++ )
+         {
+         *tr++ = tl.hits[h].tr;
+         ret->counts[k]++;
+         }
+      *tr++ = ( Transit ) { .jdn = NAN, .kind = 0 };
+      }
+   free( tl.hits );
+   return ret;
+   }
+
+/** dump_transit_timeline() deallocates a TransitTimeline.
+ * @param t Pointer to a TransitTimeline.
+ */
+extern
+void
+dump_transit_timeline( TransitTimeline* t )
+   {
+   free( t );
+   }
+
+//####################################################################//
+//---- TEST ----------------------------------------------------------//
+//####################################################################//
+#ifdef TEST
+BEGIN_TESTS
+   g_test_init( &arg_count, &args, NULL );
+   init_swiss_ephemeris( NULL, NULL );
+   double jdn = 2451545.0;
+   Chart* natal = make_chart( "natal", jdn, -23.0, -43.0 );
+   int movers[] = { SE_SUN, SE_MOON, SE_MERCURY, SE_SATURN, SE_END };
+   int moon[] = { SE_MOON, SE_END };
+   int sun[] = { SE_SUN, SE_END };
+   //
+   TRIAL( "no leaks on find_transits()",
+      BOUND(
+         Transit* ts = find_transits( natal, jdn + 100.0, jdn + 130.0, movers, NULL );
+         free( ts );
+         );
+      );
+   TRIAL( "find_transits() fails on a point the ephemeris fails on",
+      int count;
+      int ceres[] = { SE_SUN, SE_CERES, SE_END };
+      ENSURE( NULL == find_transits( natal, jdn, jdn + 30.0, ceres, &count ) );
+      ENSURE( count == -1 );
+      );
+   TRIAL( "every transit is an exact aspect, in order of time",
+      int count;
+      char err[AS_MAXCH];
+      double ret[6];
+      Transit* ts = find_transits( natal, jdn, jdn + 365.0, movers, &count );
+      ENSURE( count > 0 );
+      ENSURE( ts[count].kind == 0 );
+      for ( int k = 0; k < count; k++ )
+         {
+         AVOID( k && ts[k].jdn < ts[k-1].jdn );
+         AVOID( ts[k].jdn < jdn || ts[k].jdn > jdn + 365.0 );
+         swe_calc_ut( ts[k].jdn, ts[k].point, SEFLG_SPEED, ret, err );
+         double d = fabs( swe_difdeg2n( ret[0], natal->points[ts[k].target].lon ) );
+         AVOID( fabs( d - ts[k].angle ) > 1e-6 );
+         }
+      free( ts );
+      );
+   TRIAL( "no Moon transit is missed, compared to sampling",
+      int count;
+      int sampled = 0;
+      char err[AS_MAXCH];
+      double ret[6];
+      double prev = NAN;
+      double from = jdn + 40.0;
+      double to = from + 30.0;
+      // every 0.01 days, the Moon makes less than 0.2 degrees
+      for ( double t = from; t <= to; t += 0.01 )
+         {
+         swe_calc_ut( t, SE_MOON, SEFLG_SPEED, ret, err );
+         if ( !isnan( prev ) && fabs( swe_difdeg2n( ret[0], natal->points[3].lon + 90.0 ) ) < 1.0 )
+            {
+            if ( swe_difdeg2n( prev, natal->points[3].lon + 90.0 ) < 0.0
+                 && swe_difdeg2n( ret[0], natal->points[3].lon + 90.0 ) >= 0.0 )
+               {
+               sampled++;
+               }
+            }
+         prev = ret[0];
+         }
+      Transit* ts = find_transits( natal, from, to, moon, &count );
+      int squares = 0;
+      for ( Transit* each = ts; each->kind; each++ )
+         {
+         if ( each->target == 3 && each->kind == 4 )
+            {
+            swe_calc_ut( each->jdn, SE_MOON, SEFLG_SPEED, ret, err );
+            if ( fabs( swe_difdeg2n( ret[0], natal->points[3].lon + 90.0 ) ) < 1e-6 ) { squares++; }
+            }
+         }
+      ENSURE( sampled > 0 );
+      ENSURE( squares == sampled );
+      free( ts );
+      );
+   TRIAL( "the Sun crosses each natal cusp once a year",
+      int count;
+      Transit* ts = find_transits( natal, jdn + 1.0, jdn + 1.0 + 365.2422, sun, &count );
+      int conj[12] = {};
+      for ( Transit* each = ts; each->kind; each++ )
+         {
+         if ( each->target < 0 && each->kind == 1 ) { conj[-each->target - 1]++; }
+         }
+      for ( int h = 0; h < 12; h++ ) { AVOID( conj[h] != 1 ); }
+      free( ts );
+      );
+   TRIAL( "a timeline of many charts equals find_transits() of each",
+      enum { MANY = 12 };
+      Event evs[MANY];
+      for ( int k = 0; k < MANY; k++ )
+         {
+         evs[k].jdn = g_test_rand_double_range( 2435000.0, 2460000.0 );
+         evs[k].lat = g_test_rand_double_range( -60.0, 60.0 );
+         evs[k].lon = g_test_rand_double_range( -180.0, 180.0 );
+         evs[k].name = "natal";
+         }
+      ChartBatch* b = make_chart_batch( get_chart_config(), MANY );
+      fill_chart_batch( b, evs, MANY );
+      BOUND(
+         TransitTimeline* tt = make_transit_timeline( b, jdn, jdn + 90.0, movers );
+         ENSURE( tt->chart_count == MANY );
+         for ( int k = 0; k < MANY; k++ )
+            {
+            int count;
+            Chart* c = make_chart( "natal", evs[k].jdn, evs[k].lat, evs[k].lon );
+            Transit* ts = find_transits( c, jdn, jdn + 90.0, movers, &count );
+            // the ends of the span may differ by a hair, so skip them
+            int inner = 0;
+            int found = 0;
+            for ( int i = 0; i < count; i++ )
+               {
+               if ( ts[i].jdn < jdn + 0.01 || ts[i].jdn > jdn + 89.99 ) { continue; }
+               inner++;
+               for ( Transit* each = tt->charts[k]; each->kind; each++ )
+                  {
+                  if ( each->point == ts[i].point && each->target == ts[i].target
+                       && each->kind == ts[i].kind && fabs( each->jdn - ts[i].jdn ) < 1e-4 )
+                     {
+                     found++;
+                     break;
+                     }
+                  }
+               }
+            AVOID( found != inner );
+            AVOID( abs( tt->counts[k] - count ) > 2 );
+            AVOID( tt->charts[k][tt->counts[k]].kind != 0 );
+            free( ts );
+            dump_chart( c );
+            }
+         dump_transit_timeline( tt );
+         );
+      dump_chart_batch( b );
+      );
+   dump_chart( natal );
+   end_swiss_ephemeris();
+END_TESTS
+#endif //TEST